@@ -238,6 +238,7 @@ bind_init(void)
 	bind_add(BIND_SCOPE_LIBRARY, 'd', "delete-entry");
 	bind_add(BIND_SCOPE_LIBRARY, 'a', "add-entry -q");
 	bind_add(BIND_SCOPE_LIBRARY, 'l', "delete-entry -a");
+	bind_add(BIND_SCOPE_LIBRARY, 'f', "filter-prompt");
 
 	bind_add(BIND_SCOPE_PLAYLIST, 'a', "add-entry -q");
 
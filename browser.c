@@ -30,8 +30,10 @@ struct browser_entry {
 };
 
 static void		 browser_free_entry(void *);
+static struct menu_entry *browser_get_next_entry(void);
 static void		 browser_read_dir(void);
-static int		 browser_search_entry(const void *, const char *);
+static int		 browser_search_entry(const void *,
+			    const struct pattern *);
 static void		 browser_select_entry(const char *);
 
 static pthread_mutex_t	 browser_menu_mtx = PTHREAD_MUTEX_INITIALIZER;
@@ -181,6 +183,32 @@ browser_get_entry_text(const void *e, char *buf, size_t bufsize)
 		strlcat(buf, "/", bufsize);
 }
 
+/*
+ * Return the first entry after the active entry that can be played, or NULL if
+ * there is none. The caller must hold browser_menu_mtx.
+ */
+static struct menu_entry *
+browser_get_next_entry(void)
+{
+	struct menu_entry	*me;
+	struct browser_entry	*be;
+
+	if ((me = menu_get_active_entry(browser_menu)) == NULL)
+		return NULL;
+
+	for (;;) {
+		if ((me = menu_get_next_entry(me)) == NULL) {
+			if (!option_get_boolean("repeat-all"))
+				return NULL;
+			me = menu_get_first_entry(browser_menu);
+		}
+
+		be = menu_get_entry_data(me);
+		if (be->ip != NULL)
+			return me;
+	}
+}
+
 struct track *
 browser_get_next_track(void)
 {
@@ -190,29 +218,16 @@ browser_get_next_track(void)
 	char			*path;
 
 	XPTHREAD_MUTEX_LOCK(&browser_menu_mtx);
-	if ((me = menu_get_active_entry(browser_menu)) == NULL)
+	if ((me = browser_get_next_entry()) == NULL)
 		t = NULL;
-	else
-		for (;;) {
-			if ((me = menu_get_next_entry(me)) == NULL) {
-				if (!option_get_boolean("repeat-all")) {
-					t = NULL;
-					break;
-				}
-				me = menu_get_first_entry(browser_menu);
-			}
-
-			be = menu_get_entry_data(me);
-			if (be->ip != NULL) {
-				xasprintf(&path, "%s/%s", browser_dir,
-				    be->name);
-				t = track_get(path, be->ip);
-				free(path);
-				if (t != NULL)
-					menu_activate_entry(browser_menu, me);
-				break;
-			}
-		}
+	else {
+		be = menu_get_entry_data(me);
+		xasprintf(&path, "%s/%s", browser_dir, be->name);
+		t = track_get(path, be->ip);
+		free(path);
+		if (t != NULL)
+			menu_activate_entry(browser_menu, me);
+	}
 	XPTHREAD_MUTEX_UNLOCK(&browser_menu_mtx);
 
 	browser_print();
@@ -266,6 +281,24 @@ browser_init(void)
 	browser_read_dir();
 }
 
+char *
+browser_peek_next_path(void)
+{
+	struct menu_entry	*me;
+	struct browser_entry	*be;
+	char			*path;
+
+	path = NULL;
+	XPTHREAD_MUTEX_LOCK(&browser_menu_mtx);
+	if ((me = browser_get_next_entry()) != NULL) {
+		be = menu_get_entry_data(me);
+		xasprintf(&path, "%s/%s", browser_dir, be->name);
+	}
+	XPTHREAD_MUTEX_UNLOCK(&browser_menu_mtx);
+
+	return path;
+}
+
 void
 browser_print(void)
 {
@@ -385,12 +418,12 @@ browser_refresh_dir(void)
 }
 
 static int
-browser_search_entry(const void *e, const char *search)
+browser_search_entry(const void *e, const struct pattern *p)
 {
 	const struct browser_entry *be;
 
 	be = e;
-	return strcasestr(be->name, search) != NULL ? 0 : -1;
+	return pattern_match(p, be->name) ? 0 : -1;
 }
 
 void
@@ -14,151 +14,698 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+/*
+ * The metadata cache file consists of a header, a table of fixed-size
+ * records, an index that lists the records in order of path, and a section
+ * with the strings the records refer to. Identical strings are stored only
+ * once. A string is referred to by its offset in the string section; offset 0
+ * is the empty string and denotes a NULL field.
+ *
+ * Each record also stores the time its track was last used. When the cache is
+ * saved, the entries that have not been used for the longest time are dropped
+ * if there are too many of them; see track_write_cache(). The time the track
+ * was added is stored as well, so that tracks can be sorted by it.
+ *
+ * The file is mapped into memory when siren starts. Records are looked up
+ * through the index and converted into tracks only when needed; the fields of
+ * such a track point into the mapping. A new file is saved by save_file(),
+ * which renames it over the old one, so that the mapped file is never changed.
+ *
+ * Versions 0 to 2 of the file were in a text format, with NUL-separated
+ * fields. Such a file is converted to the current format in memory when it is
+ * read.
+ */
+
 #include "config.h"
 
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
 #include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "siren.h"
 
 #define CACHE_BUFSIZE	4096
-#define CACHE_VERSION	2
-
-static int		 cache_open_read(const char *);
-static int		 cache_open_write(const char *);
+#define CACHE_VERSION	3
+
+/* Last version in the text format. */
+#define CACHE_VERSION_TEXT 2
+
+#define CACHE_MAGIC	"SRNC"
+#define CACHE_BYTEORDER	0x01020304
+
+/* Record flags. */
+#define CACHE_PROBE	0x1
+
+struct cache_header {
+	char		magic[4];
+	uint32_t	version;
+	uint32_t	byteorder;
+	uint32_t	recordsize;
+	uint64_t	nentries;
+	uint64_t	records;	/* Offset of record table	*/
+	uint64_t	index;		/* Offset of path index		*/
+	uint64_t	strings;	/* Offset of string section	*/
+	uint64_t	stringsize;
+};
+
+struct cache_record {
+	int64_t		mtime;
+	int64_t		size;
+	uint64_t	ino;
+	uint64_t	dev;
+	int64_t		probe_offset;
+	uint32_t	path;
+	uint32_t	album;
+	uint32_t	albumartist;
+	uint32_t	artist;
+	uint32_t	comment;
+	uint32_t	date;
+	uint32_t	discnumber;
+	uint32_t	disctotal;
+	uint32_t	genre;
+	uint32_t	title;
+	uint32_t	tracknumber;
+	uint32_t	tracktotal;
+	uint32_t	duration;
+	uint32_t	flags;
+	uint32_t	probe_nbits;
+	uint32_t	probe_nchannels;
+	uint32_t	probe_rate;
+	uint32_t	probe_byte_order;
+	int32_t		probe_stream;
+	uint32_t	probe_data;
+	uint32_t	probe_datasize;
+	int64_t		atime;
+	int64_t		added;
+};
+
+static uint32_t		 cache_add_data(const void *, size_t);
+static uint32_t		 cache_add_string(const char *);
+static void		 cache_add_record(const struct cache_record *);
+static int		 cache_attach(unsigned char *, size_t, int);
+static void		 cache_begin(void);
+static int		 cache_cmp_index(const void *, const void *);
+static unsigned char	*cache_finish(size_t *);
+static void		 cache_free_builder(void);
+static int		 cache_get_record(size_t, struct cache_record *);
+static char		*cache_get_string(uint32_t);
+static uint32_t		 cache_hash_string(const char *);
+static int		 cache_read_field(char **);
 static int		 cache_read_number(unsigned int *);
 static int		 cache_read_string(char **);
-static void		 cache_write_number(unsigned int);
-static void		 cache_write_string(const char *);
-
+static int		 cache_read_text(const char *);
+static int		 cache_read_text_entry(struct track *);
+
+/* The cache that was read. */
+static unsigned char	*cache_map;
+static size_t		 cache_mapsize;
+static int		 cache_mapped;
+static const unsigned char *cache_records;
+static const uint32_t	*cache_index;
+static char		*cache_strings;
+static size_t		 cache_nentries;
+static size_t		 cache_stringsize;
 static unsigned int	 cache_version;
+static int		 cache_read_ok;
+
+/* The cache being built. */
+static struct cache_record *cache_brecords;
+static size_t		 cache_bnrecords;
+static size_t		 cache_brecordssize;
+static char		*cache_bstrings;
+static size_t		 cache_bstringlen;
+static size_t		 cache_bstringsize;
+static uint32_t		*cache_bhash;		/* String offsets	*/
+static size_t		 cache_bhashsize;
+static size_t		 cache_bhashlen;
+
+/* State of the text-format reader. */
 static FILE		*cache_fp;
 static size_t		 cache_bufidx;
 static size_t		 cache_buflen;
 static size_t		 cache_bufsize;
 static char		*cache_buf;
 
-void
-cache_close(void)
+/*
+ * Add binary data to the string section of the cache being built. The data is
+ * not deduplicated.
+ */
+static uint32_t
+cache_add_data(const void *data, size_t len)
 {
-	fclose(cache_fp);
-	free(cache_buf);
+	uint32_t off;
+
+	if (len == 0)
+		return 0;
+
+	if (cache_bstringlen + len > UINT32_MAX)
+		return UINT32_MAX;
+
+	while (cache_bstringlen + len > cache_bstringsize) {
+		cache_bstringsize *= 2;
+		cache_bstrings = xrealloc(cache_bstrings, cache_bstringsize);
+	}
+
+	off = cache_bstringlen;
+	memcpy(cache_bstrings + off, data, len);
+	cache_bstringlen += len;
+	return off;
 }
 
-int
-cache_open(enum cache_mode mode)
+static void
+cache_add_record(const struct cache_record *r)
 {
-	int	 ret;
-	char	*path;
+	if (cache_bnrecords == cache_brecordssize) {
+		cache_brecordssize *= 2;
+		cache_brecords = xreallocarray(cache_brecords,
+		    cache_brecordssize, sizeof *cache_brecords);
+	}
+	cache_brecords[cache_bnrecords++] = *r;
+}
 
-	path = conf_get_path(CACHE_FILE);
+/*
+ * Add a string to the string section of the cache being built, unless an
+ * identical string has been added already.
+ */
+static uint32_t
+cache_add_string(const char *s)
+{
+	uint32_t	*newhash, off;
+	size_t		 i, j, len;
+
+	if (s == NULL || *s == '\0')
+		return 0;
+
+	/* Keep the hash table at most half full. */
+	if (cache_bhashlen >= cache_bhashsize / 2) {
+		newhash = xreallocarray(NULL, cache_bhashsize * 2,
+		    sizeof *newhash);
+		memset(newhash, 0, cache_bhashsize * 2 * sizeof *newhash);
+		for (i = 0; i < cache_bhashsize; i++) {
+			if (cache_bhash[i] == 0)
+				continue;
+			j = cache_hash_string(cache_bstrings + cache_bhash[i]);
+			for (;;) {
+				j &= cache_bhashsize * 2 - 1;
+				if (newhash[j] == 0)
+					break;
+				j++;
+			}
+			newhash[j] = cache_bhash[i];
+		}
+		free(cache_bhash);
+		cache_bhash = newhash;
+		cache_bhashsize *= 2;
+	}
 
-	if (mode == CACHE_MODE_READ)
-		ret = cache_open_read(path);
-	else
-		ret = cache_open_write(path);
+	i = cache_hash_string(s);
+	for (;;) {
+		i &= cache_bhashsize - 1;
+		if (cache_bhash[i] == 0)
+			break;
+		if (!strcmp(cache_bstrings + cache_bhash[i], s))
+			return cache_bhash[i];
+		i++;
+	}
 
-	free(path);
-	return ret;
+	len = strlen(s) + 1;
+	if ((off = cache_add_data(s, len)) == UINT32_MAX)
+		return 0;
+
+	cache_bhash[i] = off;
+	cache_bhashlen++;
+	return off;
 }
 
+/*
+ * Use the specified cache image. If mapped is 0, the image was allocated with
+ * malloc().
+ */
 static int
-cache_open_read(const char *path)
+cache_attach(unsigned char *map, size_t size, int mapped)
 {
-	cache_fp = fopen(path, "r");
-	if (cache_fp == NULL) {
-		if (errno != ENOENT) {
-			LOG_ERR("fopen: %s", path);
-			msg_err("Cannot open metadata cache file");
-		}
+	struct cache_header	hdr;
+
+	if (size < sizeof hdr) {
+		LOG_ERRX("file too small");
 		return -1;
 	}
 
-	cache_bufidx = 0;
-	cache_buflen = 0;
-	cache_bufsize = CACHE_BUFSIZE;
-	cache_buf = xmalloc(cache_bufsize);
+	memcpy(&hdr, map, sizeof hdr);
 
-	if (cache_read_number(&cache_version) == -1) {
-		msg_errx("Cannot read metadata cache file");
-		goto error;
+	if (memcmp(hdr.magic, CACHE_MAGIC, sizeof hdr.magic)) {
+		LOG_ERRX("invalid magic");
+		return -1;
 	}
 
+	cache_version = hdr.version;
 	LOG_INFO("reading version %u", cache_version);
 
-	if (cache_version > CACHE_VERSION) {
+	if (hdr.version != CACHE_VERSION || hdr.byteorder != CACHE_BYTEORDER ||
+	    hdr.recordsize != sizeof(struct cache_record)) {
 		LOG_ERRX("unsupported metadata cache version");
 		msg_errx("Unsupported metadata cache version");
-		goto error;
+		return -1;
+	}
+
+	if (hdr.nentries > UINT32_MAX ||
+	    hdr.records % sizeof(int64_t) != 0 ||
+	    hdr.records > size ||
+	    hdr.nentries > (size - hdr.records) / sizeof(struct cache_record) ||
+	    hdr.index % sizeof(uint32_t) != 0 ||
+	    hdr.index > size ||
+	    hdr.nentries > (size - hdr.index) / sizeof *cache_index ||
+	    hdr.strings > size ||
+	    hdr.stringsize == 0 ||
+	    hdr.stringsize > size - hdr.strings ||
+	    map[hdr.strings] != '\0' ||
+	    map[hdr.strings + hdr.stringsize - 1] != '\0') {
+		LOG_ERRX("invalid header");
+		return -1;
 	}
 
+	cache_map = map;
+	cache_mapsize = size;
+	cache_mapped = mapped;
+	cache_records = map + hdr.records;
+	cache_index = (const uint32_t *)(map + hdr.index);
+	cache_strings = (char *)(map + hdr.strings);
+	cache_nentries = hdr.nentries;
+	cache_stringsize = hdr.stringsize;
 	return 0;
+}
+
+/*
+ * Start building a new cache.
+ */
+static void
+cache_begin(void)
+{
+	cache_bnrecords = 0;
+	cache_brecordssize = 1024;
+	cache_brecords = xreallocarray(NULL, cache_brecordssize,
+	    sizeof *cache_brecords);
+
+	/* Offset 0 is the empty string. */
+	cache_bstringsize = 64 * 1024;
+	cache_bstrings = xmalloc(cache_bstringsize);
+	cache_bstrings[0] = '\0';
+	cache_bstringlen = 1;
+
+	cache_bhashlen = 0;
+	cache_bhashsize = 1024;
+	cache_bhash = xreallocarray(NULL, cache_bhashsize,
+	    sizeof *cache_bhash);
+	memset(cache_bhash, 0, cache_bhashsize * sizeof *cache_bhash);
+}
+
+/*
+ * Save the cache that was built. The cache file is replaced by the save
+ * thread. If report is set, a message is shown once it has been saved.
+ */
+void
+cache_close(int report)
+{
+	unsigned char	*map;
+	size_t		 size;
+
+	map = cache_finish(&size);
+	save_file(conf_get_path(CACHE_FILE), map, size,
+	    report ? "Metadata saved" : NULL,
+	    "Cannot write metadata cache file");
+}
+
+static int
+cache_cmp_index(const void *p1, const void *p2)
+{
+	uint32_t i1, i2;
+
+	i1 = *(const uint32_t *)p1;
+	i2 = *(const uint32_t *)p2;
+	return strcmp(cache_bstrings + cache_brecords[i1].path,
+	    cache_bstrings + cache_brecords[i2].path);
+}
+
+/*
+ * Copy an entry of the cache that was read to the cache being built.
+ */
+void
+cache_copy_entry(size_t idx)
+{
+	struct cache_record r, nr;
+
+	if (cache_get_record(idx, &r) == -1)
+		return;
+
+	nr = r;
+	nr.path = cache_add_string(cache_get_string(r.path));
+	nr.album = cache_add_string(cache_get_string(r.album));
+	nr.albumartist = cache_add_string(cache_get_string(r.albumartist));
+	nr.artist = cache_add_string(cache_get_string(r.artist));
+	nr.comment = cache_add_string(cache_get_string(r.comment));
+	nr.date = cache_add_string(cache_get_string(r.date));
+	nr.discnumber = cache_add_string(cache_get_string(r.discnumber));
+	nr.disctotal = cache_add_string(cache_get_string(r.disctotal));
+	nr.genre = cache_add_string(cache_get_string(r.genre));
+	nr.title = cache_add_string(cache_get_string(r.title));
+	nr.tracknumber = cache_add_string(cache_get_string(r.tracknumber));
+	nr.tracktotal = cache_add_string(cache_get_string(r.tracktotal));
+
+	if (nr.flags & CACHE_PROBE) {
+		if (r.probe_data > cache_stringsize ||
+		    r.probe_datasize > cache_stringsize - r.probe_data)
+			nr.flags &= ~CACHE_PROBE;
+		else
+			nr.probe_data = cache_add_data(cache_strings +
+			    r.probe_data, r.probe_datasize);
+	}
+
+	if (nr.path != 0)
+		cache_add_record(&nr);
+}
+
+void
+cache_end(void)
+{
+	if (cache_map == NULL)
+		return;
+
+	if (cache_mapped) {
+		if (munmap(cache_map, cache_mapsize) == -1)
+			LOG_ERR("munmap");
+	} else
+		free(cache_map);
+
+	cache_map = NULL;
+	cache_nentries = 0;
+}
+
+/*
+ * Find the entry for the specified path. Its index is stored in idx. Return 0
+ * if the entry was found or -1 otherwise.
+ */
+int
+cache_find_entry(const char *path, size_t *idx)
+{
+	const char	*p;
+	size_t		 lo, hi, mid;
+	int		 cmp;
+
+	lo = 0;
+	hi = cache_nentries;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if ((p = cache_get_path(mid)) == NULL)
+			return -1;
+		if ((cmp = strcmp(path, p)) == 0) {
+			*idx = mid;
+			return 0;
+		}
+		if (cmp < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
 
-error:
-	free(cache_buf);
-	fclose(cache_fp);
 	return -1;
 }
 
+/*
+ * Assemble the cache that was built into a single buffer and return it. Its
+ * size is stored in size.
+ */
+static unsigned char *
+cache_finish(size_t *size)
+{
+	struct cache_header	 hdr;
+	unsigned char		*map;
+	uint32_t		*index;
+	size_t			 i;
+
+	/* Ensure the last string is terminated even if it is binary data. */
+	cache_add_data("", 1);
+
+	memset(&hdr, 0, sizeof hdr);
+	memcpy(hdr.magic, CACHE_MAGIC, sizeof hdr.magic);
+	hdr.version = CACHE_VERSION;
+	hdr.byteorder = CACHE_BYTEORDER;
+	hdr.recordsize = sizeof *cache_brecords;
+	hdr.nentries = cache_bnrecords;
+	hdr.records = sizeof hdr;
+	hdr.index = hdr.records + cache_bnrecords * sizeof *cache_brecords;
+	hdr.strings = hdr.index + cache_bnrecords * sizeof *index;
+	hdr.stringsize = cache_bstringlen;
+
+	*size = hdr.strings + hdr.stringsize;
+	map = xmalloc(*size);
+	memcpy(map, &hdr, sizeof hdr);
+	memcpy(map + hdr.records, cache_brecords,
+	    cache_bnrecords * sizeof *cache_brecords);
+	index = (uint32_t *)(map + hdr.index);
+	for (i = 0; i < cache_bnrecords; i++)
+		index[i] = i;
+	qsort(index, cache_bnrecords, sizeof *index, cache_cmp_index);
+	memcpy(map + hdr.strings, cache_bstrings, cache_bstringlen);
+
+	cache_free_builder();
+	return map;
+}
+
+static void
+cache_free_builder(void)
+{
+	free(cache_brecords);
+	free(cache_bstrings);
+	free(cache_bhash);
+	cache_brecords = NULL;
+	cache_bstrings = NULL;
+	cache_bhash = NULL;
+}
+
+/*
+ * Return 1 if the specified string is stored in the cache that was read, or 0
+ * otherwise. Such strings must not be freed.
+ */
+int
+cache_contains(const char *s)
+{
+	return cache_map != NULL && (const unsigned char *)s >= cache_map &&
+	    (const unsigned char *)s < cache_map + cache_mapsize;
+}
+
+/*
+ * Return the time the track of the specified entry was added. If it is not
+ * known, the modification time of the file is returned instead.
+ */
+int64_t
+cache_get_added(size_t idx)
+{
+	struct cache_record r;
+
+	if (cache_get_record(idx, &r) == -1)
+		return 0;
+	return (r.added != 0) ? r.added : r.mtime;
+}
+
+/*
+ * Return the time the track of the specified entry was last used, or 0 if it
+ * is not known.
+ */
+int64_t
+cache_get_atime(size_t idx)
+{
+	struct cache_record r;
+
+	if (cache_get_record(idx, &r) == -1)
+		return 0;
+	return r.atime;
+}
+
+size_t
+cache_get_nentries(void)
+{
+	return cache_nentries;
+}
+
+/*
+ * Return the path of the specified entry, or NULL if the entry is invalid.
+ */
+char *
+cache_get_path(size_t idx)
+{
+	struct cache_record r;
+
+	if (cache_get_record(idx, &r) == -1)
+		return NULL;
+	return cache_get_string(r.path);
+}
+
+/*
+ * Copy the specified record.
+ */
 static int
-cache_open_write(const char *path)
+cache_get_record(size_t idx, struct cache_record *r)
 {
-	cache_fp = fopen(path, "w");
-	if (cache_fp == NULL) {
-		LOG_ERR("fopen: %s", path);
-		msg_err("Cannot open metadata cache file");
+	uint32_t i;
+
+	if (idx >= cache_nentries)
 		return -1;
-	}
 
-	LOG_INFO("writing version %u", CACHE_VERSION);
+	i = cache_index[idx];
+	if (i >= cache_nentries) {
+		LOG_ERRX("entry %zu: invalid index", idx);
+		return -1;
+	}
 
-	cache_buf = NULL;
-	cache_write_number(CACHE_VERSION);
+	memcpy(r, cache_records + i * sizeof *r, sizeof *r);
 	return 0;
 }
 
+static char *
+cache_get_string(uint32_t off)
+{
+	if (off == 0)
+		return NULL;
+	if (off >= cache_stringsize) {
+		LOG_ERRX("%u: invalid string offset", off);
+		return NULL;
+	}
+	return cache_strings + off;
+}
+
+/* FNV-1a hash. */
+static uint32_t
+cache_hash_string(const char *s)
+{
+	uint32_t hash;
+
+	hash = 2166136261U;
+	for (; *s != '\0'; s++) {
+		hash ^= (unsigned char)*s;
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+/*
+ * Read the cache file. If it is in the current format, it is mapped into
+ * memory and only its header is examined.
+ */
+void
+cache_init(void)
+{
+	struct stat	 sb;
+	void		*map;
+	int		 fd;
+	char		*path;
+	char		 magic[sizeof CACHE_MAGIC - 1];
+
+	path = conf_get_path(CACHE_FILE);
+
+	if ((fd = open(path, O_RDONLY)) == -1) {
+		if (errno != ENOENT) {
+			LOG_ERR("open: %s", path);
+			msg_err("Cannot open metadata cache file");
+		}
+		goto out;
+	}
+
+	if (fstat(fd, &sb) == -1) {
+		LOG_ERR("fstat: %s", path);
+		goto error;
+	}
+
+	if (read(fd, magic, sizeof magic) != sizeof magic ||
+	    memcmp(magic, CACHE_MAGIC, sizeof magic)) {
+		/* Older text format. */
+		close(fd);
+		if (cache_read_text(path) == 0)
+			cache_read_ok = 1;
+		goto out;
+	}
+
+	if ((uintmax_t)sb.st_size > SIZE_MAX) {
+		LOG_ERRX("%s: file too large", path);
+		goto error;
+	}
+
+	map = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		LOG_ERR("mmap: %s", path);
+		goto error;
+	}
+	close(fd);
+
+	if (cache_attach(map, sb.st_size, 1) == -1) {
+		munmap(map, sb.st_size);
+		msg_errx("Cannot read metadata cache file");
+		goto out;
+	}
+
+	cache_read_ok = 1;
+	goto out;
+
+error:
+	close(fd);
+	msg_errx("Cannot read metadata cache file");
+out:
+	free(path);
+}
+
+/*
+ * Start building a new cache. It is saved when cache_close() is called.
+ */
+void
+cache_open(void)
+{
+	LOG_INFO("writing version %u", CACHE_VERSION);
+	cache_begin();
+}
+
+/*
+ * Fill in a track from the specified entry. The strings of the track point
+ * into the cache and must not be freed. The stream information is not read;
+ * see cache_read_probe().
+ */
 int
-cache_read_entry(struct track *t)
+cache_read_entry(size_t idx, struct track *t)
 {
-	int ret;
+	struct cache_record r;
+
+	if (cache_get_record(idx, &r) == -1 ||
+	    (t->path = cache_get_string(r.path)) == NULL)
+		return -1;
 
 	t->ip = NULL;
 	t->ipdata = NULL;
+	t->album = cache_get_string(r.album);
+	t->albumartist = cache_get_string(r.albumartist);
+	t->artist = cache_get_string(r.artist);
+	t->comment = cache_get_string(r.comment);
+	t->date = cache_get_string(r.date);
+	t->discnumber = cache_get_string(r.discnumber);
+	t->disctotal = cache_get_string(r.disctotal);
+	t->genre = cache_get_string(r.genre);
+	t->title = cache_get_string(r.title);
+	t->tracknumber = cache_get_string(r.tracknumber);
+	t->tracktotal = cache_get_string(r.tracktotal);
+	t->duration = r.duration;
+	t->stamp.mtime = r.mtime;
+	t->stamp.size = r.size;
+	t->stamp.ino = r.ino;
+	t->stamp.dev = r.dev;
+	t->probe = NULL;
 
-	ret = 0;
-	ret |= cache_read_string(&t->path);
-	if (cache_version < 2)
-		t->albumartist = NULL;
-	else
-		ret |= cache_read_string(&t->albumartist);
-	ret |= cache_read_string(&t->artist);
-	ret |= cache_read_string(&t->album);
-	ret |= cache_read_string(&t->date);
-	if (cache_version == 0)
-		t->discnumber = NULL;
-	else
-		ret |= cache_read_string(&t->discnumber);
-	if (cache_version < 2)
-		t->disctotal = NULL;
-	else
-		ret |= cache_read_string(&t->disctotal);
-	ret |= cache_read_string(&t->tracknumber);
-	if (cache_version < 2)
-		t->tracktotal = NULL;
-	else
-		ret |= cache_read_string(&t->tracktotal);
-	ret |= cache_read_string(&t->title);
-	ret |= cache_read_number(&t->duration);
-	ret |= cache_read_string(&t->genre);
-	if (cache_version < 2)
-		t->comment = NULL;
-	else
-		ret |= cache_read_string(&t->comment);
-	return ret;
+	return 0;
 }
 
 static int
@@ -237,6 +784,38 @@ cache_read_number(unsigned int *num)
 	return 0;
 }
 
+/*
+ * Read the stream information of the specified entry. The caller must free the
+ * data member of the probe structure. Return -1 if the entry has no stream
+ * information.
+ */
+int
+cache_read_probe(size_t idx, struct track_probe *p)
+{
+	struct cache_record r;
+
+	if (cache_get_record(idx, &r) == -1 || !(r.flags & CACHE_PROBE) ||
+	    r.probe_data > cache_stringsize ||
+	    r.probe_datasize > cache_stringsize - r.probe_data)
+		return -1;
+
+	p->format.nbits = r.probe_nbits;
+	p->format.nchannels = r.probe_nchannels;
+	p->format.rate = r.probe_rate;
+	p->format.byte_order = r.probe_byte_order;
+	p->stream = r.probe_stream;
+	p->offset = r.probe_offset;
+	p->datasize = r.probe_datasize;
+	if (p->datasize == 0)
+		p->data = NULL;
+	else {
+		p->data = xmalloc(p->datasize);
+		memcpy(p->data, cache_strings + r.probe_data, p->datasize);
+	}
+
+	return 0;
+}
+
 static int
 cache_read_string(char **str)
 {
@@ -251,41 +830,183 @@ cache_read_string(char **str)
 	return 0;
 }
 
-void
-cache_update(void)
+/*
+ * Read a cache file in the older text format and convert it to the current
+ * format in memory.
+ */
+static int
+cache_read_text(const char *path)
 {
-	if (cache_fp != NULL && cache_version < CACHE_VERSION)
-		track_update_metadata(1);
+	struct track	 t;
+	unsigned char	*map;
+	size_t		 size;
+	unsigned int	 version;
+
+	if ((cache_fp = fopen(path, "r")) == NULL) {
+		LOG_ERR("fopen: %s", path);
+		msg_err("Cannot open metadata cache file");
+		return -1;
+	}
+
+	cache_bufidx = 0;
+	cache_buflen = 0;
+	cache_bufsize = CACHE_BUFSIZE;
+	cache_buf = xmalloc(cache_bufsize);
+
+	if (cache_read_number(&cache_version) == -1) {
+		msg_errx("Cannot read metadata cache file");
+		goto error;
+	}
+
+	LOG_INFO("reading version %u", cache_version);
+
+	if (cache_version > CACHE_VERSION_TEXT) {
+		LOG_ERRX("unsupported metadata cache version");
+		msg_errx("Unsupported metadata cache version");
+		goto error;
+	}
+
+	cache_begin();
+	while (cache_read_text_entry(&t) == 0) {
+		cache_write_entry(&t, 0, 0);
+		free(t.path);
+		free(t.album);
+		free(t.albumartist);
+		free(t.artist);
+		free(t.comment);
+		free(t.date);
+		free(t.discnumber);
+		free(t.disctotal);
+		free(t.genre);
+		free(t.title);
+		free(t.tracknumber);
+		free(t.tracktotal);
+	}
+
+	free(cache_buf);
+	fclose(cache_fp);
+
+	map = cache_finish(&size);
+
+	/* Keep the version that was read; cache_update() needs it. */
+	version = cache_version;
+	if (cache_attach(map, size, 0) == -1) {
+		free(map);
+		return -1;
+	}
+	cache_version = version;
+	return 0;
+
+error:
+	free(cache_buf);
+	fclose(cache_fp);
+	return -1;
 }
 
-void
-cache_write_entry(const struct track *t)
+static int
+cache_read_text_entry(struct track *t)
 {
-	cache_write_string(t->path);
-	cache_write_string(t->albumartist);
-	cache_write_string(t->artist);
-	cache_write_string(t->album);
-	cache_write_string(t->date);
-	cache_write_string(t->discnumber);
-	cache_write_string(t->disctotal);
-	cache_write_string(t->tracknumber);
-	cache_write_string(t->tracktotal);
-	cache_write_string(t->title);
-	cache_write_number(t->duration);
-	cache_write_string(t->genre);
-	cache_write_string(t->comment);
+	int ret;
+
+	memset(t, 0, sizeof *t);
+
+	ret = 0;
+	ret |= cache_read_string(&t->path);
+	if (cache_version >= 2)
+		ret |= cache_read_string(&t->albumartist);
+	ret |= cache_read_string(&t->artist);
+	ret |= cache_read_string(&t->album);
+	ret |= cache_read_string(&t->date);
+	if (cache_version >= 1)
+		ret |= cache_read_string(&t->discnumber);
+	if (cache_version >= 2)
+		ret |= cache_read_string(&t->disctotal);
+	ret |= cache_read_string(&t->tracknumber);
+	if (cache_version >= 2)
+		ret |= cache_read_string(&t->tracktotal);
+	ret |= cache_read_string(&t->title);
+	ret |= cache_read_number(&t->duration);
+	ret |= cache_read_string(&t->genre);
+	if (cache_version >= 2)
+		ret |= cache_read_string(&t->comment);
+
+	if (ret != 0 || t->path == NULL) {
+		free(t->path);
+		free(t->album);
+		free(t->albumartist);
+		free(t->artist);
+		free(t->comment);
+		free(t->date);
+		free(t->discnumber);
+		free(t->disctotal);
+		free(t->genre);
+		free(t->title);
+		free(t->tracknumber);
+		free(t->tracktotal);
+		return -1;
+	}
+
+	return 0;
 }
 
-static void
-cache_write_number(unsigned int num)
+void
+cache_update(void)
 {
-	fprintf(cache_fp, "%u%c", num, '\0');
+	if (!cache_read_ok || cache_version == CACHE_VERSION)
+		return;
+
+	if (cache_version < 2)
+		/* Some fields were not stored in these versions. */
+		track_update_metadata(1, 1);
+	else
+		track_write_cache(0);
 }
 
-static void
-cache_write_string(const char *str)
+/*
+ * Add a track to the cache being built. The atime and added arguments are the
+ * times the track was last used and added.
+ */
+void
+cache_write_entry(const struct track *t, int64_t atime, int64_t added)
 {
-	if (str != NULL)
-		fputs(str, cache_fp);
-	putc('\0', cache_fp);
+	struct cache_record r;
+
+	memset(&r, 0, sizeof r);
+	r.path = cache_add_string(t->path);
+	r.album = cache_add_string(t->album);
+	r.albumartist = cache_add_string(t->albumartist);
+	r.artist = cache_add_string(t->artist);
+	r.comment = cache_add_string(t->comment);
+	r.date = cache_add_string(t->date);
+	r.discnumber = cache_add_string(t->discnumber);
+	r.disctotal = cache_add_string(t->disctotal);
+	r.genre = cache_add_string(t->genre);
+	r.title = cache_add_string(t->title);
+	r.tracknumber = cache_add_string(t->tracknumber);
+	r.tracktotal = cache_add_string(t->tracktotal);
+	r.duration = t->duration;
+	r.mtime = t->stamp.mtime;
+	r.size = t->stamp.size;
+	r.ino = t->stamp.ino;
+	r.dev = t->stamp.dev;
+	r.atime = atime;
+	r.added = added;
+
+	if (t->probe != NULL) {
+		r.flags |= CACHE_PROBE;
+		r.probe_nbits = t->probe->format.nbits;
+		r.probe_nchannels = t->probe->format.nchannels;
+		r.probe_rate = t->probe->format.rate;
+		r.probe_byte_order = t->probe->format.byte_order;
+		r.probe_stream = t->probe->stream;
+		r.probe_offset = t->probe->offset;
+		r.probe_datasize = t->probe->datasize;
+		r.probe_data = cache_add_data(t->probe->data,
+		    t->probe->datasize);
+		if (r.probe_data == UINT32_MAX)
+			r.flags &= ~CACHE_PROBE;
+	}
+
+	if (r.path != 0)
+		cache_add_record(&r);
 }
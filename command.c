@@ -39,6 +39,12 @@ struct command_add_path_data {
 	char		**paths;
 };
 
+struct command_add_query_data {
+	enum view_id	  view;
+	struct query	 *query;
+	char		 *string;
+};
+
 struct command_bind_key_data {
 	enum bind_scope	  scope;
 	int		  key;
@@ -80,6 +86,11 @@ struct command_unbind_key_data {
 	int		  key;
 };
 
+struct command_update_metadata_data {
+	int		  delete;
+	int		  force;
+};
+
 #define COMMAND_EXEC_PROTOTYPE(cmd) \
     static void command_ ## cmd ## _exec(void *)
 #define COMMAND_FREE_PROTOTYPE(cmd) \
@@ -93,6 +104,9 @@ COMMAND_PARSE_PROTOTYPE(add_entry);
 COMMAND_EXEC_PROTOTYPE(add_path);
 COMMAND_FREE_PROTOTYPE(add_path);
 COMMAND_PARSE_PROTOTYPE(add_path);
+COMMAND_EXEC_PROTOTYPE(add_query);
+COMMAND_FREE_PROTOTYPE(add_query);
+COMMAND_PARSE_PROTOTYPE(add_query);
 COMMAND_EXEC_PROTOTYPE(bind_key);
 COMMAND_FREE_PROTOTYPE(bind_key);
 COMMAND_PARSE_PROTOTYPE(bind_key);
@@ -102,6 +116,7 @@ COMMAND_EXEC_PROTOTYPE(close_output_plugin);
 COMMAND_EXEC_PROTOTYPE(command_prompt);
 COMMAND_EXEC_PROTOTYPE(delete_entry);
 COMMAND_PARSE_PROTOTYPE(delete_entry);
+COMMAND_EXEC_PROTOTYPE(filter_prompt);
 COMMAND_PARSE_PROTOTYPE(generic);
 COMMAND_EXEC_PROTOTYPE(load_playlist);
 COMMAND_PARSE_PROTOTYPE(load_playlist);
@@ -173,6 +188,12 @@ static struct command command_list[] = {
 		command_add_path_exec,
 		command_add_path_free
 	},
+	{
+		"add-query",
+		command_add_query_parse,
+		command_add_query_exec,
+		command_add_query_free
+	},
 	{
 		"bind-key",
 		command_bind_key_parse,
@@ -203,6 +224,12 @@ static struct command command_list[] = {
 		command_delete_entry_exec,
 		free
 	},
+	{
+		"filter-prompt",
+		command_generic_parse,
+		command_filter_prompt_exec,
+		NULL
+	},
 	{
 		"load-playlist",
 		command_load_playlist_parse,
@@ -556,6 +583,77 @@ usage:
 	return -1;
 }
 
+static void
+command_add_query_exec(void *datap)
+{
+	struct command_add_query_data	*data;
+	struct track			**tracks;
+	size_t				  i, ntracks;
+
+	data = datap;
+	tracks = library_get_tracks(data->query, &ntracks);
+
+	if (ntracks == 0)
+		msg_errx("No matching tracks");
+	else if (data->view == VIEW_ID_PLAYLIST)
+		playlist_set_tracks(data->string, tracks, ntracks);
+	else
+		for (i = 0; i < ntracks; i++)
+			queue_add_track(tracks[i]);
+
+	free(tracks);
+}
+
+static void
+command_add_query_free(void *datap)
+{
+	struct command_add_query_data *data;
+
+	data = datap;
+	query_free(data->query);
+	free(data->string);
+	free(data);
+}
+
+static int
+command_add_query_parse(int argc, char **argv, void **datap, char **error)
+{
+	struct command_add_query_data	*data;
+	int				 c;
+
+	data = xmalloc(sizeof *data);
+	data->view = VIEW_ID_QUEUE;
+
+	while ((c = getopt(argc, argv, "pq")) != -1)
+		switch (c) {
+		case 'p':
+			data->view = VIEW_ID_PLAYLIST;
+			break;
+		case 'q':
+			data->view = VIEW_ID_QUEUE;
+			break;
+		default:
+			goto usage;
+		}
+
+	if (argc - optind != 1)
+		goto usage;
+
+	if ((data->query = query_init(argv[optind], error)) == NULL) {
+		free(data);
+		return -1;
+	}
+
+	data->string = xstrdup(argv[optind]);
+	*datap = data;
+	return 0;
+
+usage:
+	*error = xstrdup("Usage: add-query [-p | -q] query");
+	free(data);
+	return -1;
+}
+
 static void
 command_bind_key_exec(void *datap)
 {
@@ -739,6 +837,36 @@ command_free_data(struct command *cmd, void *data)
 		cmd->free(data);
 }
 
+static void
+command_filter_prompt_callback(char *query, UNUSED void *datap)
+{
+	char *error;
+
+	if (library_set_filter(query, &error) == -1) {
+		msg_errx("%s", error);
+		free(error);
+	}
+	free(query);
+}
+
+static void
+command_filter_prompt_change(const char *query, UNUSED void *datap)
+{
+	char *error;
+
+	/* The query may be incomplete; keep the current filter. */
+	if (library_set_filter(query, &error) == -1)
+		free(error);
+}
+
+static void
+command_filter_prompt_exec(UNUSED void *datap)
+{
+	view_select_view(VIEW_ID_LIBRARY);
+	prompt_get_filter_query("Filter: ", command_filter_prompt_change,
+	    command_filter_prompt_callback, NULL);
+}
+
 static int
 command_generic_parse(int argc, char **argv, void **datap, char **error)
 {
@@ -907,17 +1035,13 @@ command_reopen_output_plugin_exec(UNUSED void *datap)
 static void
 command_save_library_exec(UNUSED void *datap)
 {
-	if (library_write_file() == 0)
-		msg_info("Library saved");
+	library_write_file(1);
 }
 
 static void
 command_save_metadata_exec(UNUSED void *datap)
 {
-	if (track_write_cache())
-		msg_err("Cannot save metadata");
-	else
-		msg_info("Metadata saved");
+	track_write_cache(1);
 }
 
 static void
@@ -1315,6 +1439,8 @@ command_set_parse(int argc, char **argv, void **datap, char **error)
 		}
 		break;
 	case OPTION_TYPE_STRING:
+		if (option_check_string(argv[1], argv[2], error) == -1)
+			goto error;
 		data->value.string = xstrdup(argv[2]);
 		break;
 	}
@@ -1603,10 +1729,10 @@ command_unbind_key_parse(int argc, char **argv, void **datap, char **error)
 static void
 command_update_metadata_exec(void *datap)
 {
-	int delete;
+	struct command_update_metadata_data *data;
 
-	delete = *(int *)datap;
-	track_update_metadata(delete);
+	data = datap;
+	track_update_metadata(data->delete, data->force);
 	library_update();
 	playlist_update();
 	queue_update();
@@ -1617,15 +1743,20 @@ static int
 command_update_metadata_parse(int argc, char **argv, void **datap,
     char **error)
 {
-	int c, *delete;
+	struct command_update_metadata_data	*data;
+	int					 c;
 
-	delete = xmalloc(sizeof *delete);
-	*delete = 0;
+	data = xmalloc(sizeof *data);
+	data->delete = 0;
+	data->force = 0;
 
-	while ((c = getopt(argc, argv, "d")) != -1)
+	while ((c = getopt(argc, argv, "df")) != -1)
 		switch (c) {
 		case 'd':
-			*delete = 1;
+			data->delete = 1;
+			break;
+		case 'f':
+			data->force = 1;
 			break;
 		default:
 			goto usage;
@@ -1634,11 +1765,11 @@ command_update_metadata_parse(int argc, char **argv, void **datap,
 	if (argc != optind)
 		goto usage;
 
-	*datap = delete;
+	*datap = data;
 	return 0;
 
 usage:
-	*error = xstrdup("Usage: update-metadata [-d]");
-	free(delete);
+	*error = xstrdup("Usage: update-metadata [-df]");
+	free(data);
 	return -1;
 }
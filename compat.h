@@ -79,10 +79,6 @@ int		 pledge(const char *, const char *);
 void		*reallocarray(void *, size_t, size_t);
 #endif
 
-#ifndef HAVE_STRCASESTR
-char		*strcasestr(const char *, const char *);
-#endif
-
 #ifdef HAVE_GNU_STRERROR_R
 int		 xstrerror_r(int, char *, size_t);
 #define strerror_r xstrerror_r
@@ -0,0 +1,15 @@
+#define VERSION "0.11"
+#define PLUGIN_DIR "/usr/local/lib/siren"
+#define _GNU_SOURCE
+#define _OPENBSD_SOURCE
+#define _WITH_GETLINE
+#define HAVE_ASPRINTF
+#define HAVE_ERR
+#define HAVE_POSIX_FADVISE
+#define HAVE_REALLOCARRAY
+#define HAVE_RESIZETERM
+#define HAVE_STRSEP
+#define HAVE___BUILTIN_BSWAP16
+#define HAVE_USE_DEFAULT_COLORS
+#define HAVE_GNU_STRERROR_R
+#define HAVE_SYS_SOUNDCARD_H
@@ -0,0 +1,16 @@
+CFLAGS=
+CPPFLAGS=
+LDFLAGS=
+LDFLAGS_PROG=-Wl,--export-dynamic -pthread -lcurses
+CFLAGS_LIB=-fPIC
+LDFLAGS_LIB=-fPIC -shared
+BINDIR=/usr/local/bin
+MANDIR=/usr/local/man
+PLUGINDIR=/usr/local/lib/siren
+SRCS+=compat/pledge.c
+SRCS+=compat/strlcat.c
+SRCS+=compat/strlcpy.c
+SRCS+=compat/strtonum.c
+SRCS+=compat/strerror_r.c
+SRCS+=compat/getopt.c
+OP+=oss
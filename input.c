@@ -120,6 +120,9 @@ input_handle_key(void)
 				view_handle_key(key);
 			else
 				prompt_handle_key(key);
+
+			library_autosave();
+			track_autosave();
 		}
 	}
 }
@@ -0,0 +1,647 @@
+/*
+ * Copyright (c) 2026 Tim van der Molen <tim@kariliq.nl>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Buffered file input for input plug-ins. Files are read with pread() in
+ * large blocks and the kernel is advised that they will be read sequentially,
+ * so that it can read ahead.
+ *
+ * Files are deliberately not mapped into memory. If a mapped file were
+ * truncated while being played (for example, by a tag editor), accessing the
+ * mapping would raise SIGBUS.
+ *
+ * Because the kernel's read-ahead does not help much on network file systems
+ * or busy disks, the file being played is also read ahead by a separate
+ * prefetch thread. The prefetched data is kept in a window: a ring buffer that
+ * starts at the current position in the file. Once the file being played has
+ * been read far enough ahead, the thread reads the start of the file that will
+ * be played next.
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "siren.h"
+
+/* Size of the read buffer. */
+#define IO_BUFSIZE	(128 * 1024)
+
+/* Number of bytes the kernel is asked to read ahead when opening a file. */
+#define IO_READAHEAD	(1024 * 1024)
+
+/* Maximum number of bytes the prefetch thread reads at once. */
+#define IO_PREFETCH_CHUNK (128 * 1024)
+
+struct io_window {
+	unsigned char	*data;
+	size_t		 size;
+	size_t		 head;
+	size_t		 len;
+	int64_t		 pos;		/* File position of head	*/
+	int		 eof;
+	unsigned int	 gen;
+};
+
+struct io {
+	int		 fd;
+	int		 eof;
+	int64_t		 pos;		/* Current position		*/
+	int64_t		 bufpos;	/* File position of buffer	*/
+	size_t		 buflen;
+	unsigned char	*buf;
+	struct io_window *win;
+};
+
+/* The start of the file that will be played next. */
+struct io_warm {
+	char		*path;
+	int		 fd;
+	unsigned char	*data;
+	size_t		 size;
+	size_t		 len;
+	int		 eof;
+	unsigned int	 gen;
+};
+
+static void		 io_prefetch_attach(struct io *, const char *);
+static void		 io_prefetch_clear_warm(void);
+static int		 io_prefetch_fill_warm(void);
+static int		 io_prefetch_fill_window(void);
+static void		*io_prefetch_handler(void *);
+static void		 io_prefetch_wait(const void *);
+static ssize_t		 io_pread(int, void *, size_t, int64_t);
+static void		 io_window_discard(struct io_window *, int64_t);
+static size_t		 io_window_read(struct io *, unsigned char *, size_t);
+
+static pthread_t	 io_prefetch_thd;
+static pthread_mutex_t	 io_prefetch_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	 io_prefetch_cond = PTHREAD_COND_INITIALIZER;
+static int		 io_prefetch_quit;
+
+/* File being played. */
+static struct io	*io_prefetch_io;
+
+/* File that will be played next. */
+static struct io_warm	 io_prefetch_warm = { NULL, -1, NULL, 0, 0, 0, 0 };
+
+/* Window or io_warm structure being filled by the prefetch thread. */
+static const void	*io_prefetch_target;
+
+void
+io_close(struct io *io)
+{
+	if (io->win != NULL) {
+		XPTHREAD_MUTEX_LOCK(&io_prefetch_mtx);
+		io_prefetch_wait(io->win);
+		if (io_prefetch_io == io)
+			io_prefetch_io = NULL;
+		XPTHREAD_MUTEX_UNLOCK(&io_prefetch_mtx);
+		free(io->win->data);
+		free(io->win);
+	}
+
+	close(io->fd);
+	free(io->buf);
+	free(io);
+}
+
+void
+io_end(void)
+{
+	XPTHREAD_MUTEX_LOCK(&io_prefetch_mtx);
+	io_prefetch_quit = 1;
+	XPTHREAD_COND_BROADCAST(&io_prefetch_cond);
+	XPTHREAD_MUTEX_UNLOCK(&io_prefetch_mtx);
+
+	XPTHREAD_JOIN(io_prefetch_thd, NULL);
+	io_prefetch_clear_warm();
+}
+
+/*
+ * Return 1 if a previous read reached the end of the file, or 0 otherwise.
+ * Seeking clears the end-of-file indicator.
+ */
+int
+io_eof(const struct io *io)
+{
+	return io->eof;
+}
+
+int64_t
+io_get_size(const struct io *io)
+{
+	struct stat sb;
+
+	if (fstat(io->fd, &sb) == -1) {
+		LOG_ERR("fstat");
+		return -1;
+	}
+
+	return sb.st_size;
+}
+
+void
+io_init(void)
+{
+	XPTHREAD_CREATE(&io_prefetch_thd, NULL, io_prefetch_handler, NULL);
+}
+
+/*
+ * Open a file for reading. If the IO_PREFETCH flag is specified, the file is
+ * read ahead by the prefetch thread; this should be done only for the file
+ * being played. On failure, NULL is returned and errno is set.
+ */
+struct io *
+io_open(const char *path, int flags)
+{
+	struct io	*io;
+	int		 fd;
+
+	if ((fd = open(path, O_RDONLY)) == -1)
+		return NULL;
+
+#ifdef HAVE_POSIX_FADVISE
+	errno = posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	if (errno == 0)
+		errno = posix_fadvise(fd, 0, IO_READAHEAD,
+		    POSIX_FADV_WILLNEED);
+	if (errno != 0)
+		LOG_ERR("posix_fadvise: %s", path);
+#endif
+
+	io = xmalloc(sizeof *io);
+	io->fd = fd;
+	io->eof = 0;
+	io->pos = 0;
+	io->bufpos = 0;
+	io->buflen = 0;
+	io->buf = xmalloc(IO_BUFSIZE);
+	io->win = NULL;
+
+	if (flags & IO_PREFETCH)
+		io_prefetch_attach(io, path);
+
+	return io;
+}
+
+/*
+ * Let the prefetch thread read ahead the specified file. If the start of the
+ * file was read by io_prefetch_file(), that data is used.
+ */
+static void
+io_prefetch_attach(struct io *io, const char *path)
+{
+	struct io_window	*win;
+	struct io_warm		*warm;
+	size_t			 size;
+	int			 bufsize, lookahead;
+
+	bufsize = option_get_number("prefetch-buffer-size");
+	lookahead = option_get_number("prefetch-lookahead");
+	size = (size_t)(lookahead < bufsize ? lookahead : bufsize) * 1024;
+	if (size == 0)
+		return;
+
+	win = xmalloc(sizeof *win);
+	win->data = xmalloc(size);
+	win->size = size;
+	win->head = 0;
+	win->len = 0;
+	win->pos = 0;
+	win->eof = 0;
+	win->gen = 0;
+
+	XPTHREAD_MUTEX_LOCK(&io_prefetch_mtx);
+	if (io_prefetch_io != NULL) {
+		/* Another file is being played already. */
+		XPTHREAD_MUTEX_UNLOCK(&io_prefetch_mtx);
+		free(win->data);
+		free(win);
+		return;
+	}
+
+	warm = &io_prefetch_warm;
+	io_prefetch_wait(warm);
+	if (warm->path != NULL && strcmp(warm->path, path) == 0) {
+		win->len = warm->len < size ? warm->len : size;
+		memcpy(win->data, warm->data, win->len);
+		win->eof = warm->eof && warm->len <= size;
+		LOG_DEBUG("%s: using %zu prefetched bytes", path, win->len);
+		io_prefetch_clear_warm();
+	}
+
+	io->win = win;
+	io_prefetch_io = io;
+	XPTHREAD_COND_BROADCAST(&io_prefetch_cond);
+	XPTHREAD_MUTEX_UNLOCK(&io_prefetch_mtx);
+}
+
+/*
+ * The io_prefetch_mtx mutex must be locked before calling this function,
+ * unless the prefetch thread has exited.
+ */
+static void
+io_prefetch_clear_warm(void)
+{
+	struct io_warm *warm;
+
+	warm = &io_prefetch_warm;
+	if (warm->fd != -1)
+		close(warm->fd);
+	free(warm->path);
+	free(warm->data);
+	warm->path = NULL;
+	warm->fd = -1;
+	warm->data = NULL;
+	warm->size = 0;
+	warm->len = 0;
+	warm->eof = 0;
+	warm->gen++;
+}
+
+/*
+ * Start reading the start of the file that will be played next. The amount
+ * read is limited by the prefetch-buffer-size option, minus what is used to
+ * read ahead the file being played.
+ */
+void
+io_prefetch_file(const char *path)
+{
+	struct io_warm	*warm;
+	size_t		 size;
+	int		 bufsize, lookahead;
+
+	bufsize = option_get_number("prefetch-buffer-size");
+	lookahead = option_get_number("prefetch-lookahead");
+	if (lookahead >= bufsize)
+		return;
+	size = (size_t)(bufsize - lookahead) * 1024;
+
+	XPTHREAD_MUTEX_LOCK(&io_prefetch_mtx);
+	warm = &io_prefetch_warm;
+	if (warm->path == NULL || strcmp(warm->path, path) != 0) {
+		io_prefetch_wait(warm);
+		io_prefetch_clear_warm();
+		warm->path = xstrdup(path);
+		warm->data = xmalloc(size);
+		warm->size = size;
+		XPTHREAD_COND_BROADCAST(&io_prefetch_cond);
+	}
+	XPTHREAD_MUTEX_UNLOCK(&io_prefetch_mtx);
+}
+
+/*
+ * Read a chunk of the file that will be played next. Return 1 if there was
+ * work to do, or 0 otherwise.
+ *
+ * The io_prefetch_mtx mutex must be locked before calling this function.
+ */
+static int
+io_prefetch_fill_warm(void)
+{
+	struct io_warm	*warm;
+	char		*path;
+	size_t		 len;
+	ssize_t		 n;
+	unsigned int	 gen;
+	int		 fd;
+
+	warm = &io_prefetch_warm;
+	if (warm->path == NULL || warm->eof || warm->len == warm->size)
+		return 0;
+
+	gen = warm->gen;
+	io_prefetch_target = warm;
+
+	if (warm->fd == -1) {
+		path = xstrdup(warm->path);
+		XPTHREAD_MUTEX_UNLOCK(&io_prefetch_mtx);
+		if ((fd = open(path, O_RDONLY)) == -1)
+			LOG_ERR("open: %s", path);
+		free(path);
+		XPTHREAD_MUTEX_LOCK(&io_prefetch_mtx);
+
+		if (gen != warm->gen) {
+			if (fd != -1)
+				close(fd);
+		} else if (fd == -1)
+			warm->eof = 1;
+		else
+			warm->fd = fd;
+	} else {
+		len = warm->size - warm->len;
+		if (len > IO_PREFETCH_CHUNK)
+			len = IO_PREFETCH_CHUNK;
+
+		XPTHREAD_MUTEX_UNLOCK(&io_prefetch_mtx);
+		n = io_pread(warm->fd, warm->data + warm->len, len, warm->len);
+		XPTHREAD_MUTEX_LOCK(&io_prefetch_mtx);
+
+		if (n <= 0)
+			warm->eof = 1;
+		else
+			warm->len += n;
+	}
+
+	io_prefetch_target = NULL;
+	XPTHREAD_COND_BROADCAST(&io_prefetch_cond);
+	return 1;
+}
+
+/*
+ * Read a chunk of the file being played. Return 1 if there was work to do, or
+ * 0 otherwise.
+ *
+ * The io_prefetch_mtx mutex must be locked before calling this function.
+ */
+static int
+io_prefetch_fill_window(void)
+{
+	struct io_window	*win;
+	size_t			 len, tail;
+	ssize_t			 n;
+	int64_t			 pos;
+	unsigned int		 gen;
+	int			 fd;
+
+	if (io_prefetch_io == NULL)
+		return 0;
+
+	win = io_prefetch_io->win;
+	if (win->eof || win->len == win->size)
+		return 0;
+
+	/* Read into the free space following the data in the ring buffer. */
+	tail = (win->head + win->len) % win->size;
+	len = win->size - win->len;
+	if (len > win->size - tail)
+		len = win->size - tail;
+	if (len > IO_PREFETCH_CHUNK)
+		len = IO_PREFETCH_CHUNK;
+
+	fd = io_prefetch_io->fd;
+	pos = win->pos + win->len;
+	gen = win->gen;
+	io_prefetch_target = win;
+
+	XPTHREAD_MUTEX_UNLOCK(&io_prefetch_mtx);
+	n = io_pread(fd, win->data + tail, len, pos);
+	XPTHREAD_MUTEX_LOCK(&io_prefetch_mtx);
+
+	/* Discard the data if the window was moved in the meantime. */
+	if (gen == win->gen) {
+		if (n <= 0)
+			win->eof = 1;
+		else
+			win->len += n;
+	}
+
+	io_prefetch_target = NULL;
+	XPTHREAD_COND_BROADCAST(&io_prefetch_cond);
+	return 1;
+}
+
+static void *
+io_prefetch_handler(UNUSED void *p)
+{
+	sigset_t ss;
+
+	/* Let the main thread handle all signals. */
+	sigfillset(&ss);
+	pthread_sigmask(SIG_BLOCK, &ss, NULL);
+
+	XPTHREAD_MUTEX_LOCK(&io_prefetch_mtx);
+	while (!io_prefetch_quit)
+		if (!io_prefetch_fill_window() && !io_prefetch_fill_warm())
+			XPTHREAD_COND_WAIT(&io_prefetch_cond,
+			    &io_prefetch_mtx);
+	XPTHREAD_MUTEX_UNLOCK(&io_prefetch_mtx);
+
+	return NULL;
+}
+
+/*
+ * Wait until the prefetch thread has stopped filling the specified window or
+ * io_warm structure.
+ *
+ * The io_prefetch_mtx mutex must be locked before calling this function.
+ */
+static void
+io_prefetch_wait(const void *target)
+{
+	while (io_prefetch_target == target)
+		XPTHREAD_COND_WAIT(&io_prefetch_cond, &io_prefetch_mtx);
+}
+
+static ssize_t
+io_pread(int fd, void *buf, size_t len, int64_t pos)
+{
+	ssize_t n;
+
+	while ((n = pread(fd, buf, len, pos)) == -1 && errno == EINTR);
+	if (n == -1)
+		LOG_ERR("pread");
+	return n;
+}
+
+/*
+ * Read up to the specified number of bytes. Fewer bytes are read only if the
+ * end of the file is reached. On failure, -1 is returned.
+ */
+ssize_t
+io_read(struct io *io, void *buf, size_t len)
+{
+	unsigned char	*p;
+	size_t		 n, total;
+	ssize_t		 nread;
+
+	p = buf;
+	total = 0;
+	while (total < len) {
+		if (io->pos < io->bufpos ||
+		    io->pos >= io->bufpos + (int64_t)io->buflen) {
+			if (io->win != NULL) {
+				n = io_window_read(io, p + total, len - total);
+				if (n > 0) {
+					total += n;
+					continue;
+				}
+			}
+
+			/* Bypass the buffer for large reads. */
+			if (len - total >= IO_BUFSIZE) {
+				nread = io_pread(io->fd, p + total,
+				    len - total, io->pos);
+				if (nread == -1)
+					return -1;
+				if (io->win != NULL)
+					io_window_discard(io->win,
+					    io->pos + nread);
+				if (nread == 0) {
+					io->eof = 1;
+					break;
+				}
+				io->pos += nread;
+				total += nread;
+				continue;
+			}
+
+			nread = io_pread(io->fd, io->buf, IO_BUFSIZE, io->pos);
+			if (nread == -1)
+				return -1;
+			if (io->win != NULL)
+				io_window_discard(io->win, io->pos + nread);
+			io->bufpos = io->pos;
+			io->buflen = nread;
+			if (nread == 0) {
+				io->eof = 1;
+				break;
+			}
+		}
+
+		n = io->bufpos + io->buflen - io->pos;
+		if (n > len - total)
+			n = len - total;
+		memcpy(p + total, io->buf + (io->pos - io->bufpos), n);
+		io->pos += n;
+		total += n;
+	}
+
+	return total;
+}
+
+/*
+ * Set the position like lseek() does. On failure, -1 is returned and errno is
+ * set.
+ */
+int
+io_seek(struct io *io, int64_t offset, int whence)
+{
+	int64_t pos, size;
+
+	switch (whence) {
+	case SEEK_SET:
+		pos = offset;
+		break;
+	case SEEK_CUR:
+		pos = io->pos + offset;
+		break;
+	case SEEK_END:
+		if ((size = io_get_size(io)) == -1)
+			return -1;
+		pos = size + offset;
+		break;
+	default:
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (pos < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	io->pos = pos;
+	io->eof = 0;
+	return 0;
+}
+
+int64_t
+io_tell(const struct io *io)
+{
+	return io->pos;
+}
+
+/*
+ * Discard the data in the window before the specified position. If the
+ * position is outside the window, the window is emptied and moved to the
+ * position.
+ */
+static void
+io_window_discard(struct io_window *win, int64_t pos)
+{
+	size_t n;
+
+	XPTHREAD_MUTEX_LOCK(&io_prefetch_mtx);
+	if (pos >= win->pos && pos <= win->pos + (int64_t)win->len) {
+		n = pos - win->pos;
+		win->head = (win->head + n) % win->size;
+		win->len -= n;
+	} else {
+		win->head = 0;
+		win->len = 0;
+		win->eof = 0;
+		win->gen++;
+	}
+	win->pos = pos;
+	XPTHREAD_COND_BROADCAST(&io_prefetch_cond);
+	XPTHREAD_MUTEX_UNLOCK(&io_prefetch_mtx);
+}
+
+/*
+ * Copy data at the current position from the window. If the prefetch thread is
+ * reading the data, wait for it. Return the number of bytes copied, which is 0
+ * if the data is not in the window.
+ */
+static size_t
+io_window_read(struct io *io, unsigned char *buf, size_t len)
+{
+	struct io_window	*win;
+	size_t			 n, off, tail;
+
+	win = io->win;
+
+	XPTHREAD_MUTEX_LOCK(&io_prefetch_mtx);
+	while (io->pos == win->pos + (int64_t)win->len &&
+	    io_prefetch_target == win)
+		XPTHREAD_COND_WAIT(&io_prefetch_cond, &io_prefetch_mtx);
+
+	if (io->pos < win->pos || io->pos >= win->pos + (int64_t)win->len) {
+		XPTHREAD_MUTEX_UNLOCK(&io_prefetch_mtx);
+		return 0;
+	}
+
+	off = io->pos - win->pos;
+	n = win->len - off;
+	if (n > len)
+		n = len;
+
+	/* The data may wrap around the end of the ring buffer. */
+	off = (win->head + off) % win->size;
+	tail = win->size - off;
+	if (tail >= n)
+		memcpy(buf, win->data + off, n);
+	else {
+		memcpy(buf, win->data + off, tail);
+		memcpy(buf + tail, win->data, n - tail);
+	}
+	XPTHREAD_MUTEX_UNLOCK(&io_prefetch_mtx);
+
+	io->pos += n;
+	io_window_discard(win, io->pos);
+	return n;
+}
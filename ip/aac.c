@@ -66,11 +66,14 @@ const struct ip		 ip = {
 	IP_PRIORITY_AAC,
 	ip_aac_extensions,
 	ip_aac_close,
+	NULL,
 	ip_aac_get_metadata,
 	ip_aac_get_position,
 	ip_aac_init,
 	ip_aac_open,
 	ip_aac_read,
+	NULL,
+	NULL,
 	ip_aac_seek
 };
 
@@ -261,21 +264,45 @@ static int
 ip_aac_open(struct track *t)
 {
 	struct ip_aac_ipdata		*ipd;
+	struct track_probe		 probe;
 	NeAACDecConfigurationPtr	 cfg;
 	uint8_t				*esc;
 	uint32_t			 escsize;
 	unsigned long			 rate;
 	unsigned char			 nchan;
+	int				 probed;
 
 	ipd = xmalloc(sizeof *ipd);
 
-	if (ip_aac_open_file(t->path, &ipd->hdl, &ipd->track) == -1)
-		goto error1;
+	/*
+	 * If the track was opened before, use the AAC track and decoder
+	 * configuration found then instead of looking them up again.
+	 */
+	if (track_get_probe(t, &probe) == 0 && probe.datasize > 0) {
+		ipd->hdl = MP4Read(t->path);
+		if (ipd->hdl == MP4_INVALID_FILE_HANDLE) {
+			LOG_ERRX("%s: MP4Read() failed", t->path);
+			free(probe.data);
+			goto error1;
+		}
+		ipd->track = probe.stream;
+		esc = probe.data;
+		escsize = probe.datasize;
+		probed = 1;
+	} else {
+		if (ip_aac_open_file(t->path, &ipd->hdl, &ipd->track) == -1)
+			goto error1;
+		esc = NULL;
+		probed = 0;
+	}
 
 	ipd->aacbufsize = MP4GetTrackMaxSampleSize(ipd->hdl, ipd->track);
 	if (ipd->aacbufsize == 0) {
 		/* Avoid zero-size allocation. */
 		LOG_ERRX("%s: MP4GetTrackMaxSampleSize() returned 0", t->path);
+		if (probed)
+			/* The saved track may be stale. */
+			track_clear_probe(t);
 		goto error2;
 	}
 
@@ -293,18 +320,19 @@ ip_aac_open(struct track *t)
 		goto error3;
 	}
 
-	if (!MP4GetTrackESConfiguration(ipd->hdl, ipd->track, &esc,
-	    &escsize)) {
+	if (!probed && !MP4GetTrackESConfiguration(ipd->hdl, ipd->track,
+	    &esc, &escsize)) {
 		LOG_ERRX("%s: MP4GetTrackESConfiguration() failed", t->path);
+		esc = NULL;
 		goto error3;
 	}
 
 	if (NeAACDecInit2(ipd->dec, esc, escsize, &rate, &nchan) != 0) {
 		LOG_ERRX("%s: NeAACDecInit2() failed", t->path);
-		free(esc);
+		if (probed)
+			track_clear_probe(t);
 		goto error3;
 	}
-	free(esc);
 
 	ipd->nsamples = MP4GetTrackNumberOfSamples(ipd->hdl, ipd->track);
 	ipd->sample = 1;
@@ -317,11 +345,22 @@ ip_aac_open(struct track *t)
 	t->format.rate = rate;
 	t->ipdata = ipd;
 
+	if (!probed) {
+		probe.format = t->format;
+		probe.stream = ipd->track;
+		probe.offset = 0;
+		probe.datasize = escsize;
+		probe.data = esc;
+		track_set_probe(t, &probe);
+	}
+	free(esc);
+
 	return 0;
 
 error3:
 	NeAACDecClose(ipd->dec);
 error2:
+	free(esc);
 	MP4Close(ipd->hdl, 0);
 error1:
 	free(ipd);
@@ -117,16 +117,35 @@ static const char	*ip_ffmpeg_extensions[] = {
 	NULL
 };
 
+#ifdef IP_FFMPEG_AVSTREAM_CODEC_DEPRECATED
+/*
+ * Formats whose header fully describes the streams and contains the seek
+ * data, so that the stream information need not be found by reading packets.
+ */
+static const char	*ip_ffmpeg_probed_formats[] = {
+	"aiff",
+	"asf",
+	"caf",
+	"mov,mp4,m4a,3gp,3g2,mj2",
+	"w64",
+	"wav",
+	NULL
+};
+#endif
+
 const struct ip		 ip = {
 	"ffmpeg",
 	IP_PRIORITY_FFMPEG,
 	ip_ffmpeg_extensions,
 	ip_ffmpeg_close,
+	NULL,
 	ip_ffmpeg_get_metadata,
 	ip_ffmpeg_get_position,
 	ip_ffmpeg_init,
 	ip_ffmpeg_open,
 	ip_ffmpeg_read,
+	NULL,
+	NULL,
 	ip_ffmpeg_seek
 };
 
@@ -438,6 +457,56 @@ ip_ffmpeg_parse_metadata(struct track *t, AVDictionary *metadata)
 	}
 }
 
+#ifdef IP_FFMPEG_AVSTREAM_CODEC_DEPRECATED
+/*
+ * Return the index of the audio stream found when the track was last opened,
+ * provided the stream still has the same parameters and the format is one of
+ * ip_ffmpeg_probed_formats. Otherwise, return -1.
+ */
+static int
+ip_ffmpeg_get_probed_stream(struct track *t, AVFormatContext *fmtctx)
+{
+	struct track_probe	 probe;
+	AVCodecParameters	*par;
+	size_t			 i;
+	int			 nchannels;
+
+	/*
+	 * For other formats, such as MPEG transport streams and raw ADTS and
+	 * MP3 files, the sample format, the frame size, the duration and the
+	 * seek data are only known after finding the stream information.
+	 */
+	for (i = 0; ip_ffmpeg_probed_formats[i] != NULL; i++)
+		if (!strcmp(fmtctx->iformat->name, ip_ffmpeg_probed_formats[i]))
+			break;
+	if (ip_ffmpeg_probed_formats[i] == NULL)
+		return -1;
+
+	if (track_get_probe(t, &probe) == -1)
+		return -1;
+	free(probe.data);
+
+	if (probe.stream < 0 ||
+	    (unsigned int)probe.stream >= fmtctx->nb_streams)
+		return -1;
+
+	par = fmtctx->streams[probe.stream]->codecpar;
+#ifdef IP_FFMPEG_AVCODECCONTEXT_CHANNELS_DEPRECATED
+	nchannels = par->ch_layout.nb_channels;
+#else
+	nchannels = par->channels;
+#endif
+
+	if (par->codec_type != AVMEDIA_TYPE_AUDIO ||
+	    par->codec_id == AV_CODEC_ID_NONE || par->sample_rate <= 0 ||
+	    (unsigned int)par->sample_rate != probe.format.rate ||
+	    nchannels <= 0 || (unsigned int)nchannels != probe.format.nchannels)
+		return -1;
+
+	return probe.stream;
+}
+#endif
+
 static void
 ip_ffmpeg_close(struct track *t)
 {
@@ -519,8 +588,9 @@ static int
 ip_ffmpeg_open(struct track *t)
 {
 	struct ip_ffmpeg_ipdata	*ipd;
+	struct track_probe	 probe;
 	const AVCodec		*codec;
-	int			 ret;
+	int			 probed, ret;
 
 	ipd = xmalloc(sizeof *ipd);
 	ipd->fmtctx = NULL;
@@ -544,21 +614,35 @@ ip_ffmpeg_open(struct track *t)
 		goto error;
 	}
 
-	ret = avformat_find_stream_info(ipd->fmtctx, NULL);
-	if (ret < 0) {
-		IP_FFMPEG_LOG("avformat_find_stream_info");
-		IP_FFMPEG_MSG("Cannot get stream information");
-		goto error;
-	}
+	/*
+	 * Finding the stream information involves reading and decoding
+	 * packets, so skip it if we already know which stream to use and the
+	 * header of the file fully describes that stream.
+	 */
+#ifdef IP_FFMPEG_AVSTREAM_CODEC_DEPRECATED
+	ipd->stream = ip_ffmpeg_get_probed_stream(t, ipd->fmtctx);
+#else
+	ipd->stream = -1;
+#endif
+	probed = ipd->stream != -1;
 
-	ret = av_find_best_stream(ipd->fmtctx, AVMEDIA_TYPE_AUDIO, -1, -1,
-	    NULL, 0);
-	if (ret < 0) {
-		IP_FFMPEG_LOG("av_find_best_stream");
-		IP_FFMPEG_MSG("Cannot find audio stream");
-		goto error;
+	if (!probed) {
+		ret = avformat_find_stream_info(ipd->fmtctx, NULL);
+		if (ret < 0) {
+			IP_FFMPEG_LOG("avformat_find_stream_info");
+			IP_FFMPEG_MSG("Cannot get stream information");
+			goto error;
+		}
+
+		ret = av_find_best_stream(ipd->fmtctx, AVMEDIA_TYPE_AUDIO, -1,
+		    -1, NULL, 0);
+		if (ret < 0) {
+			IP_FFMPEG_LOG("av_find_best_stream");
+			IP_FFMPEG_MSG("Cannot find audio stream");
+			goto error;
+		}
+		ipd->stream = ret;
 	}
-	ipd->stream = ret;
 
 #ifdef IP_FFMPEG_AVSTREAM_CODEC_DEPRECATED
 	codec = avcodec_find_decoder(
@@ -636,6 +720,15 @@ ip_ffmpeg_open(struct track *t)
 		goto error;
 	}
 
+	if (!probed) {
+		probe.format = t->format;
+		probe.stream = ipd->stream;
+		probe.offset = 0;
+		probe.datasize = 0;
+		probe.data = NULL;
+		track_set_probe(t, &probe);
+	}
+
 	t->ipdata = ipd;
 	return 0;
 
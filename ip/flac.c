@@ -16,6 +16,7 @@
 
 #include "../config.h"
 
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -35,6 +36,7 @@
 
 struct ip_flac_ipdata {
 	FLAC__StreamDecoder *decoder;
+	struct io	*io;
 
 	unsigned int	 cursample;
 
@@ -44,11 +46,26 @@ struct ip_flac_ipdata {
 };
 
 static void		 ip_flac_close(struct track *);
+static FLAC__bool	 ip_flac_eof_cb(const FLAC__StreamDecoder *, void *);
+static void		 ip_flac_free_decoder(void *);
 static void		 ip_flac_get_metadata(struct track *);
 static int		 ip_flac_get_position(struct track *, unsigned int *);
+static FLAC__StreamDecoderLengthStatus ip_flac_length_cb(
+			    const FLAC__StreamDecoder *, FLAC__uint64 *,
+			    void *);
 static int		 ip_flac_open(struct track *);
 static int		 ip_flac_read(struct track *, struct sample_buffer *);
+static FLAC__StreamDecoderReadStatus ip_flac_read_cb(
+			    const FLAC__StreamDecoder *, FLAC__byte *, size_t *,
+			    void *);
+static void		*ip_flac_reset(struct track *);
+static int		 ip_flac_reuse(struct track *, void *);
 static void		 ip_flac_seek(struct track *, unsigned int);
+static FLAC__StreamDecoderSeekStatus ip_flac_seek_cb(
+			    const FLAC__StreamDecoder *, FLAC__uint64, void *);
+static FLAC__StreamDecoderTellStatus ip_flac_tell_cb(
+			    const FLAC__StreamDecoder *, FLAC__uint64 *,
+			    void *);
 static FLAC__StreamDecoderWriteStatus ip_flac_write_cb(
 			    const FLAC__StreamDecoder *, const FLAC__Frame *,
 			    const FLAC__int32 * const *, void *);
@@ -66,23 +83,32 @@ const struct ip		 ip = {
 	IP_PRIORITY_FLAC,
 	ip_flac_extensions,
 	ip_flac_close,
+	ip_flac_free_decoder,
 	ip_flac_get_metadata,
 	ip_flac_get_position,
 	NULL,
 	ip_flac_open,
 	ip_flac_read,
+	ip_flac_reset,
+	ip_flac_reuse,
 	ip_flac_seek
 };
 
 static void
 ip_flac_close(struct track *t)
 {
-	struct ip_flac_ipdata *ipd;
+	ip_flac_free_decoder(ip_flac_reset(t));
+}
 
+static FLAC__bool
+ip_flac_eof_cb(UNUSED const FLAC__StreamDecoder *decoder, void *tp)
+{
+	struct track		*t;
+	struct ip_flac_ipdata	*ipd;
+
+	t = tp;
 	ipd = t->ipdata;
-	FLAC__stream_decoder_finish(ipd->decoder);
-	FLAC__stream_decoder_delete(ipd->decoder);
-	free(ipd);
+	return io_eof(ipd->io) ? true : false;
 }
 
 static void
@@ -122,6 +148,16 @@ ip_flac_fill_buffer(const char *path, struct ip_flac_ipdata *ipd)
 	}
 }
 
+static void
+ip_flac_free_decoder(void *decoder)
+{
+	struct ip_flac_ipdata *ipd;
+
+	ipd = decoder;
+	FLAC__stream_decoder_delete(ipd->decoder);
+	free(ipd);
+}
+
 static void
 ip_flac_get_metadata(struct track *t)
 {
@@ -167,13 +203,26 @@ ip_flac_get_position(struct track *t, unsigned int *pos)
 	return 0;
 }
 
+static FLAC__StreamDecoderLengthStatus
+ip_flac_length_cb(UNUSED const FLAC__StreamDecoder *decoder,
+    FLAC__uint64 *length, void *tp)
+{
+	struct track		*t;
+	struct ip_flac_ipdata	*ipd;
+	int64_t			 size;
+
+	t = tp;
+	ipd = t->ipdata;
+	if ((size = io_get_size(ipd->io)) == -1)
+		return FLAC__STREAM_DECODER_LENGTH_STATUS_ERROR;
+	*length = size;
+	return FLAC__STREAM_DECODER_LENGTH_STATUS_OK;
+}
+
 static int
 ip_flac_open(struct track *t)
 {
-	struct ip_flac_ipdata		*ipd;
-	FLAC__StreamDecoderInitStatus	 status;
-	FLAC__StreamMetadata		 metadata;
-	FILE				*fp;
+	struct ip_flac_ipdata *ipd;
 
 	ipd = xmalloc(sizeof *ipd);
 
@@ -181,52 +230,11 @@ ip_flac_open(struct track *t)
 		LOG_ERRX("%s: FLAC__stream_decoder_new() failed", t->path);
 		msg_errx("%s: Cannot allocate memory for FLAC decoder",
 		    t->path);
-		goto error1;
-	}
-
-	if ((fp = fopen(t->path, "r")) == NULL) {
-		LOG_ERR("fopen: %s", t->path);
-		msg_err("%s: Cannot open track", t->path);
-		goto error2;
-	}
-
-	status = FLAC__stream_decoder_init_FILE(ipd->decoder, fp,
-	    ip_flac_write_cb, NULL, ip_flac_error_cb, t);
-
-	if (status != FLAC__STREAM_DECODER_INIT_STATUS_OK) {
-		LOG_ERRX("FLAC__stream_decoder_init: %s: %s", t->path,
-		    ip_flac_init_status_to_string(status));
-		msg_errx("%s: Cannot initialise FLAC decoder: %s", t->path,
-		    ip_flac_init_status_to_string(status));
-		fclose(fp);
-		goto error2;
-	}
-
-	if (FLAC__metadata_get_streaminfo(t->path, &metadata) == false) {
-		LOG_ERRX("%s: FLAC__metadata_get_streaminfo() failed",
-		    t->path);
-		msg_errx("%s: Cannot get stream information", t->path);
-		goto error3;
+		free(ipd);
+		return -1;
 	}
 
-	t->format.nbits = metadata.data.stream_info.bits_per_sample;
-	t->format.nchannels = metadata.data.stream_info.channels;
-	t->format.rate = metadata.data.stream_info.sample_rate;
-
-	ipd->bufidx = 0;
-	ipd->buflen = 0;
-	ipd->cursample = 0;
-
-	t->ipdata = ipd;
-	return 0;
-
-error3:
-	FLAC__stream_decoder_finish(ipd->decoder);
-error2:
-	FLAC__stream_decoder_delete(ipd->decoder);
-error1:
-	free(ipd);
-	return -1;
+	return ip_flac_reuse(t, ipd);
 }
 
 static int
@@ -272,6 +280,113 @@ ip_flac_read(struct track *t, struct sample_buffer *sb)
 	return sb->len_s != 0;
 }
 
+static FLAC__StreamDecoderReadStatus
+ip_flac_read_cb(UNUSED const FLAC__StreamDecoder *decoder, FLAC__byte *buf,
+    size_t *len, void *tp)
+{
+	struct track		*t;
+	struct ip_flac_ipdata	*ipd;
+	ssize_t			 n;
+
+	t = tp;
+	ipd = t->ipdata;
+	if ((n = io_read(ipd->io, buf, *len)) == -1) {
+		*len = 0;
+		return FLAC__STREAM_DECODER_READ_STATUS_ABORT;
+	}
+	*len = n;
+	if (n == 0)
+		return FLAC__STREAM_DECODER_READ_STATUS_END_OF_STREAM;
+	return FLAC__STREAM_DECODER_READ_STATUS_CONTINUE;
+}
+
+static void *
+ip_flac_reset(struct track *t)
+{
+	struct ip_flac_ipdata *ipd;
+
+	ipd = t->ipdata;
+	FLAC__stream_decoder_finish(ipd->decoder);
+	io_close(ipd->io);
+	return ipd;
+}
+
+static int
+ip_flac_reuse(struct track *t, void *decoder)
+{
+	struct ip_flac_ipdata		*ipd;
+	FLAC__StreamDecoderInitStatus	 status;
+	FLAC__StreamMetadata		 metadata;
+	struct track_probe		 probe;
+
+	ipd = decoder;
+
+	if ((ipd->io = io_open(t->path, IO_PREFETCH)) == NULL) {
+		LOG_ERR("open: %s", t->path);
+		msg_err("%s: Cannot open track", t->path);
+		goto error1;
+	}
+
+	/* The callbacks get the decoder data through the track. */
+	t->ipdata = ipd;
+
+	status = FLAC__stream_decoder_init_stream(ipd->decoder,
+	    ip_flac_read_cb, ip_flac_seek_cb, ip_flac_tell_cb,
+	    ip_flac_length_cb, ip_flac_eof_cb, ip_flac_write_cb, NULL,
+	    ip_flac_error_cb, t);
+
+	if (status != FLAC__STREAM_DECODER_INIT_STATUS_OK) {
+		LOG_ERRX("FLAC__stream_decoder_init: %s: %s", t->path,
+		    ip_flac_init_status_to_string(status));
+		msg_errx("%s: Cannot initialise FLAC decoder: %s", t->path,
+		    ip_flac_init_status_to_string(status));
+		io_close(ipd->io);
+		goto error1;
+	}
+
+	/*
+	 * Use the stream information saved when the track was last opened, so
+	 * that we need not open the file again to read it.
+	 */
+	if (track_get_probe(t, &probe) == 0) {
+		t->format.nbits = probe.format.nbits;
+		t->format.nchannels = probe.format.nchannels;
+		t->format.rate = probe.format.rate;
+		free(probe.data);
+	} else {
+		if (FLAC__metadata_get_streaminfo(t->path, &metadata) ==
+		    false) {
+			LOG_ERRX("%s: FLAC__metadata_get_streaminfo() failed",
+			    t->path);
+			msg_errx("%s: Cannot get stream information", t->path);
+			goto error2;
+		}
+
+		t->format.nbits = metadata.data.stream_info.bits_per_sample;
+		t->format.nchannels = metadata.data.stream_info.channels;
+		t->format.rate = metadata.data.stream_info.sample_rate;
+
+		probe.format = t->format;
+		probe.stream = 0;
+		probe.offset = 0;
+		probe.datasize = 0;
+		probe.data = NULL;
+		track_set_probe(t, &probe);
+	}
+
+	ipd->bufidx = 0;
+	ipd->buflen = 0;
+	ipd->cursample = 0;
+	return 0;
+
+error2:
+	FLAC__stream_decoder_finish(ipd->decoder);
+	io_close(ipd->io);
+error1:
+	ip_flac_free_decoder(ipd);
+	return -1;
+}
+
 static void
 ip_flac_seek(struct track *t, unsigned int sec)
 {
@@ -306,6 +421,33 @@ ip_flac_seek(struct track *t, unsigned int sec)
 	}
 }
 
+static FLAC__StreamDecoderSeekStatus
+ip_flac_seek_cb(UNUSED const FLAC__StreamDecoder *decoder, FLAC__uint64 offset,
+    void *tp)
+{
+	struct track		*t;
+	struct ip_flac_ipdata	*ipd;
+
+	t = tp;
+	ipd = t->ipdata;
+	if (io_seek(ipd->io, offset, SEEK_SET) == -1)
+		return FLAC__STREAM_DECODER_SEEK_STATUS_ERROR;
+	return FLAC__STREAM_DECODER_SEEK_STATUS_OK;
+}
+
+static FLAC__StreamDecoderTellStatus
+ip_flac_tell_cb(UNUSED const FLAC__StreamDecoder *decoder, FLAC__uint64 *offset,
+    void *tp)
+{
+	struct track		*t;
+	struct ip_flac_ipdata	*ipd;
+
+	t = tp;
+	ipd = t->ipdata;
+	*offset = io_tell(ipd->io);
+	return FLAC__STREAM_DECODER_TELL_STATUS_OK;
+}
+
 static FLAC__StreamDecoderWriteStatus
 ip_flac_write_cb(UNUSED const FLAC__StreamDecoder *decoder,
     const FLAC__Frame *frame, const FLAC__int32 * const *buffer, void *tp)
@@ -316,6 +458,20 @@ ip_flac_write_cb(UNUSED const FLAC__StreamDecoder *decoder,
 	t = tp;
 	ipd = t->ipdata;
 
+	/*
+	 * The format was taken from the stream information saved by
+	 * ip_flac_reuse(). Should it not match the frames, reading them would
+	 * go beyond the buffers of the decoder. Discard the saved information
+	 * so that the stream information is read again the next time.
+	 */
+	if (frame->header.channels != t->format.nchannels ||
+	    frame->header.bits_per_sample != t->format.nbits) {
+		LOG_ERRX("%s: frame format does not match stream information",
+		    t->path);
+		track_clear_probe(t);
+		return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
+	}
+
 	if (frame->header.number_type == FLAC__FRAME_NUMBER_TYPE_FRAME_NUMBER)
 		/* Fixed blocksize. */
 		ipd->cursample += frame->header.blocksize;
@@ -16,6 +16,8 @@
 
 #include "../config.h"
 
+#include <sys/types.h>
+
 #include <limits.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -43,7 +45,8 @@
     ((error) == MAD_ERROR_BUFLEN || (error) == MAD_ERROR_BUFPTR)
 
 struct ip_mad_ipdata {
-	FILE			*fp;
+	struct io		*io;
+	off_t			 offset;	/* Offset of first frame */
 
 	struct mad_stream	 stream;
 	struct mad_frame	 frame;
@@ -55,15 +58,18 @@ struct ip_mad_ipdata {
 };
 
 static void		 ip_mad_close(struct track *);
-static int		 ip_mad_decode_frame_header(FILE *,
+static void		 ip_mad_free_decoder(void *);
+static int		 ip_mad_decode_frame_header(struct io *,
 			    struct mad_stream *, struct mad_header *,
 			    unsigned char *);
-static int		 ip_mad_fill_stream(FILE *, struct mad_stream *,
+static int		 ip_mad_fill_stream(struct io *, struct mad_stream *,
 			    unsigned char *);
 static int		 ip_mad_get_position(struct track *, unsigned int *);
 static void		 ip_mad_get_metadata(struct track *);
 static int		 ip_mad_open(struct track *);
 static int		 ip_mad_read(struct track *, struct sample_buffer *);
+static void		*ip_mad_reset(struct track *);
+static int		 ip_mad_reuse(struct track *, void *);
 static void		 ip_mad_seek(struct track *, unsigned int);
 
 static const char	*ip_mad_extensions[] = { "mp1", "mp2", "mp3", NULL };
@@ -73,11 +79,14 @@ const struct ip		 ip = {
 	IP_PRIORITY_MAD,
 	ip_mad_extensions,
 	ip_mad_close,
+	ip_mad_free_decoder,
 	ip_mad_get_metadata,
 	ip_mad_get_position,
 	NULL,
 	ip_mad_open,
 	ip_mad_read,
+	ip_mad_reset,
+	ip_mad_reuse,
 	ip_mad_seek
 };
 
@@ -89,15 +98,15 @@ const struct ip		 ip = {
 static unsigned int
 ip_mad_calculate_duration(const char *file)
 {
-	FILE			*fp;
+	struct io		*io;
 	struct mad_stream	 stream;
 	struct mad_header	 header;
 	mad_timer_t		 timer;
 	int			 ret;
 	unsigned char		*buf;
 
-	if ((fp = fopen(file, "r")) == NULL) {
-		LOG_ERR("fopen: %s", file);
+	if ((io = io_open(file, 0)) == NULL) {
+		LOG_ERR("open: %s", file);
 		msg_err("%s: Cannot open track", file);
 		return 0;
 	}
@@ -108,14 +117,14 @@ ip_mad_calculate_duration(const char *file)
 	buf = xmalloc(IP_MAD_BUFSIZE + MAD_BUFFER_GUARD);
 
 	/* Read the whole file and sum the duration of all frames. */
-	while ((ret = ip_mad_decode_frame_header(fp, &stream, &header, buf)) ==
+	while ((ret = ip_mad_decode_frame_header(io, &stream, &header, buf)) ==
 	    IP_MAD_OK)
 		mad_timer_add(&timer, header.duration);
 
 	free(buf);
 	mad_header_finish(&header);
 	mad_stream_finish(&stream);
-	fclose(fp);
+	io_close(io);
 
 	if (ret == IP_MAD_ERROR)
 		return 0;
@@ -126,17 +135,7 @@ ip_mad_calculate_duration(const char *file)
 static void
 ip_mad_close(struct track *t)
 {
-	struct ip_mad_ipdata *ipd;
-
-	ipd = t->ipdata;
-
-	mad_synth_finish(&ipd->synth);
-	mad_frame_finish(&ipd->frame);
-	mad_stream_finish(&ipd->stream);
-	fclose(ipd->fp);
-
-	free(ipd->buf);
-	free(ipd);
+	ip_mad_free_decoder(ip_mad_reset(t));
 }
 
 static int
@@ -152,7 +151,7 @@ ip_mad_decode_frame(struct ip_mad_ipdata *ipd)
 			return IP_MAD_OK;
 		}
 		if (IP_MAD_NEED_REFILL(ipd->stream.error)) {
-			ret = ip_mad_fill_stream(ipd->fp, &ipd->stream,
+			ret = ip_mad_fill_stream(ipd->io, &ipd->stream,
 			    ipd->buf);
 			if (ret == IP_MAD_EOF || ret == IP_MAD_ERROR)
 				return ret;
@@ -166,7 +165,7 @@ ip_mad_decode_frame(struct ip_mad_ipdata *ipd)
 }
 
 static int
-ip_mad_decode_frame_header(FILE *fp, struct mad_stream *stream,
+ip_mad_decode_frame_header(struct io *io, struct mad_stream *stream,
     struct mad_header *header, unsigned char *buf)
 {
 	int		 ret;
@@ -176,7 +175,7 @@ ip_mad_decode_frame_header(FILE *fp, struct mad_stream *stream,
 		if (mad_header_decode(header, stream) == 0)
 			return IP_MAD_OK;
 		if (IP_MAD_NEED_REFILL(stream->error)) {
-			ret = ip_mad_fill_stream(fp, stream, buf);
+			ret = ip_mad_fill_stream(io, stream, buf);
 			if (ret == IP_MAD_EOF || ret == IP_MAD_ERROR)
 				return ret;
 		} else if (!MAD_RECOVERABLE(stream->error)) {
@@ -189,11 +188,13 @@ ip_mad_decode_frame_header(FILE *fp, struct mad_stream *stream,
 }
 
 static int
-ip_mad_fill_stream(FILE *fp, struct mad_stream *stream, unsigned char *buf)
+ip_mad_fill_stream(struct io *io, struct mad_stream *stream,
+    unsigned char *buf)
 {
-	size_t buffree, buflen, nread;
+	size_t	buffree, buflen;
+	ssize_t	nread;
 
-	if (feof(fp))
+	if (io_eof(io))
 		return IP_MAD_EOF;
 
 	if (stream->next_frame == NULL)
@@ -204,16 +205,13 @@ ip_mad_fill_stream(FILE *fp, struct mad_stream *stream, unsigned char *buf)
 	}
 	buffree = IP_MAD_BUFSIZE - buflen;
 
-	if ((nread = fread(buf + buflen, 1, buffree, fp)) < buffree) {
-		if (ferror(fp)) {
-			LOG_ERR("fread");
-			msg_err("Cannot read from track");
-			return IP_MAD_ERROR;
-		}
-		if (feof(fp)) {
-			memset(buf + buflen + nread, 0, MAD_BUFFER_GUARD);
-			buflen += MAD_BUFFER_GUARD;
-		}
+	if ((nread = io_read(io, buf + buflen, buffree)) == -1) {
+		msg_err("Cannot read from track");
+		return IP_MAD_ERROR;
+	}
+	if (io_eof(io)) {
+		memset(buf + buflen + nread, 0, MAD_BUFFER_GUARD);
+		buflen += MAD_BUFFER_GUARD;
 	}
 
 	buflen += nread;
@@ -222,6 +220,16 @@ ip_mad_fill_stream(FILE *fp, struct mad_stream *stream, unsigned char *buf)
 	return IP_MAD_OK;
 }
 
+static void
+ip_mad_free_decoder(void *decoder)
+{
+	struct ip_mad_ipdata *ipd;
+
+	ipd = decoder;
+	free(ipd->buf);
+	free(ipd);
+}
+
 /*
  * Convert a fixed-point number to a 16-bit integer sample.
  */
@@ -357,32 +365,8 @@ ip_mad_open(struct track *t)
 	struct ip_mad_ipdata *ipd;
 
 	ipd = xmalloc(sizeof *ipd);
-
-	if ((ipd->fp = fopen(t->path, "r")) == NULL) {
-		LOG_ERR("fopen: %s", t->path);
-		msg_err("%s: Cannot open track", t->path);
-		free(ipd);
-		return -1;
-	}
-
-	t->ipdata = ipd;
 	ipd->buf = xmalloc(IP_MAD_BUFSIZE + MAD_BUFFER_GUARD);
-	ipd->sampleidx = 0;
-
-	mad_stream_init(&ipd->stream);
-	mad_frame_init(&ipd->frame);
-	mad_synth_init(&ipd->synth);
-	mad_timer_reset(&ipd->timer);
-
-	if (ip_mad_decode_frame(ipd) != IP_MAD_OK) {
-		ip_mad_close(t);
-		return -1;
-	}
-	t->format.nbits = 16;
-	t->format.nchannels = MAD_NCHANNELS(&ipd->frame.header);
-	t->format.rate = ipd->frame.header.samplerate;
-
-	return 0;
+	return ip_mad_reuse(t, ipd);
 }
 
 static int
@@ -416,6 +400,102 @@ ip_mad_read(struct track *t, struct sample_buffer *sb)
 	return sb->len_s != 0;
 }
 
+static void *
+ip_mad_reset(struct track *t)
+{
+	struct ip_mad_ipdata *ipd;
+
+	ipd = t->ipdata;
+
+	mad_synth_finish(&ipd->synth);
+	mad_frame_finish(&ipd->frame);
+	mad_stream_finish(&ipd->stream);
+	io_close(ipd->io);
+
+	return ipd;
+}
+
+static int
+ip_mad_reuse(struct track *t, void *decoder)
+{
+	struct ip_mad_ipdata	*ipd;
+	struct track_probe	 probe;
+	int			 ret;
+
+	ipd = decoder;
+
+	if ((ipd->io = io_open(t->path, IO_PREFETCH)) == NULL) {
+		LOG_ERR("open: %s", t->path);
+		msg_err("%s: Cannot open track", t->path);
+		ip_mad_free_decoder(ipd);
+		return -1;
+	}
+
+	t->ipdata = ipd;
+	ipd->offset = 0;
+	ipd->sampleidx = 0;
+
+	mad_stream_init(&ipd->stream);
+	mad_frame_init(&ipd->frame);
+	mad_synth_init(&ipd->synth);
+	mad_timer_reset(&ipd->timer);
+
+	/*
+	 * If we know where the first frame is, seek to it directly instead of
+	 * searching for it through any tags at the start of the file.
+	 */
+	if (track_get_probe(t, &probe) == 0) {
+		free(probe.data);
+		if (io_seek(ipd->io, probe.offset, SEEK_SET) == -1)
+			LOG_ERR("io_seek: %s", t->path);
+		else
+			ipd->offset = probe.offset;
+	}
+
+	ret = ip_mad_decode_frame(ipd);
+	if (ret != IP_MAD_OK && ipd->offset != 0) {
+		/* The saved offset may be stale; try again from the start. */
+		LOG_ERRX("%s: cannot decode frame at saved offset", t->path);
+		track_clear_probe(t);
+		mad_stream_finish(&ipd->stream);
+		mad_stream_init(&ipd->stream);
+		if (io_seek(ipd->io, 0, SEEK_SET) == 0) {
+			ipd->offset = 0;
+			ret = ip_mad_decode_frame(ipd);
+		}
+	}
+
+	if (ret != IP_MAD_OK) {
+		ip_mad_close(t);
+		return -1;
+	}
+
+	t->format.nbits = 16;
+	t->format.nchannels = MAD_NCHANNELS(&ipd->frame.header);
+	t->format.rate = ipd->frame.header.samplerate;
+
+	/*
+	 * Save the offset of the first frame. If the end of the file has
+	 * already been reached, the buffer includes the guard bytes and the
+	 * offset cannot be computed this way, but then the file is too small
+	 * for it to matter.
+	 */
+	if (ipd->offset == 0 && !io_eof(ipd->io)) {
+		ipd->offset = io_tell(ipd->io) -
+		    (ipd->stream.bufend - ipd->stream.this_frame);
+		if (ipd->offset > 0) {
+			probe.format = t->format;
+			probe.stream = 0;
+			probe.offset = ipd->offset;
+			probe.datasize = 0;
+			probe.data = NULL;
+			track_set_probe(t, &probe);
+		}
+	}
+
+	return 0;
+}
+
 static void
 ip_mad_seek(struct track *t, unsigned int seekpos)
 {
@@ -427,8 +507,8 @@ ip_mad_seek(struct track *t, unsigned int seekpos)
 
 	pos = mad_timer_count(ipd->timer, MAD_UNITS_SECONDS);
 	if (pos > seekpos) {
-		if (fseek(ipd->fp, 0, SEEK_SET) == -1) {
-			LOG_ERR("fseek: %s", t->path);
+		if (io_seek(ipd->io, ipd->offset, SEEK_SET) == -1) {
+			LOG_ERR("io_seek: %s", t->path);
 			msg_err("Cannot seek");
 			return;
 		}
@@ -441,7 +521,7 @@ ip_mad_seek(struct track *t, unsigned int seekpos)
 	for (;;) {
 		if (pos >= seekpos)
 			break;
-		if (ip_mad_decode_frame_header(ipd->fp, &ipd->stream, &header,
+		if (ip_mad_decode_frame_header(ipd->io, &ipd->stream, &header,
 		    ipd->buf) != IP_MAD_OK)
 			break;
 		mad_timer_add(&ipd->timer, header.duration);
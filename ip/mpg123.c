@@ -16,7 +16,8 @@
 
 #include "../config.h"
 
-#include <fcntl.h>
+#include <sys/types.h>
+
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -27,19 +28,21 @@
 
 struct ip_mpg123_ipdata {
 	mpg123_handle	*hdl;
-	int		 fd;
+	struct io	*io;
 };
 
 static void	 ip_mpg123_close(struct track *);
-static void	 ip_mpg123_close_fd_handle(int fd, mpg123_handle *);
+static void	 ip_mpg123_close_handle(struct io *, mpg123_handle *);
 static int	 ip_mpg123_get_position(struct track *, unsigned int *);
 static void	 ip_mpg123_get_metadata(struct track *);
 static int	 ip_mpg123_init(void);
 static int	 ip_mpg123_open(struct track *);
-static int	 ip_mpg123_open_fd_handle(const char *, int *fd,
+static int	 ip_mpg123_open_handle(const char *, int, struct io **,
 		    mpg123_handle **);
 static int	 ip_mpg123_read(struct track *, struct sample_buffer *);
+static ssize_t	 ip_mpg123_read_cb(void *, void *, size_t);
 static void	 ip_mpg123_seek(struct track *, unsigned int);
+static off_t	 ip_mpg123_seek_cb(void *, off_t, int);
 
 static const char *ip_mpg123_extensions[] = { "mp1", "mp2", "mp3", NULL };
 
@@ -252,11 +255,14 @@ const struct ip	 ip = {
 	IP_PRIORITY_MPG123,
 	ip_mpg123_extensions,
 	ip_mpg123_close,
+	NULL,
 	ip_mpg123_get_metadata,
 	ip_mpg123_get_position,
 	ip_mpg123_init,
 	ip_mpg123_open,
 	ip_mpg123_read,
+	NULL,
+	NULL,
 	ip_mpg123_seek
 };
 
@@ -267,16 +273,16 @@ ip_mpg123_close(struct track *t)
 
 	ipd = t->ipdata;
 
-	ip_mpg123_close_fd_handle(ipd->fd, ipd->hdl);
+	ip_mpg123_close_handle(ipd->io, ipd->hdl);
 	free(ipd);
 }
 
 static void
-ip_mpg123_close_fd_handle(int fd, mpg123_handle *hdl)
+ip_mpg123_close_handle(struct io *io, mpg123_handle *hdl)
 {
 	mpg123_close(hdl);
 	mpg123_delete(hdl);
-	close(fd);
+	io_close(io);
 }
 
 static char *
@@ -314,9 +320,10 @@ ip_mpg123_get_metadata(struct track *t)
 	off_t		 length;
 	size_t		 i;
 	long		 rate;
-	int		 encoding, fd, nchannels;
+	struct io	*io;
+	int		 encoding, nchannels;
 
-	if (ip_mpg123_open_fd_handle(t->path, &fd, &hdl) == -1)
+	if (ip_mpg123_open_handle(t->path, 0, &io, &hdl) == -1)
 		return;
 
 	if (mpg123_getformat(hdl, &rate, &nchannels, &encoding) != MPG123_OK) {
@@ -387,7 +394,7 @@ ip_mpg123_get_metadata(struct track *t)
 	}
 
 out:
-	ip_mpg123_close_fd_handle(fd, hdl);
+	ip_mpg123_close_handle(io, hdl);
 }
 
 static int
@@ -425,10 +432,11 @@ ip_mpg123_open(struct track *t)
 {
 	struct ip_mpg123_ipdata	*ipd;
 	mpg123_handle		*hdl;
+	struct io		*io;
 	long			 rate;
-	int			 encoding, fd, nchannels;
+	int			 encoding, nchannels;
 
-	if (ip_mpg123_open_fd_handle(t->path, &fd, &hdl) == -1)
+	if (ip_mpg123_open_handle(t->path, IO_PREFETCH, &io, &hdl) == -1)
 		return -1;
 
 	if (mpg123_getformat(hdl, &rate, &nchannels, &encoding) != MPG123_OK) {
@@ -467,23 +475,23 @@ ip_mpg123_open(struct track *t)
 
 	ipd = xmalloc(sizeof *ipd);
 	ipd->hdl = hdl;
-	ipd->fd = fd;
+	ipd->io = io;
 	t->ipdata = ipd;
 
 	return 0;
 
 error:
-	ip_mpg123_close_fd_handle(fd, hdl);
+	ip_mpg123_close_handle(io, hdl);
 	return -1;
 }
 
 static int
-ip_mpg123_open_fd_handle(const char *path, int *fd, mpg123_handle **hdl)
+ip_mpg123_open_handle(const char *path, int flags, struct io **io,
+    mpg123_handle **hdl)
 {
 	int err;
 
-	*fd = open(path, O_RDONLY);
-	if (*fd == -1) {
+	if ((*io = io_open(path, flags)) == NULL) {
 		LOG_ERR("open: %s", path);
 		msg_err("%s: Cannot open track", path);
 		return -1;
@@ -494,20 +502,23 @@ ip_mpg123_open_fd_handle(const char *path, int *fd, mpg123_handle **hdl)
 		LOG_ERRX("mpg123_new: %s", mpg123_plain_strerror(err));
 		msg_errx("Cannot create handle: %s",
 		    mpg123_plain_strerror(err));
-		close(*fd);
+		io_close(*io);
 		return -1;
 	}
 
 	/* Thank you for not writing to stderr. */
 	mpg123_param(*hdl, MPG123_ADD_FLAGS, MPG123_QUIET, 0.0);
 
-	if (mpg123_open_fd(*hdl, *fd) != MPG123_OK) {
-		LOG_ERRX("mpg123_open_fd: %s: %s", path,
+	/* The file is closed by ip_mpg123_close_handle(), not by libmpg123. */
+	if (mpg123_replace_reader_handle(*hdl, ip_mpg123_read_cb,
+	    ip_mpg123_seek_cb, NULL) != MPG123_OK ||
+	    mpg123_open_handle(*hdl, *io) != MPG123_OK) {
+		LOG_ERRX("mpg123_open_handle: %s: %s", path,
 		    mpg123_strerror(*hdl));
 		msg_errx("%s: Cannot open track: %s", path,
 		    mpg123_strerror(*hdl));
 		mpg123_delete(*hdl);
-		close(*fd);
+		io_close(*io);
 		return -1;
 	}
 
@@ -536,6 +547,12 @@ ip_mpg123_read(struct track *t, struct sample_buffer *sb)
 	return sb->len_s != 0;
 }
 
+static ssize_t
+ip_mpg123_read_cb(void *io, void *buf, size_t len)
+{
+	return io_read(io, buf, len);
+}
+
 static void
 ip_mpg123_seek(struct track *t, unsigned int pos)
 {
@@ -551,3 +568,11 @@ ip_mpg123_seek(struct track *t, unsigned int pos)
 		msg_errx("Cannot seek: %s", mpg123_strerror(ipd->hdl));
 	}
 }
+
+static off_t
+ip_mpg123_seek_cb(void *io, off_t offset, int whence)
+{
+	if (io_seek(io, offset, whence) == -1)
+		return -1;
+	return io_tell(io);
+}
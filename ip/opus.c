@@ -27,24 +27,38 @@
 #define IP_OPUS_RATE	48000
 
 static void		 ip_opus_close(struct track *);
+static int		 ip_opus_close_cb(void *);
 static void		 ip_opus_get_metadata(struct track *);
 static int		 ip_opus_get_position(struct track *, unsigned int *);
 static int		 ip_opus_open(struct track *);
 static int		 ip_opus_read(struct track *, struct sample_buffer *);
+static int		 ip_opus_read_cb(void *, unsigned char *, int);
 static void		 ip_opus_seek(struct track *, unsigned int);
+static int		 ip_opus_seek_cb(void *, opus_int64, int);
+static opus_int64	 ip_opus_tell_cb(void *);
 
 static const char	*ip_opus_extensions[] = { "opus", NULL };
 
+static const OpusFileCallbacks ip_opus_callbacks = {
+	ip_opus_read_cb,
+	ip_opus_seek_cb,
+	ip_opus_tell_cb,
+	ip_opus_close_cb
+};
+
 const struct ip		 ip = {
 	"opus",
 	IP_PRIORITY_OPUS,
 	ip_opus_extensions,
 	ip_opus_close,
+	NULL,
 	ip_opus_get_metadata,
 	ip_opus_get_position,
 	NULL,
 	ip_opus_open,
 	ip_opus_read,
+	NULL,
+	NULL,
 	ip_opus_seek
 };
 
@@ -57,6 +71,13 @@ ip_opus_close(struct track *t)
 	op_free(oof);
 }
 
+static int
+ip_opus_close_cb(void *io)
+{
+	io_close(io);
+	return 0;
+}
+
 static void
 ip_opus_get_metadata(struct track *t)
 {
@@ -104,12 +125,20 @@ static int
 ip_opus_open(struct track *t)
 {
 	OggOpusFile	*oof;
+	struct io	*io;
 	int		 error;
 
-	oof = op_open_file(t->path, &error);
+	if ((io = io_open(t->path, IO_PREFETCH)) == NULL) {
+		LOG_ERR("open: %s", t->path);
+		msg_err("%s: Cannot open track", t->path);
+		return -1;
+	}
+
+	oof = op_open_callbacks(io, &ip_opus_callbacks, NULL, 0, &error);
 	if (oof == NULL) {
-		LOG_ERRX("op_open_file: %s: error %d", t->path, error);
+		LOG_ERRX("op_open_callbacks: %s: error %d", t->path, error);
 		msg_errx("%s: Cannot open track", t->path);
+		io_close(io);
 		return -1;
 	}
 
@@ -149,6 +178,12 @@ ip_opus_read(struct track *t, struct sample_buffer *sb)
 	}
 }
 
+static int
+ip_opus_read_cb(void *io, unsigned char *buf, int len)
+{
+	return io_read(io, buf, len);
+}
+
 static void
 ip_opus_seek(struct track *t, unsigned int sec)
 {
@@ -162,3 +197,15 @@ ip_opus_seek(struct track *t, unsigned int sec)
 		msg_errx("Cannot seek");
 	}
 }
+
+static int
+ip_opus_seek_cb(void *io, opus_int64 offset, int whence)
+{
+	return io_seek(io, offset, whence);
+}
+
+static opus_int64
+ip_opus_tell_cb(void *io)
+{
+	return io_tell(io);
+}
@@ -74,11 +74,14 @@ const struct ip		 ip = {
 	IP_PRIORITY_SNDFILE,
 	ip_sndfile_extensions,
 	ip_sndfile_close,
+	NULL,
 	ip_sndfile_get_metadata,
 	ip_sndfile_get_position,
 	NULL,
 	ip_sndfile_open,
 	ip_sndfile_read,
+	NULL,
+	NULL,
 	ip_sndfile_seek
 };
 
@@ -22,6 +22,7 @@
 
 #include "../config.h"
 
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -30,6 +31,7 @@
 #include "../siren.h"
 
 static void		 ip_vorbis_close(struct track *);
+static int		 ip_vorbis_close_cb(void *);
 static const char	*ip_vorbis_error(int);
 static void		 ip_vorbis_get_metadata(struct track *);
 static int		 ip_vorbis_get_position(struct track *,
@@ -37,20 +39,33 @@ static int		 ip_vorbis_get_position(struct track *,
 static int		 ip_vorbis_open(struct track *);
 static int		 ip_vorbis_read(struct track *,
 			    struct sample_buffer *);
+static size_t		 ip_vorbis_read_cb(void *, size_t, size_t, void *);
 static void		 ip_vorbis_seek(struct track *, unsigned int);
+static int		 ip_vorbis_seek_cb(void *, ogg_int64_t, int);
+static long		 ip_vorbis_tell_cb(void *);
 
 static const char	*ip_vorbis_extensions[] = { "oga", "ogg", NULL };
 
+static const ov_callbacks ip_vorbis_callbacks = {
+	ip_vorbis_read_cb,
+	ip_vorbis_seek_cb,
+	ip_vorbis_close_cb,
+	ip_vorbis_tell_cb
+};
+
 const struct ip		 ip = {
 	"vorbis",
 	IP_PRIORITY_VORBIS,
 	ip_vorbis_extensions,
 	ip_vorbis_close,
+	NULL,
 	ip_vorbis_get_metadata,
 	ip_vorbis_get_position,
 	NULL,
 	ip_vorbis_open,
 	ip_vorbis_read,
+	NULL,
+	NULL,
 	ip_vorbis_seek
 };
 
@@ -64,6 +79,13 @@ ip_vorbis_close(struct track *t)
 	free(ovf);
 }
 
+static int
+ip_vorbis_close_cb(void *io)
+{
+	io_close(io);
+	return 0;
+}
+
 static const char *
 ip_vorbis_error(int errnum)
 {
@@ -173,22 +195,24 @@ ip_vorbis_open(struct track *t)
 {
 	OggVorbis_File	*ovf;
 	vorbis_info	*info;
-	FILE		*fp;
+	struct io	*io;
 	int		 ret;
 
-	if ((fp = fopen(t->path, "r")) == NULL) {
-		LOG_ERR("fopen: %s", t->path);
+	if ((io = io_open(t->path, IO_PREFETCH)) == NULL) {
+		LOG_ERR("open: %s", t->path);
 		msg_err("%s: Cannot open track", t->path);
 		return -1;
 	}
 
 	ovf = xmalloc(sizeof *ovf);
 
-	if ((ret = ov_open(fp, ovf, NULL, 0)) != 0) {
-		LOG_ERRX("ov_open: %s: %s", t->path, ip_vorbis_error(ret));
+	ret = ov_open_callbacks(io, ovf, NULL, 0, ip_vorbis_callbacks);
+	if (ret != 0) {
+		LOG_ERRX("ov_open_callbacks: %s: %s", t->path,
+		    ip_vorbis_error(ret));
 		msg_errx("%s: Cannot open track: %s", t->path,
 		    ip_vorbis_error(ret));
-		fclose(fp);
+		io_close(io);
 		free(ovf);
 		return -1;
 	}
@@ -234,6 +258,18 @@ ip_vorbis_read(struct track *t, struct sample_buffer *sb)
 	return sb->len_b != 0;
 }
 
+static size_t
+ip_vorbis_read_cb(void *buf, size_t size, size_t nmemb, void *io)
+{
+	ssize_t n;
+
+	if (size == 0 || nmemb > SIZE_MAX / size)
+		return 0;
+	if ((n = io_read(io, buf, size * nmemb)) == -1)
+		return 0;
+	return n / size;
+}
+
 static void
 ip_vorbis_seek(struct track *t, unsigned int sec)
 {
@@ -247,3 +283,15 @@ ip_vorbis_seek(struct track *t, unsigned int sec)
 		msg_errx("Cannot seek: %s", ip_vorbis_error(ret));
 	}
 }
+
+static int
+ip_vorbis_seek_cb(void *io, ogg_int64_t offset, int whence)
+{
+	return io_seek(io, offset, whence);
+}
+
+static long
+ip_vorbis_tell_cb(void *io)
+{
+	return io_tell(io);
+}
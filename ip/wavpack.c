@@ -59,11 +59,14 @@ const struct ip		 ip = {
 	IP_PRIORITY_WAVPACK,
 	ip_wavpack_extensions,
 	ip_wavpack_close,
+	NULL,
 	ip_wavpack_get_metadata,
 	ip_wavpack_get_position,
 	NULL,
 	ip_wavpack_open,
 	ip_wavpack_read,
+	NULL,
+	NULL,
 	ip_wavpack_seek
 };
 
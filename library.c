@@ -19,34 +19,134 @@
 #include <errno.h>
 #include <limits.h>
 #include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <time.h>
 
 #include "siren.h"
 
-static int		 library_search_entry(const void *, const char *);
+/* Number of tracks filtered between checks for a newer query. */
+#define LIBRARY_FILTER_CHUNK	4096
+
+/* Number of earlier filter results that are kept. */
+#define LIBRARY_FILTER_NRESULTS	8
+
+/* The rows of the filter snapshot that match a query. */
+struct library_filter_result {
+	char		*string;
+	struct query	*query;
+	uint32_t	*rows;
+	size_t		 nrows;
+	unsigned int	 used;
+};
+
+static struct library_filter_result *library_filter_add_result(char *,
+			    struct query *, uint32_t *, size_t);
+static void		 library_filter_add_tracks(struct track **, size_t);
+static int		 library_filter_cancelled(unsigned int);
+static void		 library_filter_clear_added(void);
+static void		 library_filter_clear_results(void);
+static struct library_filter_result *library_filter_get_result(const char *,
+			    unsigned int);
+static void		*library_filter_handler(void *);
+static void		 library_filter_insert_tracks(struct track **,
+			    size_t);
+static void		 library_filter_run(const char *, unsigned int,
+			    unsigned int);
+static void		 library_filter_update(unsigned int, unsigned int,
+			    struct track **, size_t);
+static struct menu_entry *library_find_entry(struct menu *,
+			    const struct track *);
+static void		 library_find_files(const char *, char ***, size_t *,
+			    size_t *);
+static unsigned int	 library_find_index(struct menu *,
+			    const struct track *);
+static void		 library_get_entry_text(const void *, char *, size_t);
+static struct menu	*library_get_menu(void);
+static void		*library_index_handler(void *);
+static void		 library_insert_track(struct track *);
+static void		 library_reset_filter(int);
+static int		 library_search_entry(const void *,
+			    const struct pattern *);
+static int		 library_search_index(const char *, int);
+static void		 library_sort(void);
 
 static pthread_mutex_t	 library_menu_mtx = PTHREAD_MUTEX_INITIALIZER;
 static struct format	*library_altformat;
 static struct format	*library_format;
 static struct menu	*library_menu;
 static unsigned int	 library_duration;
-static int		 library_modified;
+static size_t		 library_nchanges;
+
+/*
+ * The search index of the library. It is built by the index thread and is
+ * protected by library_menu_mtx. The version is increased whenever tracks are
+ * added or removed, so that an index built from an older library is discarded.
+ */
+static struct search	*library_index;
+static int		 library_index_valid;
+static unsigned int	 library_index_version;
+static pthread_t	 library_index_thd;
+static pthread_cond_t	 library_index_cond = PTHREAD_COND_INITIALIZER;
+static int		 library_index_job;
+static int		 library_index_quit;
+
+/*
+ * The filtered library. It is shown instead of library_menu if it is not
+ * NULL. Both are protected by library_menu_mtx.
+ */
+static struct menu	*library_filter_menu;
+static char		*library_filter_menu_query;
+
+static pthread_t	 library_filter_thd;
+static pthread_mutex_t	 library_filter_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	 library_filter_cond = PTHREAD_COND_INITIALIZER;
+static char		*library_filter_query;
+static unsigned int	 library_filter_job;
+static unsigned int	 library_filter_version;
+static int		 library_filter_quit;
+
+/*
+ * Tracks added to the library since version library_filter_added_version.
+ * The filter thread inserts them in the snapshot and the earlier results.
+ */
+static struct track	**library_filter_added;
+static size_t		 library_filter_nadded;
+static unsigned int	 library_filter_added_version;
+
+/*
+ * Snapshot of the library and earlier filter results. Only used by the filter
+ * thread.
+ */
+static struct query_snapshot *library_filter_snapshot;
+static int		 library_filter_snapshot_valid;
+static struct library_filter_result
+			 library_filter_results[LIBRARY_FILTER_NRESULTS];
+static size_t		 library_filter_nresults;
+static unsigned int	 library_filter_results_version;
+static unsigned int	 library_filter_results_used;
 
 void
 library_activate_entry(void)
 {
+	struct menu		*m;
 	struct menu_entry	*e;
 	struct track		*t;
 
 	t = NULL;
 
 	XPTHREAD_MUTEX_LOCK(&library_menu_mtx);
-	if ((e = menu_get_selected_entry(library_menu)) != NULL) {
-		menu_activate_entry(library_menu, e);
+	m = library_get_menu();
+	if ((e = menu_get_selected_entry(m)) != NULL) {
 		t = menu_get_entry_data(e);
+		/* Playback continues from the track in the whole library. */
+		if (m != library_menu)
+			e = library_find_entry(library_menu, t);
+		if (e != NULL)
+			menu_activate_entry(library_menu, e);
+		else
+			t = NULL;
 	}
 	XPTHREAD_MUTEX_UNLOCK(&library_menu_mtx);
 
@@ -60,56 +160,84 @@ library_activate_entry(void)
 void
 library_add_dir(const char *path)
 {
-	struct dir		*d;
-	struct dir_entry	*de;
-	struct track		*t;
+	struct track	**tracks;
+	char		**paths;
+	size_t		  i, npaths, ntracks, size;
 
-	if ((d = dir_open(path)) == NULL) {
-		msg_err("%s", path);
+	paths = NULL;
+	npaths = 0;
+	size = 0;
+	library_find_files(path, &paths, &npaths, &size);
+
+	if (npaths == 0)
 		return;
-	}
 
-	while ((de = dir_get_entry(d)) != NULL) {
-		switch (de->type) {
-		case FILE_TYPE_DIRECTORY:
-			if (strcmp(de->name, ".") && strcmp(de->name, ".."))
-				library_add_dir(de->path);
-			break;
-		case FILE_TYPE_REGULAR:
-			if ((t = track_get(de->path, NULL)) != NULL)
-				library_add_track(t);
-			break;
-		default:
-			msg_errx("%s: Unsupported file type", de->path);
-			break;
+	tracks = xreallocarray(NULL, npaths, sizeof *tracks);
+	track_get_multiple(paths, npaths, tracks);
+
+	XPTHREAD_MUTEX_LOCK(&library_menu_mtx);
+	ntracks = 0;
+	for (i = 0; i < npaths; i++)
+		if (tracks[i] != NULL) {
+			library_insert_track(tracks[i]);
+			tracks[ntracks++] = tracks[i];
 		}
-	}
+	if (ntracks > 0)
+		library_filter_add_tracks(tracks, ntracks);
+	XPTHREAD_MUTEX_UNLOCK(&library_menu_mtx);
+	library_print();
 
-	dir_close(d);
+	for (i = 0; i < npaths; i++)
+		free(paths[i]);
+	free(tracks);
+	free(paths);
 }
 
 void
 library_add_track(struct track *t)
 {
-	struct track		*et;
-	struct menu_entry	*entry;
-
 	XPTHREAD_MUTEX_LOCK(&library_menu_mtx);
-	MENU_FOR_EACH_ENTRY(library_menu, entry) {
-		et = menu_get_entry_data(entry);
-		if (track_cmp(t, et) < 0) {
-			menu_insert_before(library_menu, entry, t);
-			break;
-		}
-	}
+	library_insert_track(t);
+	library_filter_add_tracks(&t, 1);
+	XPTHREAD_MUTEX_UNLOCK(&library_menu_mtx);
+	library_print();
+}
 
-	if (entry == NULL)
-		menu_insert_tail(library_menu, t);
+/*
+ * Save the library if it has changed often enough since it was last saved.
+ */
+void
+library_autosave(void)
+{
+	size_t	nchanges;
+	int	threshold;
 
-	library_duration += t->duration;
-	library_modified = 1;
+	threshold = option_get_number("autosave-threshold");
+
+	XPTHREAD_MUTEX_LOCK(&library_menu_mtx);
+	nchanges = library_nchanges;
 	XPTHREAD_MUTEX_UNLOCK(&library_menu_mtx);
-	library_print();
+
+	if (threshold > 0 && nchanges >= (size_t)threshold)
+		library_write_file(0);
+}
+
+/*
+ * Sort the library in the order set by the library-sort option.
+ */
+void
+library_change_sort(void)
+{
+	char *order;
+
+	order = option_get_string("library-sort");
+	if (track_set_sort(order) == -1)
+		msg_errx("Invalid sort order: %s", order);
+	else {
+		library_sort();
+		library_print();
+	}
+	free(order);
 }
 
 void
@@ -121,7 +249,7 @@ library_copy_entry(enum view_id view)
 		return;
 
 	XPTHREAD_MUTEX_LOCK(&library_menu_mtx);
-	if ((t = menu_get_selected_entry_data(library_menu)) != NULL)
+	if ((t = menu_get_selected_entry_data(library_get_menu())) != NULL)
 		view_add_track(view, t);
 	XPTHREAD_MUTEX_UNLOCK(&library_menu_mtx);
 }
@@ -131,8 +259,14 @@ library_delete_all_entries(void)
 {
 	XPTHREAD_MUTEX_LOCK(&library_menu_mtx);
 	menu_remove_all_entries(library_menu);
+	if (library_filter_menu != NULL)
+		menu_remove_all_entries(library_filter_menu);
+	library_reset_filter(0);
+	search_clear(library_index);
+	library_index_valid = 0;
+	library_index_version++;
 	library_duration = 0;
-	library_modified = 1;
+	library_nchanges++;
 	XPTHREAD_MUTEX_UNLOCK(&library_menu_mtx);
 	library_print();
 }
@@ -140,15 +274,27 @@ library_delete_all_entries(void)
 void
 library_delete_entry(void)
 {
+	struct menu		*m;
 	struct menu_entry	*e;
 	struct track		*t;
 
 	XPTHREAD_MUTEX_LOCK(&library_menu_mtx);
-	if ((e = menu_get_selected_entry(library_menu)) != NULL) {
+	m = library_get_menu();
+	if ((e = menu_get_selected_entry(m)) != NULL) {
 		t = menu_get_entry_data(e);
-		menu_remove_selected_entry(library_menu);
-		library_duration -= t->duration;
-		library_modified = 1;
+		if (m != library_menu) {
+			menu_remove_selected_entry(m);
+			e = library_find_entry(library_menu, t);
+		}
+		if (e != NULL) {
+			menu_remove_entry(library_menu, e);
+			if (library_index_valid)
+				search_remove_track(library_index, t);
+			library_index_version++;
+			library_duration -= t->duration;
+			library_nchanges++;
+		}
+		library_reset_filter(0);
 	}
 	XPTHREAD_MUTEX_UNLOCK(&library_menu_mtx);
 	library_print();
@@ -157,10 +303,557 @@ library_delete_entry(void)
 void
 library_end(void)
 {
-	if (library_modified)
-		library_write_file();
+	XPTHREAD_MUTEX_LOCK(&library_menu_mtx);
+	library_index_quit = 1;
+	XPTHREAD_COND_BROADCAST(&library_index_cond);
+	XPTHREAD_MUTEX_UNLOCK(&library_menu_mtx);
+
+	XPTHREAD_JOIN(library_index_thd, NULL);
 
+	XPTHREAD_MUTEX_LOCK(&library_filter_mtx);
+	library_filter_quit = 1;
+	XPTHREAD_COND_BROADCAST(&library_filter_cond);
+	XPTHREAD_MUTEX_UNLOCK(&library_filter_mtx);
+
+	XPTHREAD_JOIN(library_filter_thd, NULL);
+
+	if (library_nchanges > 0)
+		library_write_file(0);
+
+	if (library_filter_menu != NULL)
+		menu_free(library_filter_menu);
+	free(library_filter_menu_query);
+	free(library_filter_query);
+	free(library_filter_added);
 	menu_free(library_menu);
+	search_free(library_index);
+}
+
+/*
+ * Add a filter result to the earlier results. If there is no room for it, the
+ * least recently used result is replaced.
+ */
+static struct library_filter_result *
+library_filter_add_result(char *string, struct query *query, uint32_t *rows,
+    size_t nrows)
+{
+	struct library_filter_result	*r;
+	size_t				 i;
+
+	if (library_filter_nresults < LIBRARY_FILTER_NRESULTS)
+		r = &library_filter_results[library_filter_nresults++];
+	else {
+		r = &library_filter_results[0];
+		for (i = 1; i < LIBRARY_FILTER_NRESULTS; i++)
+			if (library_filter_results[i].used < r->used)
+				r = &library_filter_results[i];
+		free(r->string);
+		query_free(r->query);
+		free(r->rows);
+	}
+
+	r->string = string;
+	r->query = query;
+	r->rows = rows;
+	r->nrows = nrows;
+	r->used = ++library_filter_results_used;
+	return r;
+}
+
+/*
+ * Let the filter thread know that tracks have been added to the library. The
+ * caller must hold library_menu_mtx.
+ */
+static void
+library_filter_add_tracks(struct track **tracks, size_t ntracks)
+{
+	XPTHREAD_MUTEX_LOCK(&library_filter_mtx);
+	library_filter_version++;
+	library_filter_added = xreallocarray(library_filter_added,
+	    library_filter_nadded + ntracks, sizeof *library_filter_added);
+	memcpy(library_filter_added + library_filter_nadded, tracks,
+	    ntracks * sizeof *tracks);
+	library_filter_nadded += ntracks;
+	if (library_filter_query != NULL) {
+		library_filter_job++;
+		XPTHREAD_COND_BROADCAST(&library_filter_cond);
+	}
+	XPTHREAD_MUTEX_UNLOCK(&library_filter_mtx);
+}
+
+/*
+ * Return 1 if filter job has been superseded by a newer one, or 0 otherwise.
+ */
+static int
+library_filter_cancelled(unsigned int job)
+{
+	int ret;
+
+	XPTHREAD_MUTEX_LOCK(&library_filter_mtx);
+	ret = library_filter_quit || job != library_filter_job;
+	XPTHREAD_MUTEX_UNLOCK(&library_filter_mtx);
+	return ret;
+}
+
+/*
+ * Forget the added tracks. The caller must hold library_filter_mtx.
+ */
+static void
+library_filter_clear_added(void)
+{
+	free(library_filter_added);
+	library_filter_added = NULL;
+	library_filter_nadded = 0;
+	library_filter_added_version = library_filter_version;
+}
+
+static void
+library_filter_clear_results(void)
+{
+	size_t i;
+
+	for (i = 0; i < library_filter_nresults; i++) {
+		free(library_filter_results[i].string);
+		query_free(library_filter_results[i].query);
+		free(library_filter_results[i].rows);
+	}
+	library_filter_nresults = 0;
+}
+
+/*
+ * Get the rows of the filter snapshot that match a query. The rows are taken
+ * from the smallest earlier result for a query that every matching track also
+ * matches (see query_refines()). If there is none, all rows are used. Return
+ * NULL if the job is cancelled.
+ */
+static struct library_filter_result *
+library_filter_get_result(const char *string, unsigned int job)
+{
+	struct library_filter_result	*r, *src;
+	struct menu_entry		*e;
+	struct query			*query;
+	struct query_plan		*plan;
+	struct track			**tracks;
+	uint32_t			 *rows;
+	char				 *error;
+	size_t				  i, n, nrows, ntracks;
+
+	/* The query has been checked by library_set_filter(). */
+	if ((query = query_init(string, &error)) == NULL) {
+		free(error);
+		return NULL;
+	}
+
+	src = NULL;
+	for (i = 0; i < library_filter_nresults; i++) {
+		r = &library_filter_results[i];
+		if (query_refines(query, r->query) &&
+		    (src == NULL || r->nrows < src->nrows))
+			src = r;
+	}
+
+	if (src != NULL && !strcmp(src->string, string)) {
+		query_free(query);
+		src->used = ++library_filter_results_used;
+		return src;
+	}
+
+	if (src == NULL) {
+		if (!library_filter_snapshot_valid) {
+			XPTHREAD_MUTEX_LOCK(&library_menu_mtx);
+			ntracks = menu_get_nentries(library_menu);
+			tracks = (ntracks == 0) ? NULL :
+			    xreallocarray(NULL, ntracks, sizeof *tracks);
+			i = 0;
+			MENU_FOR_EACH_ENTRY(library_menu, e)
+				tracks[i++] = menu_get_entry_data(e);
+
+			/*
+			 * The snapshot includes the tracks added so far, so it
+			 * may be newer than the job.
+			 */
+			XPTHREAD_MUTEX_LOCK(&library_filter_mtx);
+			library_filter_results_version =
+			    library_filter_version;
+			library_filter_clear_added();
+			XPTHREAD_MUTEX_UNLOCK(&library_filter_mtx);
+			XPTHREAD_MUTEX_UNLOCK(&library_menu_mtx);
+
+			track_lock_metadata();
+			query_snapshot_build(library_filter_snapshot, tracks,
+			    ntracks);
+			track_unlock_metadata();
+			library_filter_snapshot_valid = 1;
+			free(tracks);
+		}
+
+		nrows = query_snapshot_get_ntracks(library_filter_snapshot);
+		rows = (nrows == 0) ? NULL :
+		    xreallocarray(NULL, nrows, sizeof *rows);
+		for (i = 0; i < nrows; i++)
+			rows[i] = i;
+		src = library_filter_add_result(xstrdup(""),
+		    query_init("", &error), rows, nrows);
+	}
+
+	plan = query_plan_init(query, library_filter_snapshot);
+	rows = (src->nrows == 0) ? NULL :
+	    xreallocarray(NULL, src->nrows, sizeof *rows);
+	nrows = 0;
+	for (i = 0; i < src->nrows; i += n) {
+		if (library_filter_cancelled(job)) {
+			query_plan_free(plan);
+			query_free(query);
+			free(rows);
+			return NULL;
+		}
+		n = src->nrows - i;
+		if (n > LIBRARY_FILTER_CHUNK)
+			n = LIBRARY_FILTER_CHUNK;
+		nrows += query_plan_select(plan, src->rows + i, n,
+		    rows + nrows);
+	}
+	query_plan_free(plan);
+
+	return library_filter_add_result(xstrdup(string), query, rows, nrows);
+}
+
+static void *
+library_filter_handler(UNUSED void *p)
+{
+	struct track	**added;
+	sigset_t	  ss;
+	size_t		  nadded;
+	unsigned int	  job, since, version;
+	char		 *query;
+
+	/* Let the main thread handle all signals. */
+	sigfillset(&ss);
+	pthread_sigmask(SIG_BLOCK, &ss, NULL);
+
+	library_filter_snapshot = query_snapshot_init();
+
+	XPTHREAD_MUTEX_LOCK(&library_filter_mtx);
+	job = library_filter_job;
+	for (;;) {
+		if (library_filter_quit)
+			break;
+		if (job == library_filter_job) {
+			XPTHREAD_COND_WAIT(&library_filter_cond,
+			    &library_filter_mtx);
+			continue;
+		}
+
+		job = library_filter_job;
+		version = library_filter_version;
+		added = NULL;
+		nadded = 0;
+		since = version;
+		if (library_filter_query == NULL)
+			query = NULL;
+		else {
+			query = xstrdup(library_filter_query);
+			added = library_filter_added;
+			nadded = library_filter_nadded;
+			since = library_filter_added_version;
+			library_filter_added = NULL;
+			library_filter_clear_added();
+		}
+		XPTHREAD_MUTEX_UNLOCK(&library_filter_mtx);
+
+		if (query != NULL) {
+			library_filter_update(version, since, added, nadded);
+			library_filter_run(query, job, version);
+			free(query);
+		}
+		free(added);
+
+		XPTHREAD_MUTEX_LOCK(&library_filter_mtx);
+	}
+	XPTHREAD_MUTEX_UNLOCK(&library_filter_mtx);
+
+	library_filter_clear_results();
+	query_snapshot_free(library_filter_snapshot);
+	return NULL;
+}
+
+/*
+ * Insert tracks that have been added to the library in the filter snapshot and
+ * in the earlier results. The rows of the snapshot stay in the order of the
+ * library, so the rows of the results are renumbered.
+ */
+static void
+library_filter_insert_tracks(struct track **tracks, size_t ntracks)
+{
+	struct library_filter_result	*r;
+	struct query_plan		*plan;
+	uint32_t			*match, *pos, *rows;
+	uint32_t			 hi, lo, mid, row;
+	size_t				 i, j, k, m, n, nmatch;
+
+	pos = xreallocarray(NULL, ntracks, sizeof *pos);
+	match = xreallocarray(NULL, ntracks, sizeof *match);
+
+	/* Find the row before which each track is inserted. */
+	track_lock_metadata();
+	track_sort(tracks, ntracks);
+	n = query_snapshot_get_ntracks(library_filter_snapshot);
+	lo = 0;
+	for (i = 0; i < ntracks; i++) {
+		hi = n;
+		while (lo < hi) {
+			mid = lo + (hi - lo) / 2;
+			if (track_cmp(query_snapshot_get_track(
+			    library_filter_snapshot, mid), tracks[i]) < 0)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		pos[i] = lo;
+	}
+	query_snapshot_insert(library_filter_snapshot, tracks, pos, ntracks);
+	track_unlock_metadata();
+
+	for (i = 0; i < library_filter_nresults; i++) {
+		r = &library_filter_results[i];
+
+		for (j = 0; j < ntracks; j++)
+			match[j] = pos[j] + j;
+		plan = query_plan_init(r->query, library_filter_snapshot);
+		nmatch = query_plan_select(plan, match, ntracks, match);
+		query_plan_free(plan);
+
+		/*
+		 * An earlier row moves down by the number of tracks inserted
+		 * before it. Merge the matching new rows with these.
+		 */
+		if (r->nrows + nmatch == 0)
+			continue;
+
+		rows = xreallocarray(NULL, r->nrows + nmatch, sizeof *rows);
+		k = m = n = 0;
+		for (j = 0; j < r->nrows; j++) {
+			while (m < ntracks && pos[m] <= r->rows[j])
+				m++;
+			row = r->rows[j] + m;
+			while (k < nmatch && match[k] < row)
+				rows[n++] = match[k++];
+			rows[n++] = row;
+		}
+		while (k < nmatch)
+			rows[n++] = match[k++];
+
+		free(r->rows);
+		r->rows = rows;
+		r->nrows = n;
+	}
+
+	free(match);
+	free(pos);
+}
+
+/*
+ * Filter the library and show the result. The version is that of the library
+ * when the job was started.
+ */
+static void
+library_filter_run(const char *query, unsigned int job, unsigned int version)
+{
+	struct library_filter_result	*r;
+	struct menu			*m, *old;
+	struct menu_entry		*e;
+	struct track			*t;
+	size_t				 i;
+
+	if ((r = library_filter_get_result(query, job)) == NULL)
+		return;
+
+	m = menu_init(NULL, library_get_entry_text, library_search_entry);
+	for (i = 0; i < r->nrows; i++) {
+		if (i % LIBRARY_FILTER_CHUNK == 0 &&
+		    library_filter_cancelled(job)) {
+			menu_free(m);
+			return;
+		}
+		menu_insert_tail(m, query_snapshot_get_track(
+		    library_filter_snapshot, r->rows[i]));
+	}
+
+	XPTHREAD_MUTEX_LOCK(&library_menu_mtx);
+	XPTHREAD_MUTEX_LOCK(&library_filter_mtx);
+	if (library_filter_quit || job != library_filter_job ||
+	    version != library_filter_version) {
+		/*
+		 * If the library has changed in the meantime, the result may
+		 * be out of date. Filter the library again.
+		 */
+		if (!library_filter_quit && job == library_filter_job)
+			library_filter_job++;
+		XPTHREAD_MUTEX_UNLOCK(&library_filter_mtx);
+		XPTHREAD_MUTEX_UNLOCK(&library_menu_mtx);
+		menu_free(m);
+		return;
+	}
+	XPTHREAD_MUTEX_UNLOCK(&library_filter_mtx);
+
+	/* Keep the selected track selected if it is still shown. */
+	old = library_filter_menu;
+	t = menu_get_selected_entry_data(old != NULL ? old : library_menu);
+	if (t != NULL && (e = library_find_entry(m, t)) != NULL)
+		menu_select_entry(m, e);
+
+	library_filter_menu = m;
+	free(library_filter_menu_query);
+	library_filter_menu_query = xstrdup(query);
+	XPTHREAD_MUTEX_UNLOCK(&library_menu_mtx);
+
+	if (old != NULL)
+		menu_free(old);
+	library_print();
+}
+
+/*
+ * Bring the snapshot and the earlier results up to date with the specified
+ * version of the library. If the only changes since are tracks that were added
+ * after version since, these tracks are inserted. Otherwise, the snapshot and
+ * the results are discarded.
+ */
+static void
+library_filter_update(unsigned int version, unsigned int since,
+    struct track **added, size_t nadded)
+{
+	if (version == library_filter_results_version)
+		return;
+
+	if (since == library_filter_results_version &&
+	    library_filter_snapshot_valid) {
+		if (nadded > 0)
+			library_filter_insert_tracks(added, nadded);
+	} else {
+		library_filter_clear_results();
+		library_filter_snapshot_valid = 0;
+	}
+	library_filter_results_version = version;
+}
+
+/*
+ * Return the entry of a track in a sorted menu, or NULL if the track is not
+ * in the menu.
+ */
+static struct menu_entry *
+library_find_entry(struct menu *m, const struct track *t)
+{
+	struct menu_entry *e;
+
+	e = menu_get_entry(m, library_find_index(m, t));
+	if (e == NULL || menu_get_entry_data(e) != t)
+		return NULL;
+	return e;
+}
+
+/*
+ * Add the paths of the files in a directory and its subdirectories to the
+ * paths array.
+ */
+static void
+library_find_files(const char *path, char ***paths, size_t *npaths,
+    size_t *size)
+{
+	struct dir		*d;
+	struct dir_entry	*de;
+
+	if ((d = dir_open(path)) == NULL) {
+		msg_err("%s", path);
+		return;
+	}
+
+	while ((de = dir_get_entry(d)) != NULL) {
+		switch (de->type) {
+		case FILE_TYPE_DIRECTORY:
+			if (strcmp(de->name, ".") && strcmp(de->name, ".."))
+				library_find_files(de->path, paths, npaths,
+				    size);
+			break;
+		case FILE_TYPE_REGULAR:
+			if (*npaths == *size) {
+				*size = (*size == 0) ? 256 : *size * 2;
+				*paths = xreallocarray(*paths, *size,
+				    sizeof **paths);
+			}
+			(*paths)[(*npaths)++] = xstrdup(de->path);
+			break;
+		default:
+			msg_errx("%s: Unsupported file type", de->path);
+			break;
+		}
+	}
+
+	dir_close(d);
+}
+
+/*
+ * Return the index of the first entry in a sorted menu that does not sort
+ * before the specified track.
+ */
+static unsigned int
+library_find_index(struct menu *m, const struct track *t)
+{
+	struct menu_entry	*e;
+	unsigned int		 lo, hi, mid;
+
+	lo = 0;
+	hi = menu_get_nentries(m);
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		e = menu_get_entry(m, mid);
+		if (track_cmp(menu_get_entry_data(e), t) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/*
+ * Return the menu that is shown: the filtered library if there is one, or
+ * else the whole library.
+ */
+static struct menu *
+library_get_menu(void)
+{
+	return library_filter_menu != NULL ? library_filter_menu :
+	    library_menu;
+}
+
+/*
+ * Return the tracks in the library that match a query, in library order. The
+ * number of tracks is stored in *ntracks. The caller must free the array. If
+ * the library is empty, NULL is returned.
+ */
+struct track **
+library_get_tracks(const struct query *q, size_t *ntracks)
+{
+	struct menu_entry	*e;
+	struct track		**tracks, *t;
+
+	*ntracks = 0;
+	XPTHREAD_MUTEX_LOCK(&library_menu_mtx);
+	if (menu_get_nentries(library_menu) == 0) {
+		XPTHREAD_MUTEX_UNLOCK(&library_menu_mtx);
+		return NULL;
+	}
+
+	tracks = xreallocarray(NULL, menu_get_nentries(library_menu),
+	    sizeof *tracks);
+	track_lock_metadata();
+	MENU_FOR_EACH_ENTRY(library_menu, e) {
+		t = menu_get_entry_data(e);
+		if (query_match(q, t))
+			tracks[(*ntracks)++] = t;
+	}
+	track_unlock_metadata();
+	XPTHREAD_MUTEX_UNLOCK(&library_menu_mtx);
+	return tracks;
 }
 
 static void
@@ -225,30 +918,170 @@ library_get_prev_track(void)
 	return t;
 }
 
+/*
+ * Build the search index. The library is copied first, so that
+ * library_menu_mtx need not be held while the index is built. The metadata
+ * lock is held instead, because the index is built from the metadata.
+ */
+static void *
+library_index_handler(UNUSED void *p)
+{
+	struct menu_entry	*e;
+	struct search		*s;
+	struct track		**tracks;
+	sigset_t		  ss;
+	size_t			  i, ntracks;
+	unsigned int		  version;
+
+	/* Let the main thread handle all signals. */
+	sigfillset(&ss);
+	pthread_sigmask(SIG_BLOCK, &ss, NULL);
+
+	XPTHREAD_MUTEX_LOCK(&library_menu_mtx);
+	for (;;) {
+		if (library_index_quit)
+			break;
+		if (!library_index_job) {
+			XPTHREAD_COND_WAIT(&library_index_cond,
+			    &library_menu_mtx);
+			continue;
+		}
+
+		library_index_job = 0;
+		version = library_index_version;
+		ntracks = menu_get_nentries(library_menu);
+		if (ntracks == 0)
+			tracks = NULL;
+		else {
+			tracks = xreallocarray(NULL, ntracks, sizeof *tracks);
+			i = 0;
+			MENU_FOR_EACH_ENTRY(library_menu, e)
+				tracks[i++] = menu_get_entry_data(e);
+		}
+		XPTHREAD_MUTEX_UNLOCK(&library_menu_mtx);
+
+		s = search_init();
+		if (ntracks > 0) {
+			track_lock_metadata();
+			search_build(s, tracks, ntracks);
+			track_unlock_metadata();
+			free(tracks);
+		}
+
+		XPTHREAD_MUTEX_LOCK(&library_menu_mtx);
+		if (version == library_index_version) {
+			search_free(library_index);
+			library_index = s;
+			library_index_valid = 1;
+		} else {
+			/* The library has changed. Try again. */
+			search_free(s);
+			library_index_job = 1;
+		}
+	}
+	XPTHREAD_MUTEX_UNLOCK(&library_menu_mtx);
+
+	return NULL;
+}
+
 void
 library_init(void)
 {
 	library_menu = menu_init(NULL, library_get_entry_text,
 	    library_search_entry);
+	library_index = search_init();
+	XPTHREAD_CREATE(&library_filter_thd, NULL, library_filter_handler,
+	    NULL);
+	XPTHREAD_CREATE(&library_index_thd, NULL, library_index_handler,
+	    NULL);
+}
+
+/*
+ * Insert a track in its place in the library. The caller must hold
+ * library_menu_mtx.
+ */
+static void
+library_insert_track(struct track *t)
+{
+	struct menu_entry *entry;
+
+	entry = menu_get_entry(library_menu, library_find_index(library_menu,
+	    t));
+	if (entry != NULL)
+		menu_insert_before(library_menu, entry, t);
+	else
+		menu_insert_tail(library_menu, t);
+
+	if (library_index_valid)
+		search_add_track(library_index, t);
+	library_index_version++;
+
+	library_duration += t->duration;
+	library_nchanges++;
+}
+
+/*
+ * Return the path of the track that library_get_next_track() would return, or
+ * NULL if there is none. The active entry is left unchanged.
+ */
+char *
+library_peek_next_path(void)
+{
+	struct menu_entry	*me;
+	struct track		*t;
+	char			*path;
+
+	path = NULL;
+	XPTHREAD_MUTEX_LOCK(&library_menu_mtx);
+	if ((me = menu_get_active_entry(library_menu)) != NULL) {
+		if ((me = menu_get_next_entry(me)) == NULL &&
+		    option_get_boolean("repeat-all"))
+			me = menu_get_first_entry(library_menu);
+
+		if (me != NULL) {
+			t = menu_get_entry_data(me);
+			path = xstrdup(t->path);
+		}
+	}
+	XPTHREAD_MUTEX_UNLOCK(&library_menu_mtx);
+	return path;
 }
 
 void
 library_print(void)
 {
+	struct menu_entry *e;
+
 	if (view_get_id() != VIEW_ID_LIBRARY)
 		return;
 
 	XPTHREAD_MUTEX_LOCK(&library_menu_mtx);
-	screen_view_title_printf("Library: %u track%s (%u:%02u:%02u)",
-	    menu_get_nentries(library_menu),
-	    menu_get_nentries(library_menu) == 1 ? "" : "s",
-	    HOURS(library_duration),
-	    HMINS(library_duration),
-	    MSECS(library_duration));
+	if (library_filter_menu == NULL)
+		screen_view_title_printf("Library: %u track%s (%u:%02u:%02u)",
+		    menu_get_nentries(library_menu),
+		    menu_get_nentries(library_menu) == 1 ? "" : "s",
+		    HOURS(library_duration),
+		    HMINS(library_duration),
+		    MSECS(library_duration));
+	else {
+		screen_view_title_printf("Library: %u of %u track%s "
+		    "(filter: %s)",
+		    menu_get_nentries(library_filter_menu),
+		    menu_get_nentries(library_menu),
+		    menu_get_nentries(library_menu) == 1 ? "" : "s",
+		    library_filter_menu_query);
+
+		/* Mark the active track if it is shown. */
+		e = menu_get_active_entry(library_menu);
+		if (e != NULL)
+			e = library_find_entry(library_filter_menu,
+			    menu_get_entry_data(e));
+		menu_activate_entry(library_filter_menu, e);
+	}
 	option_lock();
 	library_format = option_get_format("library-format");
 	library_altformat = option_get_format("library-format-alt");
-	menu_print(library_menu);
+	menu_print(library_get_menu());
 	option_unlock();
 	XPTHREAD_MUTEX_UNLOCK(&library_menu_mtx);
 }
@@ -271,13 +1104,11 @@ library_reactivate_entry(void)
 void
 library_read_file(void)
 {
-	struct menu_entry	*e;
-	struct track		*et, *t;
-	FILE			*fp;
-	size_t			 size;
-	ssize_t			 len;
-	time_t			 lasttime;
-	char			*line, *file;
+	struct track		**tracks;
+	FILE			 *fp;
+	size_t			  i, npaths, ntracks, pathsize, size;
+	ssize_t			  len;
+	char			**paths, *line, *file;
 
 	file = conf_get_path(LIBRARY_FILE);
 	if ((fp = fopen(file, "r")) == NULL) {
@@ -289,7 +1120,9 @@ library_read_file(void)
 		return;
 	}
 
-	lasttime = time(NULL);
+	paths = NULL;
+	npaths = 0;
+	pathsize = 0;
 	line = NULL;
 	size = 0;
 	while ((len = getline(&line, &size, fp)) != -1) {
@@ -301,24 +1134,11 @@ library_read_file(void)
 			continue;
 		}
 
-		if ((t = track_require(line)) == NULL)
-			continue;
-
-		MENU_FOR_EACH_ENTRY_REVERSE(library_menu, e) {
-			et = menu_get_entry_data(e);
-			if (track_cmp(t, et) > 0) {
-				menu_insert_after(library_menu, e, t);
-				break;
-			}
-		}
-		if (e == NULL)
-			menu_insert_head(library_menu, t);
-		library_duration += t->duration;
-
-		if (time(NULL) > lasttime) {
-			library_print();
-			lasttime = time(NULL);
+		if (npaths == pathsize) {
+			pathsize = (pathsize == 0) ? 1024 : pathsize * 2;
+			paths = xreallocarray(paths, pathsize, sizeof *paths);
 		}
+		paths[npaths++] = xstrdup(line);
 	}
 	if (ferror(fp)) {
 		LOG_ERR("getline: %s", file);
@@ -329,6 +1149,39 @@ library_read_file(void)
 
 	fclose(fp);
 
+	if (npaths == 0)
+		return;
+
+	/* Tracks that are not in the cache are read concurrently. */
+	tracks = xreallocarray(NULL, npaths, sizeof *tracks);
+	track_require_multiple(paths, npaths, tracks);
+	ntracks = 0;
+	for (i = 0; i < npaths; i++) {
+		if (tracks[i] != NULL)
+			tracks[ntracks++] = tracks[i];
+		free(paths[i]);
+	}
+	free(paths);
+
+	/*
+	 * The library is read when siren starts, so the menu is still empty.
+	 * Sort the tracks once and append them to it, rather than inserting
+	 * each track in its place.
+	 */
+	track_sort(tracks, ntracks);
+
+	XPTHREAD_MUTEX_LOCK(&library_menu_mtx);
+	for (i = 0; i < ntracks; i++) {
+		menu_insert_tail(library_menu, tracks[i]);
+		if (library_index_valid)
+			search_add_track(library_index, tracks[i]);
+		library_duration += tracks[i]->duration;
+	}
+	library_index_version++;
+	library_reset_filter(1);
+	XPTHREAD_MUTEX_UNLOCK(&library_menu_mtx);
+
+	free(tracks);
 	library_print();
 }
 
@@ -336,7 +1189,7 @@ void
 library_scroll_down(enum menu_scroll scroll)
 {
 	XPTHREAD_MUTEX_LOCK(&library_menu_mtx);
-	menu_scroll_down(library_menu, scroll);
+	menu_scroll_down(library_get_menu(), scroll);
 	XPTHREAD_MUTEX_UNLOCK(&library_menu_mtx);
 	library_print();
 }
@@ -345,25 +1198,111 @@ void
 library_scroll_up(enum menu_scroll scroll)
 {
 	XPTHREAD_MUTEX_LOCK(&library_menu_mtx);
-	menu_scroll_up(library_menu, scroll);
+	menu_scroll_up(library_get_menu(), scroll);
 	XPTHREAD_MUTEX_UNLOCK(&library_menu_mtx);
 	library_print();
 }
 
+/*
+ * Invalidate the earlier filter results after the library has changed. If
+ * refilter is 1, the library is filtered again. The caller must hold
+ * library_menu_mtx.
+ */
+static void
+library_reset_filter(int refilter)
+{
+	XPTHREAD_MUTEX_LOCK(&library_filter_mtx);
+	library_filter_version++;
+	library_filter_clear_added();
+	if (refilter && library_filter_query != NULL) {
+		library_filter_job++;
+		XPTHREAD_COND_BROADCAST(&library_filter_cond);
+	}
+	XPTHREAD_MUTEX_UNLOCK(&library_filter_mtx);
+}
+
 static int
-library_search_entry(const void *e, const char *search)
+library_search_entry(const void *e, const struct pattern *p)
 {
 	const struct track *t;
 
 	t = e;
-	return track_search(t, search);
+	return track_search(t, p);
+}
+
+/*
+ * Search the library with the search index. The index is built in the
+ * background when it is first needed. Return -1 if the index cannot be used
+ * (yet); the caller then has to search the menu.
+ */
+static int
+library_search_index(const char *search, int dir)
+{
+	struct menu_entry	*e;
+	struct pattern		*p;
+	struct track		**tracks, *first, *found, *selected;
+	size_t			  i, ntracks;
+
+	if ((selected = menu_get_selected_entry_data(library_menu)) == NULL)
+		return -1;
+
+	if (!library_index_valid) {
+		library_index_job = 1;
+		XPTHREAD_COND_BROADCAST(&library_index_cond);
+		return -1;
+	}
+
+	if (search_lookup(library_index, search, &tracks, &ntracks) == -1)
+		return -1;
+
+	/*
+	 * The library is sorted, so the next match is the matching track that
+	 * sorts first after the selected track (or last before it if dir is
+	 * -1). If there is none, the search wraps to the first (or last)
+	 * matching track.
+	 */
+	p = pattern_init(search);
+	first = found = NULL;
+	for (i = 0; i < ntracks; i++) {
+		if (track_search(tracks[i], p) == -1)
+			continue;
+		if (first == NULL || dir * track_cmp(tracks[i], first) < 0)
+			first = tracks[i];
+		if (dir * track_cmp(tracks[i], selected) > 0 &&
+		    (found == NULL || dir * track_cmp(tracks[i], found) < 0))
+			found = tracks[i];
+	}
+	pattern_free(p);
+
+	if (first == NULL) {
+		msg_errx("Not found");
+		return 0;
+	}
+
+	if (found == NULL) {
+		if (dir > 0)
+			msg_info("Search wrapped to top");
+		else
+			msg_info("Search wrapped to bottom");
+		found = first;
+	}
+
+	if ((e = library_find_entry(library_menu, found)) == NULL)
+		return -1;
+
+	menu_select_entry(library_menu, e);
+	return 0;
 }
 
 void
 library_search_next(const char *search)
 {
 	XPTHREAD_MUTEX_LOCK(&library_menu_mtx);
-	menu_search_next(library_menu, search);
+	/* The search index covers the whole library only. */
+	if (library_filter_menu != NULL)
+		menu_search_next(library_filter_menu, search);
+	else if (library_search_index(search, 1) == -1)
+		menu_search_next(library_menu, search);
 	XPTHREAD_MUTEX_UNLOCK(&library_menu_mtx);
 	library_print();
 }
@@ -372,7 +1311,11 @@ void
 library_search_prev(const char *search)
 {
 	XPTHREAD_MUTEX_LOCK(&library_menu_mtx);
-	menu_search_prev(library_menu, search);
+	/* The search index covers the whole library only. */
+	if (library_filter_menu != NULL)
+		menu_search_prev(library_filter_menu, search);
+	else if (library_search_index(search, -1) == -1)
+		menu_search_prev(library_menu, search);
 	XPTHREAD_MUTEX_UNLOCK(&library_menu_mtx);
 	library_print();
 }
@@ -381,7 +1324,7 @@ void
 library_select_active_entry(void)
 {
 	XPTHREAD_MUTEX_LOCK(&library_menu_mtx);
-	menu_select_active_entry(library_menu);
+	menu_select_active_entry(library_get_menu());
 	XPTHREAD_MUTEX_UNLOCK(&library_menu_mtx);
 	library_print();
 }
@@ -390,7 +1333,7 @@ void
 library_select_first_entry(void)
 {
 	XPTHREAD_MUTEX_LOCK(&library_menu_mtx);
-	menu_select_first_entry(library_menu);
+	menu_select_first_entry(library_get_menu());
 	XPTHREAD_MUTEX_UNLOCK(&library_menu_mtx);
 	library_print();
 }
@@ -399,7 +1342,7 @@ void
 library_select_last_entry(void)
 {
 	XPTHREAD_MUTEX_LOCK(&library_menu_mtx);
-	menu_select_last_entry(library_menu);
+	menu_select_last_entry(library_get_menu());
 	XPTHREAD_MUTEX_UNLOCK(&library_menu_mtx);
 	library_print();
 }
@@ -408,7 +1351,7 @@ void
 library_select_next_entry(void)
 {
 	XPTHREAD_MUTEX_LOCK(&library_menu_mtx);
-	menu_select_next_entry(library_menu);
+	menu_select_next_entry(library_get_menu());
 	XPTHREAD_MUTEX_UNLOCK(&library_menu_mtx);
 	library_print();
 }
@@ -417,74 +1360,189 @@ void
 library_select_prev_entry(void)
 {
 	XPTHREAD_MUTEX_LOCK(&library_menu_mtx);
-	menu_select_prev_entry(library_menu);
+	menu_select_prev_entry(library_get_menu());
 	XPTHREAD_MUTEX_UNLOCK(&library_menu_mtx);
 	library_print();
 }
 
-/* Resort the tracks and recalculate the duration. */
-void
-library_update(void)
+/*
+ * Filter the library: only the tracks that match the query (see query.c) are
+ * shown. The library is filtered by the filter thread, so that the user
+ * interface does not block. If query is NULL or empty, the whole library is
+ * shown again.
+ *
+ * If the query is invalid, the filter is left unchanged, -1 is returned and an
+ * error message is stored in *error; the caller must free it.
+ */
+int
+library_set_filter(const char *query, char **error)
+{
+	struct menu_entry	*e;
+	struct query		*q;
+	struct track		*t;
+
+	if (query != NULL && query[0] == '\0')
+		query = NULL;
+
+	if (query != NULL) {
+		if ((q = query_init(query, error)) == NULL)
+			return -1;
+		query_free(q);
+	}
+
+	XPTHREAD_MUTEX_LOCK(&library_menu_mtx);
+	XPTHREAD_MUTEX_LOCK(&library_filter_mtx);
+	if (query == NULL && library_filter_query == NULL) {
+		XPTHREAD_MUTEX_UNLOCK(&library_filter_mtx);
+		XPTHREAD_MUTEX_UNLOCK(&library_menu_mtx);
+		return 0;
+	}
+	if (query != NULL && library_filter_query != NULL &&
+	    !strcmp(query, library_filter_query)) {
+		XPTHREAD_MUTEX_UNLOCK(&library_filter_mtx);
+		XPTHREAD_MUTEX_UNLOCK(&library_menu_mtx);
+		return 0;
+	}
+
+	free(library_filter_query);
+	library_filter_query = (query != NULL) ? xstrdup(query) : NULL;
+	library_filter_job++;
+	XPTHREAD_COND_BROADCAST(&library_filter_cond);
+	XPTHREAD_MUTEX_UNLOCK(&library_filter_mtx);
+
+	if (query == NULL && library_filter_menu != NULL) {
+		/* Keep the selected track selected. */
+		t = menu_get_selected_entry_data(library_filter_menu);
+		if (t != NULL && (e = library_find_entry(library_menu, t)) !=
+		    NULL)
+			menu_select_entry(library_menu, e);
+
+		menu_free(library_filter_menu);
+		library_filter_menu = NULL;
+		free(library_filter_menu_query);
+		library_filter_menu_query = NULL;
+	}
+	XPTHREAD_MUTEX_UNLOCK(&library_menu_mtx);
+
+	if (query == NULL)
+		library_print();
+	return 0;
+}
+
+/*
+ * Sort the library again. The active and selected entries follow their
+ * tracks. The entries themselves stay in place, so the library does not
+ * scroll.
+ */
+static void
+library_sort(void)
 {
-	struct menu_entry	*be, *e, *ne, *pe;
-	struct track		*pt, *t;
+	struct menu_entry	*e;
+	struct track		**tracks, *active, *selected;
+	unsigned int		  i, n;
 
 	XPTHREAD_MUTEX_LOCK(&library_menu_mtx);
 
 	library_duration = 0;
 
-	e = menu_get_first_entry(library_menu);
-	while (e != NULL) {
-		t = menu_get_entry_data(e);
-		library_duration += t->duration;
+	if ((n = menu_get_nentries(library_menu)) == 0) {
+		XPTHREAD_MUTEX_UNLOCK(&library_menu_mtx);
+		return;
+	}
 
-		ne = menu_get_next_entry(e);
+	e = menu_get_active_entry(library_menu);
+	active = (e != NULL) ? menu_get_entry_data(e) : NULL;
+	selected = menu_get_selected_entry_data(library_menu);
 
-		be = NULL;
-		pe = e;
-		while ((pe = menu_get_prev_entry(pe)) != NULL) {
-			pt = menu_get_entry_data(pe);
-			if (track_cmp(t, pt) < 0)
-				be = pe;
-			else
-				break;
-		}
-		if (be != NULL)
-			menu_move_entry_before(library_menu, be, e);
+	tracks = xreallocarray(NULL, n, sizeof *tracks);
+	i = 0;
+	MENU_FOR_EACH_ENTRY(library_menu, e) {
+		tracks[i] = menu_get_entry_data(e);
+		library_duration += tracks[i]->duration;
+		i++;
+	}
+
+	track_sort(tracks, n);
 
-		e = ne;
+	i = 0;
+	MENU_FOR_EACH_ENTRY(library_menu, e) {
+		menu_set_entry_data(e, tracks[i]);
+		if (tracks[i] == active) {
+			menu_activate_entry(library_menu, e);
+			active = NULL;
+		}
+		if (tracks[i] == selected) {
+			menu_select_entry(library_menu, e);
+			selected = NULL;
+		}
+		i++;
 	}
 
+	library_reset_filter(1);
 	XPTHREAD_MUTEX_UNLOCK(&library_menu_mtx);
+
+	free(tracks);
 }
 
-int
-library_write_file(void)
+/*
+ * Sort the library again after the metadata of its tracks has changed.
+ */
+void
+library_update(void)
+{
+	/*
+	 * The search index may no longer match the metadata. If it has been
+	 * used, build it again in the background.
+	 */
+	XPTHREAD_MUTEX_LOCK(&library_menu_mtx);
+	if (library_index_valid) {
+		search_clear(library_index);
+		library_index_valid = 0;
+		library_index_job = 1;
+		XPTHREAD_COND_BROADCAST(&library_index_cond);
+	}
+	library_index_version++;
+	XPTHREAD_MUTEX_UNLOCK(&library_menu_mtx);
+
+	library_sort();
+}
+
+/*
+ * Save the library. The library file is written by the save thread. If report
+ * is set, a message is shown once it has been saved.
+ */
+void
+library_write_file(int report)
 {
 	struct menu_entry	*entry;
 	struct track		*t;
-	FILE			*fp;
-	int			 ret;
-	char			*file;
+	size_t			 len, off, size;
+	char			*buf;
 
-	file = conf_get_path(LIBRARY_FILE);
-	if ((fp = fopen(file, "w")) == NULL) {
-		LOG_ERR("fopen: %s", file);
-		msg_err("Cannot save library");
-		ret = -1;
-	} else {
-		XPTHREAD_MUTEX_LOCK(&library_menu_mtx);
+	XPTHREAD_MUTEX_LOCK(&library_menu_mtx);
+	size = 0;
+	MENU_FOR_EACH_ENTRY(library_menu, entry) {
+		t = menu_get_entry_data(entry);
+		size += strlen(t->path) + 1;
+	}
+
+	if (size == 0)
+		buf = NULL;
+	else {
+		buf = xmalloc(size);
+		off = 0;
 		MENU_FOR_EACH_ENTRY(library_menu, entry) {
 			t = menu_get_entry_data(entry);
-			fprintf(fp, "%s\n", t->path);
+			len = strlen(t->path);
+			memcpy(buf + off, t->path, len);
+			off += len;
+			buf[off++] = '\n';
 		}
-		library_modified = 0;
-		XPTHREAD_MUTEX_UNLOCK(&library_menu_mtx);
-
-		fclose(fp);
-		ret = 0;
 	}
 
-	free(file);
-	return ret;
+	library_nchanges = 0;
+	XPTHREAD_MUTEX_UNLOCK(&library_menu_mtx);
+
+	save_file(conf_get_path(LIBRARY_FILE), buf, size,
+	    report ? "Library saved" : NULL, "Cannot save library");
 }
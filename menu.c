@@ -17,31 +17,59 @@
 #include "config.h"
 
 #include <limits.h>
+#include <stdint.h>
 #include <stdlib.h>
 
 #include "siren.h"
 
+/*
+ * The entries of a menu are kept in a list and in a treap: a binary tree that
+ * is ordered by the position of the entries and balanced by random
+ * priorities. Each node stores the size of its subtree, so that the index of
+ * an entry and the entry at an index can be found in logarithmic time. The
+ * list allows going from an entry to its neighbours in constant time.
+ */
+
 #define MENU_NENTRIES_MAX UINT_MAX
 
+#define MENU_SIZE(e)	((e) == NULL ? 0 : (e)->size)
+
 struct menu {
 	struct menu_entry *active;
 	struct menu_entry *selected;
 	struct menu_entry *top;
+	struct menu_entry *root;
 	unsigned int	 nentries;
+	uint32_t	 seed;
 
 	void		 (*free_entry_data)(void *);
 	void		 (*get_entry_text)(const void *, char *, size_t);
-	int		 (*search_entry_data)(const void *, const char *);
+	int		 (*search_entry_data)(const void *,
+			    const struct pattern *);
 
 	TAILQ_HEAD(menu_list, menu_entry) list;
 };
 
 struct menu_entry {
-	unsigned int	 index;
+	struct menu_entry *parent;
+	struct menu_entry *left;
+	struct menu_entry *right;
+	unsigned int	 size;		/* Number of entries in subtree */
+	uint32_t	 priority;
 	void		*data;
 	TAILQ_ENTRY(menu_entry) entries;
 };
 
+static struct menu_entry *menu_alloc_entry(struct menu *, void *);
+static void		 menu_link_after(struct menu *, struct menu_entry *,
+			    struct menu_entry *);
+static void		 menu_link_before(struct menu *, struct menu_entry *,
+			    struct menu_entry *);
+static void		 menu_tree_insert(struct menu *, struct menu_entry *,
+			    struct menu_entry *, int);
+static void		 menu_tree_remove(struct menu *, struct menu_entry *);
+static void		 menu_tree_rotate(struct menu *, struct menu_entry *);
+
 void
 menu_activate_entry(struct menu *m, struct menu_entry *e)
 {
@@ -51,35 +79,50 @@ menu_activate_entry(struct menu *m, struct menu_entry *e)
 static void
 menu_adjust_scroll_offset(struct menu *m)
 {
-	unsigned int nrows;
+	unsigned int nrows, selected, top;
 
 	if (m->nentries == 0)
 		return;
 
 	nrows = screen_view_get_nrows();
+	selected = menu_get_entry_index(m->selected);
+	top = menu_get_entry_index(m->top);
 
 	/*
 	 * If the selected entry is above the viewport, then move the selected
 	 * entry to the top of the viewport.
 	 */
-	if (m->selected->index < m->top->index || nrows == 0)
+	if (selected < top || nrows == 0)
 		m->top = m->selected;
 	/*
 	 * If the selected entry is below the viewport, then move the selected
 	 * entry to the bottom of the viewport.
 	 */
-	else if (m->selected->index >= m->top->index + nrows)
-		do
-			m->top = TAILQ_NEXT(m->top, entries);
-		while (m->top->index != m->selected->index - nrows + 1);
+	else if (selected >= top + nrows)
+		m->top = menu_get_entry(m, selected - nrows + 1);
 	/*
 	 * If the viewport extends below the last entry, then, if possible,
 	 * move the last entry to the bottom of the viewport.
 	 */
-	else
-		while (m->top->index > 0 &&
-		    m->top->index + nrows > m->nentries)
-			m->top = TAILQ_PREV(m->top, menu_list, entries);
+	else if (top > 0 && top + nrows > m->nentries)
+		m->top = menu_get_entry(m, m->nentries > nrows ?
+		    m->nentries - nrows : 0);
+}
+
+static struct menu_entry *
+menu_alloc_entry(struct menu *m, void *data)
+{
+	struct menu_entry *e;
+
+	/* Xorshift generator. */
+	m->seed ^= m->seed << 13;
+	m->seed ^= m->seed >> 17;
+	m->seed ^= m->seed << 5;
+
+	e = xmalloc(sizeof *e);
+	e->priority = m->seed;
+	e->data = data;
+	return e;
 }
 
 void
@@ -95,12 +138,48 @@ menu_get_active_entry(const struct menu *m)
 	return m->active;
 }
 
+/*
+ * Return the entry at the specified index, or NULL if there is none.
+ */
+struct menu_entry *
+menu_get_entry(const struct menu *m, unsigned int idx)
+{
+	struct menu_entry	*e;
+	unsigned int		 n;
+
+	e = m->root;
+	while (e != NULL) {
+		n = MENU_SIZE(e->left);
+		if (idx < n)
+			e = e->left;
+		else if (idx == n)
+			break;
+		else {
+			idx -= n + 1;
+			e = e->right;
+		}
+	}
+	return e;
+}
+
 void *
 menu_get_entry_data(const struct menu_entry *e)
 {
 	return e->data;
 }
 
+unsigned int
+menu_get_entry_index(const struct menu_entry *e)
+{
+	unsigned int idx;
+
+	idx = MENU_SIZE(e->left);
+	for (; e->parent != NULL; e = e->parent)
+		if (e->parent->right == e)
+			idx += MENU_SIZE(e->parent->left) + 1;
+	return idx;
+}
+
 struct menu_entry *
 menu_get_first_entry(const struct menu *m)
 {
@@ -146,7 +225,7 @@ menu_get_selected_entry_data(const struct menu *m)
 struct menu *
 menu_init(void (*free_entry_data)(void *),
     void (*get_entry_text)(const void *, char *, size_t),
-    int (*search_entry_data)(const void *, const char *))
+    int (*search_entry_data)(const void *, const struct pattern *))
 {
 	struct menu *m;
 
@@ -154,7 +233,9 @@ menu_init(void (*free_entry_data)(void *),
 	m->active = NULL;
 	m->selected = NULL;
 	m->top = NULL;
+	m->root = NULL;
 	m->nentries = 0;
+	m->seed = 2463534242U;
 	m->free_entry_data = free_entry_data;
 	m->get_entry_text = get_entry_text;
 	m->search_entry_data = search_entry_data;
@@ -165,41 +246,21 @@ menu_init(void (*free_entry_data)(void *),
 void
 menu_insert_after(struct menu *m, struct menu_entry *le, void *data)
 {
-	struct menu_entry *e;
-
 	if (m->nentries == MENU_NENTRIES_MAX)
 		return;
 
-	e = xmalloc(sizeof *e);
-	e->data = data;
-	e->index = le->index + 1;
-
-	TAILQ_INSERT_AFTER(&m->list, le, e, entries);
+	menu_link_after(m, le, menu_alloc_entry(m, data));
 	m->nentries++;
-
-	/* Increment the index of the entries after the inserted entry. */
-	while ((e = TAILQ_NEXT(e, entries)) != NULL)
-		e->index++;
 }
 
 void
 menu_insert_before(struct menu *m, struct menu_entry *le, void *data)
 {
-	struct menu_entry *e;
-
 	if (m->nentries == MENU_NENTRIES_MAX)
 		return;
 
-	e = xmalloc(sizeof *e);
-	e->data = data;
-	e->index = le->index;
-
-	TAILQ_INSERT_BEFORE(le, e, entries);
+	menu_link_before(m, le, menu_alloc_entry(m, data));
 	m->nentries++;
-
-	/* Increment the index of the entries after the inserted entry. */
-	while ((e = TAILQ_NEXT(e, entries)) != NULL)
-		e->index++;
 }
 
 void
@@ -210,23 +271,18 @@ menu_insert_head(struct menu *m, void *data)
 	if (m->nentries == MENU_NENTRIES_MAX)
 		return;
 
-	e = xmalloc(sizeof *e);
-	e->data = data;
-	e->index = 0;
-
-	TAILQ_INSERT_HEAD(&m->list, e, entries);
-	m->nentries++;
-
-	if (m->nentries == 1)
+	e = menu_alloc_entry(m, data);
+	if (m->nentries == 0) {
+		menu_tree_insert(m, e, NULL, 0);
+		TAILQ_INSERT_HEAD(&m->list, e, entries);
 		/*
 		 * This is the first entry in the menu: make it the top entry
 		 * and the selected entry.
 		 */
 		m->top = m->selected = e;
-
-	/* Increment the index of the entries after the inserted entry. */
-	while ((e = TAILQ_NEXT(e, entries)) != NULL)
-		e->index++;
+	} else
+		menu_link_before(m, TAILQ_FIRST(&m->list), e);
+	m->nentries++;
 }
 
 void
@@ -237,19 +293,52 @@ menu_insert_tail(struct menu *m, void *data)
 	if (m->nentries == MENU_NENTRIES_MAX)
 		return;
 
-	e = xmalloc(sizeof *e);
-	e->data = data;
-	e->index = m->nentries;
-
-	TAILQ_INSERT_TAIL(&m->list, e, entries);
-	m->nentries++;
-
-	if (m->nentries == 1)
+	e = menu_alloc_entry(m, data);
+	if (m->nentries == 0) {
+		menu_tree_insert(m, e, NULL, 0);
+		TAILQ_INSERT_TAIL(&m->list, e, entries);
 		/*
 		 * This is the first entry in the menu: make it the top entry
 		 * and the selected entry.
 		 */
 		m->top = m->selected = e;
+	} else
+		menu_link_after(m, TAILQ_LAST(&m->list, menu_list), e);
+	m->nentries++;
+}
+
+/*
+ * Insert entry e after entry le.
+ */
+static void
+menu_link_after(struct menu *m, struct menu_entry *le, struct menu_entry *e)
+{
+	/*
+	 * If le has a right subtree, the entry after le is its leftmost
+	 * entry.
+	 */
+	if (le->right == NULL)
+		menu_tree_insert(m, e, le, 0);
+	else
+		menu_tree_insert(m, e, TAILQ_NEXT(le, entries), 1);
+	TAILQ_INSERT_AFTER(&m->list, le, e, entries);
+}
+
+/*
+ * Insert entry e before entry be.
+ */
+static void
+menu_link_before(struct menu *m, struct menu_entry *be, struct menu_entry *e)
+{
+	/*
+	 * If be has a left subtree, the entry before be is its rightmost
+	 * entry.
+	 */
+	if (be->left == NULL)
+		menu_tree_insert(m, e, be, 1);
+	else
+		menu_tree_insert(m, e, TAILQ_PREV(be, menu_list, entries), 0);
+	TAILQ_INSERT_BEFORE(be, e, entries);
 }
 
 /* Move entry e before entry be. */
@@ -257,16 +346,12 @@ void
 menu_move_entry_before(struct menu *m, struct menu_entry *be,
     struct menu_entry *e)
 {
-	struct menu_entry *f;
-
-	/* Update the index of each relevant entry. */
-	e->index = be->index;
-	for (f = be; f != e; f = TAILQ_NEXT(f, entries))
-		f->index++;
+	if (be == e)
+		return;
 
-	/* Move the entry to its new position. */
+	menu_tree_remove(m, e);
 	TAILQ_REMOVE(&m->list, e, entries);
-	TAILQ_INSERT_BEFORE(be, e, entries);
+	menu_link_before(m, be, e);
 }
 
 void
@@ -303,7 +388,7 @@ menu_print(struct menu *m)
 		bottomrow = 0;
 		percent = 100;
 	} else {
-		toprow = m->top->index + 1;
+		toprow = menu_get_entry_index(m->top) + 1;
 		if (nrows == 0) {
 			bottomrow = 0;
 			percent = 100 * toprow / m->nentries;
@@ -353,14 +438,13 @@ menu_remove_all_entries(struct menu *m)
 	m->active = NULL;
 	m->selected = NULL;
 	m->top = NULL;
+	m->root = NULL;
 	m->nentries = 0;
 }
 
 void
 menu_remove_entry(struct menu *m, struct menu_entry *e)
 {
-	struct menu_entry *f;
-
 	if (m->active == e)
 		m->active = NULL;
 	if (m->top == e)
@@ -373,11 +457,7 @@ menu_remove_entry(struct menu *m, struct menu_entry *e)
 			    entries);
 	}
 
-	/* Decrement the index of the entries after the specified entry. */
-	f = e;
-	while ((f = TAILQ_NEXT(f, entries)) != NULL)
-		f->index--;
-
+	menu_tree_remove(m, e);
 	TAILQ_REMOVE(&m->list, e, entries);
 	m->nentries--;
 
@@ -396,7 +476,7 @@ menu_remove_selected_entry(struct menu *m)
 void
 menu_scroll_down(struct menu *m, enum menu_scroll scroll)
 {
-	unsigned int nrows, nscroll;
+	unsigned int nrows, nscroll, top;
 
 	if (m->nentries == 0)
 		return;
@@ -415,7 +495,8 @@ menu_scroll_down(struct menu *m, enum menu_scroll scroll)
 		break;
 	}
 
-	if (m->top->index + nrows >= m->nentries)
+	top = menu_get_entry_index(m->top);
+	if (top + nrows >= m->nentries)
 		/*
 		 * The last entry already is visible, so we cannot scroll down
 		 * farther. Select the last entry instead.
@@ -426,14 +507,16 @@ menu_scroll_down(struct menu *m, enum menu_scroll scroll)
 		 * Scroll down the requested number of lines or just as far as
 		 * possible.
 		 */
-		while (nscroll-- > 0 && m->top->index + nrows < m->nentries)
-			m->top = TAILQ_NEXT(m->top, entries);
+		if (nscroll > m->nentries - nrows - top)
+			nscroll = m->nentries - nrows - top;
+		top += nscroll;
+		m->top = menu_get_entry(m, top);
 
 		/*
 		 * Select the top entry if the selected entry is no longer
 		 * visible.
 		 */
-		if (m->selected->index < m->top->index)
+		if (menu_get_entry_index(m->selected) < top)
 			m->selected = m->top;
 	}
 }
@@ -441,7 +524,7 @@ menu_scroll_down(struct menu *m, enum menu_scroll scroll)
 void
 menu_scroll_up(struct menu *m, enum menu_scroll scroll)
 {
-	unsigned int nrows, nscroll;
+	unsigned int nrows, nscroll, top;
 
 	if (m->nentries == 0)
 		return;
@@ -460,7 +543,8 @@ menu_scroll_up(struct menu *m, enum menu_scroll scroll)
 		break;
 	}
 
-	if (m->top->index == 0)
+	top = menu_get_entry_index(m->top);
+	if (top == 0)
 		/*
 		 * The first entry already is visible, so we cannot scroll up
 		 * farther. Select the first entry instead.
@@ -471,25 +555,26 @@ menu_scroll_up(struct menu *m, enum menu_scroll scroll)
 		 * Scroll up the requested number of lines or just as far as
 		 * possible.
 		 */
-		while (nscroll-- > 0 && m->top->index > 0)
-			m->top = TAILQ_PREV(m->top, menu_list, entries);
+		top = (nscroll < top) ? top - nscroll : 0;
+		m->top = menu_get_entry(m, top);
 
 		/*
 		 * Select the bottom entry if the selected entry is no longer
 		 * visible.
 		 */
-		while (m->selected->index >= m->top->index + nrows)
-			m->selected = TAILQ_PREV(m->selected, menu_list,
-			    entries);
+		if (menu_get_entry_index(m->selected) >= top + nrows)
+			m->selected = menu_get_entry(m, top + nrows - 1);
 	}
 }
 
 void
 menu_search_next(struct menu *m, const char *s)
 {
-	struct menu_entry *e;
+	struct menu_entry	*e;
+	struct pattern		*p;
 
 	if (m->selected != NULL && m->search_entry_data != NULL) {
+		p = pattern_init(s);
 		e = m->selected;
 		do {
 			if (TAILQ_NEXT(e, entries) != NULL)
@@ -499,11 +584,13 @@ menu_search_next(struct menu *m, const char *s)
 				msg_info("Search wrapped to top");
 			}
 
-			if (m->search_entry_data(e->data, s) == 0) {
+			if (m->search_entry_data(e->data, p) == 0) {
 				m->selected = e;
+				pattern_free(p);
 				return;
 			}
 		} while (e != m->selected);
+		pattern_free(p);
 	}
 
 	msg_errx("Not found");
@@ -512,9 +599,11 @@ menu_search_next(struct menu *m, const char *s)
 void
 menu_search_prev(struct menu *m, const char *s)
 {
-	struct menu_entry *e;
+	struct menu_entry	*e;
+	struct pattern		*p;
 
 	if (m->selected != NULL && m->search_entry_data != NULL) {
+		p = pattern_init(s);
 		e = m->selected;
 		do {
 			if (TAILQ_PREV(e, menu_list, entries) != NULL)
@@ -524,11 +613,13 @@ menu_search_prev(struct menu *m, const char *s)
 				msg_info("Search wrapped to bottom");
 			}
 
-			if (m->search_entry_data(e->data, s) == 0) {
+			if (m->search_entry_data(e->data, p) == 0) {
 				m->selected = e;
+				pattern_free(p);
 				return;
 			}
 		} while (e != m->selected);
+		pattern_free(p);
 	}
 
 	msg_errx("Not found");
@@ -573,3 +664,105 @@ menu_select_prev_entry(struct menu *m)
 	    TAILQ_PREV(m->selected, menu_list, entries) != NULL)
 		m->selected = TAILQ_PREV(m->selected, menu_list, entries);
 }
+
+void
+menu_set_entry_data(struct menu_entry *e, void *data)
+{
+	e->data = data;
+}
+
+/*
+ * Insert entry e into the tree as a leaf. It becomes the left child of parent
+ * if left is set or the right child otherwise. The child must not exist.
+ */
+static void
+menu_tree_insert(struct menu *m, struct menu_entry *e,
+    struct menu_entry *parent, int left)
+{
+	struct menu_entry *p;
+
+	e->parent = parent;
+	e->left = NULL;
+	e->right = NULL;
+	e->size = 1;
+
+	if (parent == NULL)
+		m->root = e;
+	else if (left)
+		parent->left = e;
+	else
+		parent->right = e;
+
+	for (p = parent; p != NULL; p = p->parent)
+		p->size++;
+
+	/* Restore the heap order of the priorities. */
+	while (e->parent != NULL && e->priority < e->parent->priority)
+		menu_tree_rotate(m, e);
+}
+
+static void
+menu_tree_remove(struct menu *m, struct menu_entry *e)
+{
+	struct menu_entry *c, *p;
+
+	/* Rotate the entry down until it is a leaf. */
+	while (e->left != NULL || e->right != NULL) {
+		if (e->left == NULL)
+			c = e->right;
+		else if (e->right == NULL)
+			c = e->left;
+		else if (e->left->priority < e->right->priority)
+			c = e->left;
+		else
+			c = e->right;
+		menu_tree_rotate(m, c);
+	}
+
+	p = e->parent;
+	if (p == NULL)
+		m->root = NULL;
+	else if (p->left == e)
+		p->left = NULL;
+	else
+		p->right = NULL;
+
+	for (; p != NULL; p = p->parent)
+		p->size--;
+}
+
+/*
+ * Rotate entry e above its parent.
+ */
+static void
+menu_tree_rotate(struct menu *m, struct menu_entry *e)
+{
+	struct menu_entry *g, *p;
+
+	p = e->parent;
+	g = p->parent;
+
+	if (p->left == e) {
+		p->left = e->right;
+		if (e->right != NULL)
+			e->right->parent = p;
+		e->right = p;
+	} else {
+		p->right = e->left;
+		if (e->left != NULL)
+			e->left->parent = p;
+		e->left = p;
+	}
+
+	p->parent = e;
+	e->parent = g;
+	if (g == NULL)
+		m->root = e;
+	else if (g->left == p)
+		g->left = e;
+	else
+		g->right = e;
+
+	e->size = p->size;
+	p->size = MENU_SIZE(p->left) + MENU_SIZE(p->right) + 1;
+}
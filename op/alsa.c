@@ -141,11 +141,11 @@ static int
 op_alsa_init(void)
 {
 	option_add_string("alsa-mixer-device", OP_ALSA_MIXER_DEVICE,
-	    player_reopen_op);
+	    NULL, player_reopen_op);
 	option_add_string("alsa-mixer-element", OP_ALSA_MIXER_ELEM,
-	    player_reopen_op);
+	    NULL, player_reopen_op);
 	option_add_string("alsa-pcm-device", OP_ALSA_PCM_DEVICE,
-	    player_reopen_op);
+	    NULL, player_reopen_op);
 	snd_lib_error_set_handler(op_alsa_handle_error);
 	return 0;
 }
@@ -79,7 +79,7 @@ op_ao_init(void)
 {
 	option_add_number("ao-buffer-size", OP_AO_BUFSIZE, 1, INT_MAX,
 	    player_reopen_op);
-	option_add_string("ao-driver", OP_AO_DRIVER, player_reopen_op);
+	option_add_string("ao-driver", OP_AO_DRIVER, NULL, player_reopen_op);
 	return 0;
 }
 
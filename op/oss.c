@@ -134,7 +134,7 @@ op_oss_get_volume_support(void)
 static int
 op_oss_init(void)
 {
-	option_add_string("oss-device", OP_OSS_DEVICE, player_reopen_op);
+	option_add_string("oss-device", OP_OSS_DEVICE, NULL, player_reopen_op);
 	return 0;
 }
 
@@ -91,7 +91,7 @@ op_sndio_get_volume_support(void)
 static int
 op_sndio_init(void)
 {
-	option_add_string("sndio-device", SIO_DEVANY, player_reopen_op);
+	option_add_string("sndio-device", SIO_DEVANY, NULL, player_reopen_op);
 	return 0;
 }
 
@@ -114,7 +114,7 @@ op_sun_get_volume_support(void)
 static int
 op_sun_init(void)
 {
-	option_add_string("sun-device", OP_SUN_DEVICE, player_reopen_op);
+	option_add_string("sun-device", OP_SUN_DEVICE, NULL, player_reopen_op);
 	return 0;
 }
 
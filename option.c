@@ -41,11 +41,15 @@ struct option_entry {
 			int		 max;
 		} number;
 
+		struct {
+			char		*cur;
+			int		(*check)(const char *, char **);
+		} string;
+
 		struct format		*format;
 		int			 colour;
 		int			 attrib;
 		int			 boolean;
-		char			*string;
 	} value;
 	void			 (*callback)(void);
 
@@ -56,6 +60,8 @@ RB_HEAD(option_tree, option_entry);
 
 static int			 option_cmp_entry(struct option_entry *,
 				    struct option_entry *);
+static struct option_entry	*option_find_type(const char *,
+				    enum option_type);
 static void			 option_insert_entry(struct option_entry *);
 
 static struct option_tree	option_tree = RB_INITIALIZER(option_tree);
@@ -182,15 +188,21 @@ option_add_number(const char *name, int value, int minvalue, int maxvalue,
 	option_insert_entry(o);
 }
 
+/*
+ * Add a string option. If check is not NULL, it is used to validate a new
+ * value; see option_check_string().
+ */
 void
-option_add_string(const char *name, const char *value, void (*callback)(void))
+option_add_string(const char *name, const char *value,
+    int (*check)(const char *, char **), void (*callback)(void))
 {
 	struct option_entry *o;
 
 	o = xmalloc(sizeof *o);
 	o->name = xstrdup(name);
 	o->type = OPTION_TYPE_STRING;
-	o->value.string = xstrdup(value);
+	o->value.string.cur = xstrdup(value);
+	o->value.string.check = check;
 	o->callback = callback;
 	option_insert_entry(o);
 }
@@ -225,6 +237,24 @@ option_boolean_to_string(int boolean)
 	LOG_FATALX("unknown boolean");
 }
 
+/*
+ * Check whether a value is valid for a string option. If it is not, -1 is
+ * returned and an error message is stored in *error; the caller must free it.
+ */
+int
+option_check_string(const char *name, const char *value, char **error)
+{
+	struct option_entry	*o;
+	int			(*check)(const char *, char **);
+
+	XPTHREAD_MUTEX_LOCK(&option_tree_mtx);
+	o = option_find_type(name, OPTION_TYPE_STRING);
+	check = o->value.string.check;
+	XPTHREAD_MUTEX_UNLOCK(&option_tree_mtx);
+
+	return (check != NULL) ? check(value, error) : 0;
+}
+
 static int
 option_cmp_entry(struct option_entry *o1, struct option_entry *o2)
 {
@@ -262,7 +292,7 @@ option_end(void)
 			format_free(o->value.format);
 			break;
 		case OPTION_TYPE_STRING:
-			free(o->value.string);
+			free(o->value.string.cur);
 			break;
 		/* Silence gcc. */
 		default:
@@ -394,7 +424,7 @@ option_get_string(const char *name)
 
 	XPTHREAD_MUTEX_LOCK(&option_tree_mtx);
 	o = option_find_type(name, OPTION_TYPE_STRING);
-	string = xstrdup(o->value.string);
+	string = xstrdup(o->value.string.cur);
 	XPTHREAD_MUTEX_UNLOCK(&option_tree_mtx);
 	return string;
 }
@@ -419,12 +449,19 @@ option_get_type(const char *name, enum option_type *type)
 void
 option_init(void)
 {
+	option_add_number("autosave-threshold", 100, 0, INT_MAX, NULL);
+	option_add_number("cache-size", 10000, 0, INT_MAX, NULL);
 	option_add_boolean("continue", 1, player_print);
 	option_add_boolean("continue-after-error", 0, NULL);
+	option_add_boolean("detect-file-type", 0, browser_refresh_dir);
 	option_add_format("library-format", "%-*a %-*l %4y %2n. %-*t %5d",
 	    library_print);
 	option_add_format("library-format-alt", "%-*F %5d", library_print);
-	option_add_string("output-plugin", "default", player_change_op);
+	option_add_string("library-sort",
+	    "albumartist,date,album,discnumber,tracknumber,title",
+	    track_check_sort, library_change_sort);
+	option_add_number("metadata-threads", 0, 0, 64, NULL);
+	option_add_string("output-plugin", "default", NULL, player_change_op);
 	option_add_format("player-status-format",
 	    "%-7s  %5p / %5d  %3v%%  %u%{?c,  continue,}%{?r,  repeat-all,}"
 	    "%{?t,  repeat-track,}", player_print);
@@ -433,6 +470,8 @@ option_init(void)
 	option_add_format("player-track-format-alt", "%F", player_print);
 	option_add_format("playlist-format", "%-*a %-*t %5d", playlist_print);
 	option_add_format("playlist-format-alt", "%-*F %5d", playlist_print);
+	option_add_number("prefetch-buffer-size", 8192, 0, 1024 * 1024, NULL);
+	option_add_number("prefetch-lookahead", 4096, 0, 1024 * 1024, NULL);
 	option_add_format("queue-format", "%-*a %-*t %5d", queue_print);
 	option_add_format("queue-format-alt", "%-*F %5d", queue_print);
 	option_add_boolean("repeat-all", 1, player_print);
@@ -580,11 +619,11 @@ option_set_string(const char *name, const char *value)
 
 	XPTHREAD_MUTEX_LOCK(&option_tree_mtx);
 	o = option_find_type(name, OPTION_TYPE_STRING);
-	if (!strcmp(value, o->value.string))
+	if (!strcmp(value, o->value.string.cur))
 		XPTHREAD_MUTEX_UNLOCK(&option_tree_mtx);
 	else {
-		free(o->value.string);
-		o->value.string = xstrdup(value);
+		free(o->value.string.cur);
+		o->value.string.cur = xstrdup(value);
 		XPTHREAD_MUTEX_UNLOCK(&option_tree_mtx);
 		if (o->callback != NULL)
 			o->callback();
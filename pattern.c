@@ -0,0 +1,282 @@
+/*
+ * Copyright (c) 2026 Tim van der Molen <tim@kariliq.nl>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * A pattern is a string that is searched for case-insensitively. Unlike
+ * strcasestr(), case is folded independently of the locale, and UTF-8 text in
+ * the Latin, Greek, Cyrillic and Armenian scripts is folded as well as ASCII.
+ * Bytes that are not valid UTF-8 only match themselves.
+ *
+ * The pattern is folded once, when it is compiled. A pattern that consists
+ * only of ASCII characters is searched for byte by byte: candidate positions
+ * are found by looking for the first byte of the pattern with memchr(), which
+ * usually is much faster than examining each byte, and are then checked
+ * against the last byte before the rest of the pattern is compared. Other
+ * patterns are compared character by character.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "siren.h"
+
+/* Fold an ASCII character. */
+#define PATTERN_FOLD_ASCII(c) \
+	((unsigned int)(c) - 'A' < 26 ? (c) | 0x20 : (c))
+
+/* Value returned for a byte that is not part of a valid UTF-8 character. */
+#define PATTERN_INVALID(c) (0xdc00 | (c))
+
+struct pattern {
+	char		*text;		/* Folded pattern if it is ASCII */
+	size_t		 len;
+	uint32_t	*chars;		/* Folded characters otherwise */
+	size_t		 nchars;
+};
+
+static uint32_t		 pattern_fold(uint32_t);
+static uint32_t		 pattern_get_char(const char **);
+static int		 pattern_match_ascii(const struct pattern *,
+			    const char *);
+static int		 pattern_match_chars(const struct pattern *,
+			    const char *);
+
+/*
+ * Fold a character to lower case. Only the simple one-to-one mappings of the
+ * most common scripts are supported.
+ */
+static uint32_t
+pattern_fold(uint32_t c)
+{
+	if (c < 0x80)
+		return PATTERN_FOLD_ASCII(c);
+
+	/* Latin-1 Supplement. */
+	if (c < 0x100)
+		return (c >= 0xc0 && c <= 0xde && c != 0xd7) ? c + 0x20 : c;
+
+	/* Latin Extended-A. */
+	if (c < 0x180) {
+		if ((c < 0x130 || (c >= 0x132 && c <= 0x137) ||
+		    (c >= 0x14a && c <= 0x177)) && c % 2 == 0)
+			return c + 1;
+		if (((c >= 0x139 && c <= 0x148) ||
+		    (c >= 0x179 && c <= 0x17e)) && c % 2 == 1)
+			return c + 1;
+		if (c == 0x178)
+			return 0xff;
+		return c;
+	}
+
+	/* Greek. */
+	if (c >= 0x386 && c <= 0x3ab) {
+		if (c >= 0x391 && c != 0x3a2)
+			return c + 0x20;
+		if (c == 0x386)
+			return 0x3ac;
+		if (c >= 0x388 && c <= 0x38a)
+			return c + 0x25;
+		if (c == 0x38c)
+			return 0x3cc;
+		if (c == 0x38e || c == 0x38f)
+			return c + 0x3f;
+		return c;
+	}
+	if (c == 0x3c2)
+		return 0x3c3;
+
+	/* Cyrillic. */
+	if (c >= 0x400 && c <= 0x42f)
+		return c < 0x410 ? c + 0x50 : c + 0x20;
+	if (((c >= 0x460 && c <= 0x481) || (c >= 0x48a && c <= 0x4bf)) &&
+	    c % 2 == 0)
+		return c + 1;
+
+	/* Armenian. */
+	if (c >= 0x531 && c <= 0x556)
+		return c + 0x30;
+
+	/* Latin Extended Additional. */
+	if (((c >= 0x1e00 && c <= 0x1e95) || (c >= 0x1ea0 && c <= 0x1eff)) &&
+	    c % 2 == 0)
+		return c + 1;
+	if (c == 0x1e9e)
+		return 0xdf;
+
+	return c;
+}
+
+void
+pattern_free(struct pattern *p)
+{
+	free(p->text);
+	free(p->chars);
+	free(p);
+}
+
+/*
+ * Decode the UTF-8 character at *s and advance *s past it.
+ */
+static uint32_t
+pattern_get_char(const char **s)
+{
+	const unsigned char	*u;
+	uint32_t		 c;
+	size_t			 i, n;
+
+	u = (const unsigned char *)*s;
+	if (u[0] < 0x80) {
+		(*s)++;
+		return u[0];
+	}
+
+	if ((u[0] & 0xe0) == 0xc0 && u[0] >= 0xc2) {
+		c = u[0] & 0x1f;
+		n = 1;
+	} else if ((u[0] & 0xf0) == 0xe0) {
+		c = u[0] & 0x0f;
+		n = 2;
+	} else if ((u[0] & 0xf8) == 0xf0 && u[0] <= 0xf4) {
+		c = u[0] & 0x07;
+		n = 3;
+	} else {
+		(*s)++;
+		return PATTERN_INVALID(u[0]);
+	}
+
+	for (i = 1; i <= n; i++) {
+		if ((u[i] & 0xc0) != 0x80) {
+			(*s)++;
+			return PATTERN_INVALID(u[0]);
+		}
+		c = (c << 6) | (u[i] & 0x3f);
+	}
+
+	*s += n + 1;
+	return c;
+}
+
+struct pattern *
+pattern_init(const char *s)
+{
+	struct pattern	*p;
+	const char	*t;
+	size_t		 i;
+
+	p = xmalloc(sizeof *p);
+	p->text = NULL;
+	p->len = strlen(s);
+	p->chars = NULL;
+	p->nchars = 0;
+
+	for (i = 0; i < p->len; i++)
+		if ((unsigned char)s[i] >= 0x80)
+			break;
+
+	if (i == p->len) {
+		p->text = xmalloc(p->len + 1);
+		for (i = 0; i <= p->len; i++)
+			p->text[i] = PATTERN_FOLD_ASCII(s[i]);
+	} else {
+		p->chars = xreallocarray(NULL, p->len, sizeof *p->chars);
+		for (t = s; *t != '\0';)
+			p->chars[p->nchars++] = pattern_fold(
+			    pattern_get_char(&t));
+	}
+
+	return p;
+}
+
+/*
+ * Return 1 if the pattern occurs in a string, or 0 otherwise. An empty
+ * pattern occurs in every string.
+ */
+int
+pattern_match(const struct pattern *p, const char *s)
+{
+	if (p->text != NULL)
+		return pattern_match_ascii(p, s);
+	else
+		return pattern_match_chars(p, s);
+}
+
+static int
+pattern_match_ascii(const struct pattern *p, const char *s)
+{
+	const char	*end, *lower, *upper, *t;
+	size_t		 i, len;
+	int		 first, last;
+
+	if (p->len == 0)
+		return 1;
+
+	len = strlen(s);
+	if (len < p->len)
+		return 0;
+
+	/* The pattern can only start before this position. */
+	end = s + len - p->len + 1;
+
+	first = p->text[0];
+	last = p->text[p->len - 1];
+	lower = memchr(s, first, end - s);
+	if (first >= 'a' && first <= 'z')
+		upper = memchr(s, first - 0x20, end - s);
+	else
+		upper = NULL;
+
+	for (;;) {
+		if (lower == NULL && upper == NULL)
+			return 0;
+		if (upper == NULL || (lower != NULL && lower < upper))
+			t = lower;
+		else
+			t = upper;
+
+		if (PATTERN_FOLD_ASCII(t[p->len - 1]) == last) {
+			for (i = 1; i < p->len - 1; i++)
+				if (PATTERN_FOLD_ASCII(t[i]) != p->text[i])
+					break;
+			if (i >= p->len - 1)
+				return 1;
+		}
+
+		if (t == lower)
+			lower = memchr(t + 1, first, end - t - 1);
+		else
+			upper = memchr(t + 1, first - 0x20, end - t - 1);
+	}
+}
+
+static int
+pattern_match_chars(const struct pattern *p, const char *s)
+{
+	const char	*t;
+	size_t		 i;
+
+	for (; *s != '\0'; pattern_get_char(&s)) {
+		t = s;
+		for (i = 0; i < p->nchars && *t != '\0'; i++)
+			if (pattern_fold(pattern_get_char(&t)) != p->chars[i])
+				break;
+		if (i == p->nchars)
+			return 1;
+	}
+	return 0;
+}
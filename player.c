@@ -20,6 +20,8 @@
 #include <signal.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #include "siren.h"
 
@@ -33,6 +35,9 @@
 #define PLAYER_FMT_VOLUME	7
 #define PLAYER_FMT_NVARS	8
 
+/* Number of decoders kept for reuse by subsequent tracks. */
+#define PLAYER_NDECODERS	4
+
 enum player_command {
 	PLAYER_COMMAND_PAUSE,
 	PLAYER_COMMAND_PLAY,
@@ -47,8 +52,13 @@ enum player_state {
 };
 
 static void			 player_close_op(void);
+static void			 player_close_track(void);
+static void			 player_free_decoders(void);
+static void			 player_log_latency(void);
 static int			 player_open_op(void);
+static int			 player_open_track(void);
 static void			*player_playback_handler(void *);
+static void			 player_prefetch_next_track(void);
 static void			 player_print_status(void);
 static void			 player_print_track(void);
 static void			 player_quit(void);
@@ -74,6 +84,17 @@ static pthread_mutex_t		 player_track_mtx = PTHREAD_MUTEX_INITIALIZER;
 
 static enum byte_order		 player_byte_order;
 
+/* Decoders kept by player_close_track() for use by player_open_track(). */
+static struct {
+	const struct ip	*ip;
+	void		*decoder;
+}				 player_decoders[PLAYER_NDECODERS];
+static size_t			 player_ndecoders;
+
+/* Used to measure the time between opening a track and playing it. */
+static struct timespec		 player_open_time;
+static int			 player_latency_pending;
+
 /*
  * The player_state_mtx mutex must be locked before calling this function.
  */
@@ -91,7 +112,12 @@ player_begin_playback(struct sample_buffer *sb)
 		goto error1;
 	}
 
-	if (player_track->ip->open(player_track))
+	if (clock_gettime(CLOCK_MONOTONIC, &player_open_time) == -1)
+		LOG_ERR("clock_gettime");
+	else
+		player_latency_pending = 1;
+
+	if (player_open_track() == -1)
 		goto error1;
 
 	LOG_DEBUG("rate=%u, nchannels=%u, nbits=%u", player_track->format.rate,
@@ -137,7 +163,7 @@ player_begin_playback(struct sample_buffer *sb)
 	return 0;
 
 error2:
-	player_track->ip->close(player_track);
+	player_close_track();
 error1:
 	XPTHREAD_MUTEX_UNLOCK(&player_op_mtx);
 	XPTHREAD_MUTEX_UNLOCK(&player_track_mtx);
@@ -172,6 +198,36 @@ player_close_op(void)
 	}
 }
 
+/*
+ * If possible, keep the decoder of the current track, so that it can be used
+ * again for the next track.
+ *
+ * The player_track_mtx mutex must be locked before calling this function.
+ */
+static void
+player_close_track(void)
+{
+	const struct ip	*ip;
+	void		*decoder;
+
+	ip = player_track->ip;
+	if (ip->reset == NULL || (decoder = ip->reset(player_track)) == NULL) {
+		ip->close(player_track);
+		return;
+	}
+
+	/* If the pool is full, free the least recently used decoder. */
+	if (player_ndecoders == PLAYER_NDECODERS) {
+		player_decoders[0].ip->free_decoder(player_decoders[0].decoder);
+		memmove(player_decoders, player_decoders + 1,
+		    --player_ndecoders * sizeof *player_decoders);
+	}
+
+	player_decoders[player_ndecoders].ip = ip;
+	player_decoders[player_ndecoders].decoder = decoder;
+	player_ndecoders++;
+}
+
 static void
 player_determine_byte_order(void)
 {
@@ -190,13 +246,14 @@ player_end(void)
 	player_quit();
 	XPTHREAD_JOIN(player_playback_thd, NULL);
 	player_close_op();
+	player_free_decoders();
 }
 
 static void
 player_end_playback(struct sample_buffer *sb)
 {
 	XPTHREAD_MUTEX_LOCK(&player_track_mtx);
-	player_track->ip->close(player_track);
+	player_close_track();
 	XPTHREAD_MUTEX_UNLOCK(&player_track_mtx);
 
 	XPTHREAD_MUTEX_LOCK(&player_op_mtx);
@@ -221,6 +278,17 @@ player_forcibly_close_op(void)
 	XPTHREAD_MUTEX_UNLOCK(&player_op_mtx);
 }
 
+static void
+player_free_decoders(void)
+{
+	size_t i;
+
+	for (i = 0; i < player_ndecoders; i++)
+		player_decoders[i].ip->free_decoder(
+		    player_decoders[i].decoder);
+	player_ndecoders = 0;
+}
+
 enum byte_order
 player_get_byte_order(void)
 {
@@ -268,6 +336,28 @@ player_init(void)
 	    NULL);
 }
 
+/*
+ * Log the time it took from opening the current track until its first sample
+ * was written to the output plug-in.
+ */
+static void
+player_log_latency(void)
+{
+	struct timespec now;
+	long long	ms;
+
+	player_latency_pending = 0;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &now) == -1) {
+		LOG_ERR("clock_gettime");
+		return;
+	}
+
+	ms = (now.tv_sec - player_open_time.tv_sec) * 1000LL +
+	    (now.tv_nsec - player_open_time.tv_nsec) / 1000000;
+	LOG_INFO("first sample written %lld ms after opening track", ms);
+}
+
 /*
  * The player_op_mtx mutex must be locked before calling this function.
  */
@@ -298,6 +388,35 @@ player_open_op(void)
 	return 0;
 }
 
+/*
+ * Open the current track, reusing a decoder kept by player_close_track() if
+ * there is one.
+ *
+ * The player_track_mtx mutex must be locked before calling this function.
+ */
+static int
+player_open_track(void)
+{
+	const struct ip	*ip;
+	void		*decoder;
+	size_t		 i;
+
+	ip = player_track->ip;
+	if (ip->reuse != NULL)
+		for (i = player_ndecoders; i > 0; i--)
+			if (player_decoders[i - 1].ip == ip) {
+				decoder = player_decoders[i - 1].decoder;
+				memmove(player_decoders + i - 1,
+				    player_decoders + i,
+				    (player_ndecoders - i) *
+				    sizeof *player_decoders);
+				player_ndecoders--;
+				return ip->reuse(player_track, decoder);
+			}
+
+	return ip->open(player_track);
+}
+
 void
 player_pause(void)
 {
@@ -411,6 +530,9 @@ player_play_sample_buffer(struct sample_buffer *sb)
 	if (ret == -1)
 		goto error;
 
+	if (player_latency_pending)
+		player_log_latency();
+
 	return 0;
 
 error:
@@ -464,6 +586,8 @@ player_playback_handler(UNUSED void *p)
 			continue;
 		}
 
+		player_prefetch_next_track();
+
 		player_state = PLAYER_STATE_PLAYING;
 		XPTHREAD_MUTEX_UNLOCK(&player_state_mtx);
 
@@ -504,6 +628,41 @@ player_playback_handler(UNUSED void *p)
 	return NULL;
 }
 
+/*
+ * Let the I/O layer read the start of the track that will be played after the
+ * current one.
+ */
+static void
+player_prefetch_next_track(void)
+{
+	char *path;
+
+	if (option_get_boolean("repeat-track") ||
+	    !option_get_boolean("continue"))
+		return;
+
+	if ((path = queue_peek_next_path()) == NULL) {
+		XPTHREAD_MUTEX_LOCK(&player_source_mtx);
+		switch (player_source) {
+		case PLAYER_SOURCE_BROWSER:
+			path = browser_peek_next_path();
+			break;
+		case PLAYER_SOURCE_LIBRARY:
+			path = library_peek_next_path();
+			break;
+		case PLAYER_SOURCE_PLAYLIST:
+			path = playlist_peek_next_path();
+			break;
+		}
+		XPTHREAD_MUTEX_UNLOCK(&player_source_mtx);
+	}
+
+	if (path != NULL) {
+		io_prefetch_file(path);
+		free(path);
+	}
+}
+
 void
 player_print(void)
 {
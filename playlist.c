@@ -23,7 +23,8 @@
 
 #include "siren.h"
 
-static int		 playlist_search_entry(const void *, const char *);
+static int		 playlist_search_entry(const void *,
+			    const struct pattern *);
 
 static pthread_mutex_t	 playlist_menu_mtx = PTHREAD_MUTEX_INITIALIZER;
 static struct format	*playlist_altformat;
@@ -212,6 +213,29 @@ playlist_load(const char *file)
 	playlist_print();
 }
 
+char *
+playlist_peek_next_path(void)
+{
+	struct menu_entry	*e;
+	struct track		*t;
+	char			*path;
+
+	path = NULL;
+	XPTHREAD_MUTEX_LOCK(&playlist_menu_mtx);
+	if ((e = menu_get_active_entry(playlist_menu)) != NULL) {
+		if ((e = menu_get_next_entry(e)) == NULL &&
+		    option_get_boolean("repeat-all"))
+			e = menu_get_first_entry(playlist_menu);
+
+		if (e != NULL) {
+			t = menu_get_entry_data(e);
+			path = xstrdup(t->path);
+		}
+	}
+	XPTHREAD_MUTEX_UNLOCK(&playlist_menu_mtx);
+	return path;
+}
+
 void
 playlist_reactivate_entry(void)
 {
@@ -268,12 +292,12 @@ playlist_scroll_up(enum menu_scroll scroll)
 }
 
 static int
-playlist_search_entry(const void *e, const char *search)
+playlist_search_entry(const void *e, const struct pattern *p)
 {
 	const struct track *t;
 
 	t = e;
-	return track_search(t, search);
+	return track_search(t, p);
 }
 
 void
@@ -339,6 +363,30 @@ playlist_select_prev_entry(void)
 	playlist_print();
 }
 
+/*
+ * Replace the playlist with the specified tracks. The name is shown instead of
+ * the playlist file.
+ */
+void
+playlist_set_tracks(const char *name, struct track **tracks, size_t ntracks)
+{
+	size_t i;
+
+	XPTHREAD_MUTEX_LOCK(&playlist_menu_mtx);
+	menu_remove_all_entries(playlist_menu);
+	free(playlist_file);
+	playlist_file = xstrdup(name);
+	playlist_duration = 0;
+
+	for (i = 0; i < ntracks; i++) {
+		menu_insert_tail(playlist_menu, tracks[i]);
+		playlist_duration += tracks[i]->duration;
+	}
+	XPTHREAD_MUTEX_UNLOCK(&playlist_menu_mtx);
+
+	playlist_print();
+}
+
 /* Recalculate the duration. */
 void
 playlist_update(void)
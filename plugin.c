@@ -16,10 +16,16 @@
 
 #include "config.h"
 
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <ctype.h>
 #include <dlfcn.h>
+#include <fcntl.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
-#include <strings.h>
+#include <unistd.h>
 
 #include "siren.h"
 
@@ -35,14 +41,71 @@ struct plugin_op_entry {
 	SLIST_ENTRY(plugin_op_entry) entries;
 };
 
+/* Maps an extension to the input plug-in with the highest priority for it. */
+struct plugin_ext_entry {
+	char		*ext;
+	const struct ip	*ip;
+	SLIST_ENTRY(plugin_ext_entry) entries;
+};
+
+SLIST_HEAD(plugin_ext_list, plugin_ext_entry);
+
+/* Number of buckets in the extension hash table. Must be a power of two. */
+#define PLUGIN_EXT_NBUCKETS	128
+
+/* Number of bytes read to determine the type of a file. */
+#define PLUGIN_SNIFF_LEN	36
+
+static void plugin_add_ext(const char *, const struct ip *);
+static const struct ip *plugin_find_ext(const char *);
+static uint32_t plugin_hash_ext(const char *);
 static void plugin_load_dir(const char *, const char *,
     int (*)(void *, void *));
+static const char *plugin_sniff_file(const char *);
 
 static SLIST_HEAD(, plugin_ip_entry) plugin_ip_list =
     SLIST_HEAD_INITIALIZER(plugin_ip_list);
 static SLIST_HEAD(, plugin_op_entry) plugin_op_list =
     SLIST_HEAD_INITIALIZER(plugin_op_list);
 
+static struct plugin_ext_list plugin_ext_table[PLUGIN_EXT_NBUCKETS];
+static size_t plugin_ext_maxlen;
+
+/*
+ * Add an extension to the hash table, unless it has been added already for a
+ * plug-in with a higher priority.
+ */
+static void
+plugin_add_ext(const char *ext, const struct ip *ip)
+{
+	struct plugin_ext_list	*list;
+	struct plugin_ext_entry	*e;
+	size_t			 i;
+	char			*lext;
+
+	lext = xstrdup(ext);
+	for (i = 0; lext[i] != '\0'; i++)
+		lext[i] = tolower((unsigned char)lext[i]);
+
+	list = &plugin_ext_table[plugin_hash_ext(lext) &
+	    (PLUGIN_EXT_NBUCKETS - 1)];
+	SLIST_FOREACH(e, list, entries)
+		if (!strcmp(e->ext, lext)) {
+			if (e->ip->priority > ip->priority)
+				e->ip = ip;
+			free(lext);
+			return;
+		}
+
+	e = xmalloc(sizeof *e);
+	e->ext = lext;
+	e->ip = ip;
+	SLIST_INSERT_HEAD(list, e, entries);
+
+	if (i > plugin_ext_maxlen)
+		plugin_ext_maxlen = i;
+}
+
 static int
 plugin_add_ip(void *handle, void *ip)
 {
@@ -98,8 +161,17 @@ plugin_append_promises(char **promises)
 void
 plugin_end(void)
 {
-	struct plugin_ip_entry *ipe;
-	struct plugin_op_entry *ope;
+	struct plugin_ip_entry	*ipe;
+	struct plugin_op_entry	*ope;
+	struct plugin_ext_entry	*e;
+	size_t			 i;
+
+	for (i = 0; i < PLUGIN_EXT_NBUCKETS; i++)
+		while ((e = SLIST_FIRST(&plugin_ext_table[i])) != NULL) {
+			SLIST_REMOVE_HEAD(&plugin_ext_table[i], entries);
+			free(e->ext);
+			free(e);
+		}
 
 	while ((ipe = SLIST_FIRST(&plugin_ip_list)) != NULL) {
 		SLIST_REMOVE_HEAD(&plugin_ip_list, entries);
@@ -115,30 +187,50 @@ plugin_end(void)
 }
 
 /*
- * Find an input plug-in based on the extension of the specified file.
+ * Find an input plug-in for the specified extension.
+ */
+static const struct ip *
+plugin_find_ext(const char *ext)
+{
+	struct plugin_ext_entry	*e;
+	size_t			 i;
+	char			 lext[16];
+
+	for (i = 0; ext[i] != '\0'; i++) {
+		if (i == plugin_ext_maxlen || i == sizeof lext - 1)
+			return NULL;
+		lext[i] = tolower((unsigned char)ext[i]);
+	}
+	lext[i] = '\0';
+
+	SLIST_FOREACH(e, &plugin_ext_table[plugin_hash_ext(lext) &
+	    (PLUGIN_EXT_NBUCKETS - 1)], entries)
+		if (!strcmp(e->ext, lext))
+			return e->ip;
+
+	return NULL;
+}
+
+/*
+ * Find an input plug-in for the specified file. If the detect-file-type
+ * option is enabled, the plug-in is chosen based on the contents of the file
+ * if possible. Otherwise, the extension of the file is used.
  */
 const struct ip *
 plugin_find_ip(const char *file)
 {
-	struct plugin_ip_entry	*ipe;
-	const struct ip		*ip;
-	int			 i;
-	char			*ext;
+	const struct ip	*ip;
+	const char	*ext;
+
+	if (option_get_boolean("detect-file-type") &&
+	    (ext = plugin_sniff_file(file)) != NULL &&
+	    (ip = plugin_find_ext(ext)) != NULL)
+		return ip;
 
 	if ((ext = strrchr(file, '.')) == NULL || *++ext == '\0')
 		return NULL;
 
-	ip = NULL;
-	SLIST_FOREACH(ipe, &plugin_ip_list, entries)
-		for (i = 0; ipe->ip->extensions[i] != NULL; i++)
-			if (!strcasecmp(ext, ipe->ip->extensions[i])) {
-				if (ip == NULL ||
-				    ip->priority > ipe->ip->priority)
-					ip = ipe->ip;
-				break;
-			}
-
-	return ip;
+	return plugin_find_ext(ext);
 }
 
 /*
@@ -167,15 +259,39 @@ plugin_find_op(const char *name)
 	return op;
 }
 
+/* FNV-1a hash. */
+static uint32_t
+plugin_hash_ext(const char *ext)
+{
+	uint32_t hash;
+
+	hash = 2166136261U;
+	for (; *ext != '\0'; ext++) {
+		hash ^= (unsigned char)*ext;
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
 void
 plugin_init(void)
 {
+	struct plugin_ip_entry	*ipe;
+	size_t			 i;
+
+	for (i = 0; i < PLUGIN_EXT_NBUCKETS; i++)
+		SLIST_INIT(&plugin_ext_table[i]);
+
 	plugin_load_dir(PLUGIN_IP_DIR, "ip", plugin_add_ip);
 	if (SLIST_EMPTY(&plugin_ip_list)) {
 		LOG_ERRX("%s: no input plug-ins found", PLUGIN_IP_DIR);
 		msg_errx("No input plug-ins found");
 	}
 
+	SLIST_FOREACH(ipe, &plugin_ip_list, entries)
+		for (i = 0; ipe->ip->extensions[i] != NULL; i++)
+			plugin_add_ext(ipe->ip->extensions[i], ipe->ip);
+
 	plugin_load_dir(PLUGIN_OP_DIR, "op", plugin_add_op);
 	if (SLIST_EMPTY(&plugin_op_list)) {
 		LOG_ERRX("%s: no output plug-ins found", PLUGIN_OP_DIR);
@@ -224,3 +340,77 @@ plugin_load_dir(const char *dir, const char *symbol,
 
 	dir_close(d);
 }
+
+/*
+ * Determine the type of a file by looking for a signature at its start. If
+ * successful, an extension corresponding to the type is returned.
+ */
+static const char *
+plugin_sniff_file(const char *file)
+{
+	struct stat	 sb;
+	off_t		 off;
+	ssize_t		 n;
+	int		 fd;
+	unsigned char	 buf[PLUGIN_SNIFF_LEN];
+
+	/* Do not block on FIFOs. */
+	if ((fd = open(file, O_RDONLY | O_NONBLOCK)) == -1)
+		return NULL;
+
+	if (fstat(fd, &sb) == -1 || !S_ISREG(sb.st_mode)) {
+		close(fd);
+		return NULL;
+	}
+
+	/*
+	 * An ID3v2 tag may precede the audio data of any format, so look for
+	 * the signature after it. The size of the tag is a syncsafe integer
+	 * that excludes the 10-byte header and footer.
+	 */
+	off = 0;
+	while ((n = pread(fd, buf, sizeof buf, off)) >= 10 &&
+	    !memcmp(buf, "ID3", 3)) {
+		if ((buf[6] | buf[7] | buf[8] | buf[9]) & 0x80) {
+			n = -1;
+			break;
+		}
+		off += 10 + ((buf[6] << 21) | (buf[7] << 14) | (buf[8] << 7) |
+		    buf[9]);
+		if (buf[5] & 0x10)
+			off += 10;
+	}
+	close(fd);
+
+	if (n < 4)
+		return NULL;
+	if (!memcmp(buf, "fLaC", 4))
+		return "flac";
+	if (!memcmp(buf, "wvpk", 4))
+		return "wv";
+	if (!memcmp(buf, "OggS", 4)) {
+		/* The first packet starts at offset 28. */
+		if (n >= 36 && !memcmp(buf + 28, "OpusHead", 8))
+			return "opus";
+		if (n >= 35 && !memcmp(buf + 28, "\001vorbis", 7))
+			return "ogg";
+		return NULL;
+	}
+	if (buf[0] == 0xff && (buf[1] & 0xe0) == 0xe0) {
+		/* MPEG audio frame or, if the layer is 0, ADTS frame. */
+		if ((buf[1] & 0xf6) == 0xf0)
+			return "aac";
+		return "mp3";
+	}
+
+	if (n < 12)
+		return NULL;
+	if (!memcmp(buf + 4, "ftyp", 4))
+		return "m4a";
+	if (!memcmp(buf, "RIFF", 4) && !memcmp(buf + 8, "WAVE", 4))
+		return "wav";
+	if (!memcmp(buf, "FORM", 4) && !memcmp(buf + 8, "AIF", 3))
+		return "aiff";
+
+	return NULL;
+}
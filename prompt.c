@@ -54,6 +54,7 @@ static size_t		 prompt_promptlen;
 
 void			 (*prompt_callback)(char *, void *);
 void			*prompt_callback_data;
+static void		 (*prompt_change_callback)(const char *, void *);
 
 static void
 prompt_adjust_scroll_offset(void)
@@ -118,6 +119,20 @@ prompt_get_command(const char *prompt, void (*callback)(char *, void *),
 	    callback, callback_data);
 }
 
+/*
+ * Like prompt_get_search_query(), but the change callback is called whenever
+ * the query is changed.
+ */
+void
+prompt_get_filter_query(const char *prompt,
+    void (*change_callback)(const char *, void *),
+    void (*callback)(char *, void *), void *callback_data)
+{
+	prompt_mode_begin(PROMPT_MODE_LINE, prompt, prompt_search_history,
+	    callback, callback_data);
+	prompt_change_callback = change_callback;
+}
+
 void
 prompt_get_search_query(const char *prompt, void (*callback)(char *, void *),
     void *callback_data)
@@ -158,10 +173,10 @@ static void
 prompt_line_handle_key(int key)
 {
 	size_t		 i, j;
-	int		 done;
+	int		 changed, done;
 	const char	*line;
 
-	done = 0;
+	changed = done = 0;
 	switch (key) {
 	case K_CTRL('A'):
 	case K_HOME:
@@ -180,6 +195,7 @@ prompt_line_handle_key(int key)
 		for (i = prompt_linepos; i < prompt_linelen; i++)
 			prompt_line[i] = prompt_line[i + 1];
 		prompt_linelen--;
+		changed = 1;
 		break;
 	case K_CTRL('E'):
 	case K_END:
@@ -205,16 +221,19 @@ prompt_line_handle_key(int key)
 		for (i = prompt_linepos; i < prompt_linelen; i++)
 			prompt_line[i] = prompt_line[i + 1];
 		prompt_linelen--;
+		changed = 1;
 		break;
 	case K_CTRL('K'):
 		prompt_linelen = prompt_linepos;
 		prompt_line[prompt_linelen] = '\0';
+		changed = 1;
 		break;
 	case K_CTRL('U'):
 		prompt_linelen = 0;
 		prompt_linepos = 0;
 		prompt_scroll_offset = 0;
 		prompt_line[0] = '\0';
+		changed = 1;
 		break;
 	case K_CTRL('W'):
 		i = 0;
@@ -230,6 +249,7 @@ prompt_line_handle_key(int key)
 		prompt_linelen -= i;
 		for (j = prompt_linepos; j <= prompt_linelen; j++)
 			prompt_line[j] = prompt_line[j + i];
+		changed = 1;
 		break;
 	case K_DOWN:
 		if (prompt_history == NULL)
@@ -247,6 +267,7 @@ prompt_line_handle_key(int key)
 			prompt_linesize = prompt_linelen + 1;
 			prompt_linepos = prompt_linelen;
 		}
+		changed = 1;
 		break;
 	case K_ENTER:
 		if (prompt_history != NULL && prompt_linelen > 0)
@@ -268,6 +289,7 @@ prompt_line_handle_key(int key)
 			prompt_linesize = prompt_linelen + 1;
 			prompt_linepos = prompt_linelen;
 		}
+		changed = 1;
 		break;
 	default:
 		/*
@@ -286,13 +308,18 @@ prompt_line_handle_key(int key)
 			prompt_line[i] = prompt_line[i - 1];
 
 		prompt_line[prompt_linepos++] = key;
+		changed = 1;
 		break;
 	}
 
 	if (done)
 		prompt_mode_end();
-	else
+	else {
 		prompt_print();
+		if (changed && prompt_change_callback != NULL)
+			prompt_change_callback(prompt_line,
+			    prompt_callback_data);
+	}
 }
 
 void
@@ -323,6 +350,7 @@ prompt_mode_begin(enum prompt_mode mode, const char *prompt,
 	prompt_promptlen = strlen(prompt_prompt);
 	prompt_callback = callback;
 	prompt_callback_data = callback_data;
+	prompt_change_callback = NULL;
 	prompt_line = xmalloc(prompt_linesize);
 	prompt_linelen = 0;
 	prompt_linepos = 0;
@@ -0,0 +1,1038 @@
+/*
+ * Copyright (c) 2026 Tim van der Molen <tim@kariliq.nl>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * A query consists of terms separated by white space. A track matches a query
+ * if it matches every term. A term has one of the following forms.
+ *
+ *	text		The text occurs in any of the fields searched by
+ *			track_search().
+ *	field:text	The text occurs in the field.
+ *	field:range	The number in the field lies in the range.
+ *
+ * Text may be enclosed in double quotes to include white space. Text is
+ * matched case-insensitively. A range is a number, optionally preceded by <,
+ * <=, =, >= or >, or two numbers separated by "..", either of which may be
+ * omitted. A duration may be given in seconds or as [hours:]minutes:seconds.
+ *
+ * When a query is compiled, its terms are ordered so that the cheapest ones
+ * are evaluated first: numeric comparisons, then text in a single field, then
+ * text in any field.
+ *
+ * To evaluate a query over many tracks, a snapshot of their metadata can be
+ * taken. A snapshot stores each field in a column: numeric fields as arrays of
+ * numbers and text fields as arrays of ids of strings in a dictionary. The
+ * dictionary stores each distinct string once, in a single buffer, and is kept
+ * when the snapshot is taken again, so that only new strings are added.
+ *
+ * A query plan evaluates a query over a snapshot. Numeric terms are simple
+ * comparisons over an array. For text terms, the plan remembers for each
+ * string whether it matches, so that a string shared by many tracks (such as
+ * an artist or an album) is searched only once. Because a snapshot holds
+ * copies of the metadata, it can be evaluated without holding the metadata
+ * lock.
+ */
+
+#include "config.h"
+
+#include <ctype.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "siren.h"
+
+/* Initial number of buckets in the dictionary of a snapshot. */
+#define QUERY_NBUCKETS	1024
+
+/* Results of matching a string in a query plan. */
+#define QUERY_MEMO_UNKNOWN	0
+#define QUERY_MEMO_NO		1
+#define QUERY_MEMO_YES		2
+
+enum query_field {
+	QUERY_FIELD_ALBUM,
+	QUERY_FIELD_ALBUMARTIST,
+	QUERY_FIELD_ANY,
+	QUERY_FIELD_ARTIST,
+	QUERY_FIELD_COMMENT,
+	QUERY_FIELD_DATE,
+	QUERY_FIELD_DISCNUMBER,
+	QUERY_FIELD_DURATION,
+	QUERY_FIELD_FILENAME,
+	QUERY_FIELD_GENRE,
+	QUERY_FIELD_PATH,
+	QUERY_FIELD_TITLE,
+	QUERY_FIELD_TRACKNUMBER
+};
+
+/* Term types, in order of evaluation. */
+enum query_type {
+	QUERY_TYPE_NUMBER,
+	QUERY_TYPE_STRING,
+	QUERY_TYPE_ANY
+};
+
+struct query_term {
+	enum query_field field;
+	enum query_type	 type;
+	char		*text;
+	struct pattern	*pattern;
+	int		 min;
+	int		 max;
+};
+
+struct query {
+	struct query_term *terms;
+	size_t		 nterms;
+};
+
+/* Text columns of a snapshot. */
+enum query_column {
+	QUERY_COLUMN_ALBUM,
+	QUERY_COLUMN_ALBUMARTIST,
+	QUERY_COLUMN_ARTIST,
+	QUERY_COLUMN_COMMENT,
+	QUERY_COLUMN_DATE,
+	QUERY_COLUMN_GENRE,
+	QUERY_COLUMN_TITLE,
+	QUERY_COLUMN_TRACKNUMBER,
+	QUERY_NCOLUMNS
+};
+
+/* Numeric columns of a snapshot. */
+enum query_number {
+	QUERY_NUMBER_DATE,
+	QUERY_NUMBER_DISCNUMBER,
+	QUERY_NUMBER_DURATION,
+	QUERY_NUMBER_TRACKNUMBER,
+	QUERY_NNUMBERS
+};
+
+struct query_string {
+	uint32_t	 next;		/* Next string in bucket, or 0 */
+	uint32_t	 hash;
+	uint32_t	 stamp;		/* Last snapshot that used the string */
+	size_t		 offset;	/* Offset in the buffer */
+};
+
+struct query_snapshot {
+	struct track	**tracks;
+	size_t		  ntracks;
+	size_t		  size;
+	uint32_t	 *columns[QUERY_NCOLUMNS];
+	int		 *numbers[QUERY_NNUMBERS];
+
+	/*
+	 * Dictionary of strings. Id 0 stands for a field that is not set, so
+	 * the first string is not used.
+	 */
+	char		 *buf;
+	size_t		  buflen;
+	size_t		  bufsize;
+	struct query_string *strings;
+	uint32_t	  nstrings;
+	uint32_t	  stringssize;
+	uint32_t	  nused;	/* Strings used by this snapshot */
+	uint32_t	  stamp;
+	uint32_t	 *buckets;
+	uint32_t	  nbuckets;
+};
+
+/* A query plan keeps the column and the matching strings of each term. */
+struct query_plan {
+	const struct query		*query;
+	const struct query_snapshot	*snapshot;
+	int				*columns;
+	unsigned char			**memos;
+};
+
+static int		 query_add_term(struct query *, const char *, char **);
+static int		 query_cmp_terms(const void *, const void *);
+static int		 query_get_number(const struct track *,
+			    enum query_field);
+static const char	*query_get_string(const struct track *,
+			    enum query_field);
+static uint32_t		 query_hash_string(const char *);
+static int		 query_implies(const struct query_term *,
+			    const struct query_term *);
+static int		 query_match_term(const struct query_term *,
+			    const struct track *);
+static char		*query_next_term(const char **);
+static int		 query_parse_number(const char *, enum query_field,
+			    int *);
+static int		 query_parse_range(struct query_term *, const char *,
+			    char **);
+static int		 query_plan_match_any(struct query_plan *, size_t,
+			    uint32_t);
+static int		 query_plan_match_string(struct query_plan *, size_t,
+			    uint32_t);
+static uint32_t		 query_snapshot_add_string(struct query_snapshot *,
+			    const char *);
+static void		 query_snapshot_clear_strings(struct query_snapshot *);
+static void		 query_snapshot_grow(struct query_snapshot *);
+static void		 query_snapshot_resize(struct query_snapshot *,
+			    size_t);
+
+static const struct {
+	const char		*name;
+	enum query_field	 field;
+	enum query_type		 type;
+} query_fields[] = {
+	{ "album",		QUERY_FIELD_ALBUM,	 QUERY_TYPE_STRING },
+	{ "albumartist",	QUERY_FIELD_ALBUMARTIST, QUERY_TYPE_STRING },
+	{ "artist",		QUERY_FIELD_ARTIST,	 QUERY_TYPE_STRING },
+	{ "comment",		QUERY_FIELD_COMMENT,	 QUERY_TYPE_STRING },
+	{ "date",		QUERY_FIELD_DATE,	 QUERY_TYPE_NUMBER },
+	{ "discnumber",		QUERY_FIELD_DISCNUMBER,	 QUERY_TYPE_NUMBER },
+	{ "duration",		QUERY_FIELD_DURATION,	 QUERY_TYPE_NUMBER },
+	{ "filename",		QUERY_FIELD_FILENAME,	 QUERY_TYPE_STRING },
+	{ "genre",		QUERY_FIELD_GENRE,	 QUERY_TYPE_STRING },
+	{ "path",		QUERY_FIELD_PATH,	 QUERY_TYPE_STRING },
+	{ "title",		QUERY_FIELD_TITLE,	 QUERY_TYPE_STRING },
+	{ "tracknumber",	QUERY_FIELD_TRACKNUMBER, QUERY_TYPE_NUMBER }
+};
+
+/* Fields stored in the text and numeric columns of a snapshot. */
+static const enum query_field query_columns[QUERY_NCOLUMNS] = {
+	QUERY_FIELD_ALBUM,
+	QUERY_FIELD_ALBUMARTIST,
+	QUERY_FIELD_ARTIST,
+	QUERY_FIELD_COMMENT,
+	QUERY_FIELD_DATE,
+	QUERY_FIELD_GENRE,
+	QUERY_FIELD_TITLE,
+	QUERY_FIELD_TRACKNUMBER
+};
+
+static const enum query_field query_numbers[QUERY_NNUMBERS] = {
+	QUERY_FIELD_DATE,
+	QUERY_FIELD_DISCNUMBER,
+	QUERY_FIELD_DURATION,
+	QUERY_FIELD_TRACKNUMBER
+};
+
+/* Columns searched by track_search(), apart from the path. */
+static const enum query_column query_any_columns[] = {
+	QUERY_COLUMN_ALBUM,
+	QUERY_COLUMN_ARTIST,
+	QUERY_COLUMN_DATE,
+	QUERY_COLUMN_GENRE,
+	QUERY_COLUMN_TITLE,
+	QUERY_COLUMN_TRACKNUMBER
+};
+
+static int
+query_add_term(struct query *q, const char *s, char **error)
+{
+	struct query_term	 qt;
+	size_t			 i, len;
+	const char		*colon, *quote;
+
+	qt.field = QUERY_FIELD_ANY;
+	qt.type = QUERY_TYPE_ANY;
+	qt.text = NULL;
+	qt.pattern = NULL;
+
+	/*
+	 * A colon inside quotes does not separate a field name. If the text
+	 * before the colon is not a field name (as in "12:30"), the colon is
+	 * part of the text.
+	 */
+	colon = strchr(s, ':');
+	quote = strchr(s, '"');
+	if (colon != NULL && (quote == NULL || colon < quote)) {
+		len = colon - s;
+		for (i = 0; i < nitems(query_fields); i++)
+			if (strlen(query_fields[i].name) == len &&
+			    !strncasecmp(query_fields[i].name, s, len))
+				break;
+		if (i < nitems(query_fields)) {
+			qt.field = query_fields[i].field;
+			qt.type = query_fields[i].type;
+			s = colon + 1;
+		}
+	}
+
+	qt.text = xmalloc(strlen(s) + 1);
+	for (i = 0; *s != '\0'; s++)
+		if (*s != '"')
+			qt.text[i++] = *s;
+	qt.text[i] = '\0';
+
+	/* An empty term matches every track. */
+	if (qt.text[0] == '\0') {
+		free(qt.text);
+		return 0;
+	}
+
+	if (qt.type == QUERY_TYPE_NUMBER) {
+		if (query_parse_range(&qt, qt.text, error) == -1) {
+			free(qt.text);
+			return -1;
+		}
+		free(qt.text);
+		qt.text = NULL;
+	} else
+		qt.pattern = pattern_init(qt.text);
+
+	q->terms = xreallocarray(q->terms, q->nterms + 1, sizeof *q->terms);
+	q->terms[q->nterms++] = qt;
+	return 0;
+}
+
+static int
+query_cmp_terms(const void *p1, const void *p2)
+{
+	const struct query_term *qt1, *qt2;
+
+	qt1 = p1;
+	qt2 = p2;
+	return (qt1->type < qt2->type) ? -1 : (qt1->type > qt2->type);
+}
+
+void
+query_free(struct query *q)
+{
+	size_t i;
+
+	for (i = 0; i < q->nterms; i++) {
+		free(q->terms[i].text);
+		if (q->terms[i].pattern != NULL)
+			pattern_free(q->terms[i].pattern);
+	}
+	free(q->terms);
+	free(q);
+}
+
+/*
+ * Return the number in a numeric field, or -1 if the field is not set or does
+ * not start with a number. Only the leading number is used, so that the year
+ * of a date and the track number of "3/12" can be compared.
+ */
+static int
+query_get_number(const struct track *t, enum query_field field)
+{
+	const char	*s;
+	int		 num;
+
+	switch (field) {
+	case QUERY_FIELD_DATE:
+		s = t->date;
+		break;
+	case QUERY_FIELD_DISCNUMBER:
+		s = t->discnumber;
+		break;
+	case QUERY_FIELD_DURATION:
+		return t->duration > INT_MAX ? INT_MAX : (int)t->duration;
+	case QUERY_FIELD_TRACKNUMBER:
+		s = t->tracknumber;
+		break;
+	default:
+		return -1;
+	}
+
+	if (s == NULL || !isdigit((unsigned char)*s))
+		return -1;
+
+	for (num = 0; isdigit((unsigned char)*s); s++) {
+		if (num > (INT_MAX - (*s - '0')) / 10)
+			return INT_MAX;
+		num = num * 10 + (*s - '0');
+	}
+	return num;
+}
+
+static const char *
+query_get_string(const struct track *t, enum query_field field)
+{
+	switch (field) {
+	case QUERY_FIELD_ALBUM:
+		return t->album;
+	case QUERY_FIELD_ALBUMARTIST:
+		return (t->albumartist != NULL) ? t->albumartist : t->artist;
+	case QUERY_FIELD_ARTIST:
+		return t->artist;
+	case QUERY_FIELD_COMMENT:
+		return t->comment;
+	case QUERY_FIELD_DATE:
+		return t->date;
+	case QUERY_FIELD_FILENAME:
+		return t->filename;
+	case QUERY_FIELD_GENRE:
+		return t->genre;
+	case QUERY_FIELD_PATH:
+		return t->path;
+	case QUERY_FIELD_TITLE:
+		return t->title;
+	case QUERY_FIELD_TRACKNUMBER:
+		return t->tracknumber;
+	default:
+		return NULL;
+	}
+}
+
+static uint32_t
+query_hash_string(const char *s)
+{
+	uint32_t hash;
+
+	hash = 2166136261U;
+	for (; *s != '\0'; s++) {
+		hash ^= (unsigned char)*s;
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+/*
+ * Return 1 if every track that matches qt1 also matches qt2, or 0 if that is
+ * not certain.
+ */
+static int
+query_implies(const struct query_term *qt1, const struct query_term *qt2)
+{
+	if (qt2->type == QUERY_TYPE_ANY) {
+		/* Any text in these fields is searched by track_search(). */
+		switch (qt1->field) {
+		case QUERY_FIELD_ALBUM:
+		case QUERY_FIELD_ANY:
+		case QUERY_FIELD_ARTIST:
+		case QUERY_FIELD_GENRE:
+		case QUERY_FIELD_PATH:
+		case QUERY_FIELD_TITLE:
+			return pattern_match(qt2->pattern, qt1->text);
+		default:
+			return 0;
+		}
+	}
+
+	if (qt1->field != qt2->field)
+		return 0;
+
+	if (qt2->type == QUERY_TYPE_NUMBER)
+		return qt1->min >= qt2->min && qt1->max <= qt2->max;
+
+	return pattern_match(qt2->pattern, qt1->text);
+}
+
+/*
+ * Compile a query. If the query is invalid, NULL is returned and an error
+ * message is stored in *error; the caller must free it.
+ */
+struct query *
+query_init(const char *s, char **error)
+{
+	struct query	*q;
+	char		*term;
+
+	q = xmalloc(sizeof *q);
+	q->terms = NULL;
+	q->nterms = 0;
+
+	while ((term = query_next_term(&s)) != NULL) {
+		if (query_add_term(q, term, error) == -1) {
+			free(term);
+			query_free(q);
+			return NULL;
+		}
+		free(term);
+	}
+
+	if (q->nterms > 1)
+		qsort(q->terms, q->nterms, sizeof *q->terms, query_cmp_terms);
+
+	return q;
+}
+
+/*
+ * Return 1 if the track matches the query, or 0 otherwise. The caller must
+ * hold the metadata lock if the metadata of the track may change.
+ */
+int
+query_match(const struct query *q, const struct track *t)
+{
+	size_t i;
+
+	for (i = 0; i < q->nterms; i++)
+		if (!query_match_term(&q->terms[i], t))
+			return 0;
+	return 1;
+}
+
+static int
+query_match_term(const struct query_term *qt, const struct track *t)
+{
+	const char	*s;
+	int		 num;
+
+	switch (qt->type) {
+	case QUERY_TYPE_NUMBER:
+		num = query_get_number(t, qt->field);
+		return num != -1 && num >= qt->min && num <= qt->max;
+	case QUERY_TYPE_STRING:
+		s = query_get_string(t, qt->field);
+		return s != NULL && pattern_match(qt->pattern, s);
+	default:
+		return track_search(t, qt->pattern) == 0;
+	}
+}
+
+/*
+ * Return the next term of a query, without leading or trailing white space,
+ * or NULL if there is none. A quote that is not closed extends to the end of
+ * the query, so that a query can be evaluated while it is being typed.
+ */
+static char *
+query_next_term(const char **s)
+{
+	const char	*start;
+	int		 quoted;
+
+	while (isspace((unsigned char)**s))
+		(*s)++;
+
+	if (**s == '\0')
+		return NULL;
+
+	start = *s;
+	quoted = 0;
+	for (; **s != '\0'; (*s)++) {
+		if (**s == '"')
+			quoted = !quoted;
+		else if (!quoted && isspace((unsigned char)**s))
+			break;
+	}
+
+	return xstrndup(start, *s - start);
+}
+
+static int
+query_parse_number(const char *s, enum query_field field, int *num)
+{
+	const char	*errstr;
+	char		*buf, *part, *tmp;
+	int		 n;
+
+	if (field != QUERY_FIELD_DURATION || strchr(s, ':') == NULL) {
+		*num = strtonum(s, 0, INT_MAX, &errstr);
+		return (errstr == NULL) ? 0 : -1;
+	}
+
+	/* Parse a duration of the form [hours:]minutes:seconds. */
+	buf = tmp = xstrdup(s);
+	*num = 0;
+	while ((part = strsep(&tmp, ":")) != NULL) {
+		n = strtonum(part, 0, (tmp == NULL) ? 59 : INT_MAX / 60,
+		    &errstr);
+		if (errstr != NULL || *num > (INT_MAX - n) / 60) {
+			free(buf);
+			return -1;
+		}
+		*num = *num * 60 + n;
+	}
+	free(buf);
+	return 0;
+}
+
+static int
+query_parse_range(struct query_term *qt, const char *s, char **error)
+{
+	const char	*dots, *range;
+	char		*tmp;
+	int		 num, ret;
+
+	range = s;
+	qt->min = 0;
+	qt->max = INT_MAX;
+
+	if ((dots = strstr(s, "..")) != NULL) {
+		ret = 0;
+		if (dots > s) {
+			tmp = xstrndup(s, dots - s);
+			ret = query_parse_number(tmp, qt->field, &qt->min);
+			free(tmp);
+		}
+		if (ret == 0 && dots[2] != '\0')
+			ret = query_parse_number(dots + 2, qt->field,
+			    &qt->max);
+	} else if (s[0] == '<' && s[1] == '=')
+		ret = query_parse_number(s + 2, qt->field, &qt->max);
+	else if (s[0] == '<') {
+		ret = query_parse_number(s + 1, qt->field, &num);
+		qt->max = num - 1;
+	} else if (s[0] == '>' && s[1] == '=')
+		ret = query_parse_number(s + 2, qt->field, &qt->min);
+	else if (s[0] == '>') {
+		ret = query_parse_number(s + 1, qt->field, &num);
+		qt->min = (num < INT_MAX) ? num + 1 : INT_MAX;
+	} else {
+		if (s[0] == '=')
+			s++;
+		ret = query_parse_number(s, qt->field, &num);
+		qt->min = qt->max = num;
+	}
+
+	if (ret == -1) {
+		xasprintf(error, "Invalid range: %s", range);
+		return -1;
+	}
+	return 0;
+}
+
+void
+query_plan_free(struct query_plan *p)
+{
+	size_t i;
+
+	for (i = 0; i < p->query->nterms; i++)
+		free(p->memos[i]);
+	free(p->memos);
+	free(p->columns);
+	free(p);
+}
+
+/*
+ * Prepare the evaluation of a query over a snapshot. The query and the
+ * snapshot must not be changed or freed while the plan is used.
+ */
+struct query_plan *
+query_plan_init(const struct query *q, const struct query_snapshot *s)
+{
+	struct query_plan	*p;
+	size_t			 i, j;
+
+	p = xmalloc(sizeof *p);
+	p->query = q;
+	p->snapshot = s;
+	p->columns = NULL;
+	p->memos = NULL;
+	if (q->nterms == 0)
+		return p;
+
+	p->columns = xreallocarray(NULL, q->nterms, sizeof *p->columns);
+	p->memos = xreallocarray(NULL, q->nterms, sizeof *p->memos);
+
+	for (i = 0; i < q->nterms; i++) {
+		p->columns[i] = -1;
+		if (q->terms[i].type == QUERY_TYPE_NUMBER) {
+			for (j = 0; j < QUERY_NNUMBERS; j++)
+				if (query_numbers[j] == q->terms[i].field)
+					p->columns[i] = j;
+			p->memos[i] = NULL;
+		} else {
+			for (j = 0; j < QUERY_NCOLUMNS; j++)
+				if (query_columns[j] == q->terms[i].field)
+					p->columns[i] = j;
+			p->memos[i] = xmalloc(s->nstrings);
+			memset(p->memos[i], QUERY_MEMO_UNKNOWN, s->nstrings);
+		}
+	}
+
+	return p;
+}
+
+/*
+ * Return 1 if the text of a term occurs in any of the fields of a row that are
+ * searched by track_search(), or 0 otherwise.
+ */
+static int
+query_plan_match_any(struct query_plan *p, size_t term, uint32_t row)
+{
+	const struct query_snapshot	*s;
+	size_t				 i;
+
+	s = p->snapshot;
+	for (i = 0; i < nitems(query_any_columns); i++)
+		if (query_plan_match_string(p, term,
+		    s->columns[query_any_columns[i]][row]))
+			return 1;
+
+	/* The path does not change, so it is not part of the snapshot. */
+	return pattern_match(p->query->terms[term].pattern,
+	    s->tracks[row]->path);
+}
+
+/*
+ * Return 1 if the text of a term occurs in a string of the snapshot, or 0
+ * otherwise. The result is remembered.
+ */
+static int
+query_plan_match_string(struct query_plan *p, size_t term, uint32_t id)
+{
+	const char	*s;
+	unsigned char	*memo;
+
+	if (id == 0)
+		return 0;
+
+	memo = p->memos[term];
+	if (memo[id] == QUERY_MEMO_UNKNOWN) {
+		s = p->snapshot->buf + p->snapshot->strings[id].offset;
+		if (pattern_match(p->query->terms[term].pattern, s))
+			memo[id] = QUERY_MEMO_YES;
+		else
+			memo[id] = QUERY_MEMO_NO;
+	}
+	return memo[id] == QUERY_MEMO_YES;
+}
+
+/*
+ * Select the rows of the snapshot that match the query. The rows to consider
+ * are given in rows; the matching ones are stored in match, in the same order,
+ * and their number is returned. The match array must have room for nrows
+ * rows; it may be the same array as rows.
+ */
+size_t
+query_plan_select(struct query_plan *p, const uint32_t *rows, size_t nrows,
+    uint32_t *match)
+{
+	const struct query_snapshot	*s;
+	const struct query_term		*qt;
+	const uint32_t			*col, *in;
+	const int			*num;
+	size_t				 i, k, n, term;
+	uint32_t			 r;
+
+	s = p->snapshot;
+	in = rows;
+	n = nrows;
+
+	if (p->query->nterms == 0) {
+		if (match != rows)
+			memmove(match, rows, nrows * sizeof *match);
+		return nrows;
+	}
+
+	/*
+	 * Each term reduces the rows that match the preceding terms. Rows are
+	 * only removed, so the result can be stored in place.
+	 */
+	for (term = 0; term < p->query->nterms; term++) {
+		qt = &p->query->terms[term];
+		k = 0;
+		switch (qt->type) {
+		case QUERY_TYPE_NUMBER:
+			num = s->numbers[p->columns[term]];
+			for (i = 0; i < n; i++) {
+				r = in[i];
+				match[k] = r;
+				k += num[r] >= qt->min && num[r] <= qt->max;
+			}
+			break;
+		case QUERY_TYPE_STRING:
+			if (p->columns[term] == -1) {
+				/* The path and the file name do not change. */
+				for (i = 0; i < n; i++)
+					if (pattern_match(qt->pattern,
+					    query_get_string(s->tracks[in[i]],
+					    qt->field)))
+						match[k++] = in[i];
+				break;
+			}
+			col = s->columns[p->columns[term]];
+			for (i = 0; i < n; i++)
+				if (query_plan_match_string(p, term,
+				    col[in[i]]))
+					match[k++] = in[i];
+			break;
+		default:
+			for (i = 0; i < n; i++)
+				if (query_plan_match_any(p, term, in[i]))
+					match[k++] = in[i];
+			break;
+		}
+		in = match;
+		n = k;
+	}
+
+	return n;
+}
+
+/*
+ * Return 1 if every track that matches q1 also matches q2, or 0 if that is
+ * not certain. This allows the tracks that match q1 to be selected from those
+ * that match q2.
+ */
+int
+query_refines(const struct query *q1, const struct query *q2)
+{
+	size_t i, j;
+
+	for (i = 0; i < q2->nterms; i++) {
+		for (j = 0; j < q1->nterms; j++)
+			if (query_implies(&q1->terms[j], &q2->terms[i]))
+				break;
+		if (j == q1->nterms)
+			return 0;
+	}
+	return 1;
+}
+
+static uint32_t
+query_snapshot_add_string(struct query_snapshot *s, const char *str)
+{
+	struct query_string	*qs;
+	size_t			 len;
+	uint32_t		 hash, id;
+
+	if (str == NULL)
+		return 0;
+
+	hash = query_hash_string(str);
+	for (id = s->buckets[hash & (s->nbuckets - 1)]; id != 0;
+	    id = s->strings[id].next) {
+		qs = &s->strings[id];
+		if (qs->hash == hash && !strcmp(s->buf + qs->offset, str))
+			break;
+	}
+
+	if (id == 0) {
+		/* Keep the average chain length at most 1. */
+		if (s->nstrings >= s->nbuckets)
+			query_snapshot_grow(s);
+
+		if (s->nstrings == s->stringssize) {
+			s->stringssize *= 2;
+			s->strings = xreallocarray(s->strings, s->stringssize,
+			    sizeof *s->strings);
+		}
+
+		len = strlen(str) + 1;
+		while (s->buflen + len > s->bufsize) {
+			s->bufsize *= 2;
+			s->buf = xrealloc(s->buf, s->bufsize);
+		}
+		memcpy(s->buf + s->buflen, str, len);
+
+		id = s->nstrings++;
+		qs = &s->strings[id];
+		qs->hash = hash;
+		qs->stamp = 0;
+		qs->offset = s->buflen;
+		qs->next = s->buckets[hash & (s->nbuckets - 1)];
+		s->buckets[hash & (s->nbuckets - 1)] = id;
+		s->buflen += len;
+	}
+
+	if (qs->stamp != s->stamp) {
+		qs->stamp = s->stamp;
+		s->nused++;
+	}
+	return id;
+}
+
+/*
+ * Take a snapshot of the metadata of the specified tracks. Row i of the
+ * snapshot is tracks[i]. The caller must hold the metadata lock.
+ */
+void
+query_snapshot_build(struct query_snapshot *s, struct track **tracks,
+    size_t ntracks)
+{
+	const char	*last[QUERY_NCOLUMNS], *str;
+	uint32_t	 lastid[QUERY_NCOLUMNS];
+	size_t		 c, i;
+
+	/*
+	 * Strings that are no longer used are not removed from the
+	 * dictionary. If most strings are unused, start afresh.
+	 */
+	if (s->nstrings > QUERY_NBUCKETS && s->nstrings / 2 > s->nused)
+		query_snapshot_clear_strings(s);
+
+	if (ntracks > s->size)
+		query_snapshot_resize(s, ntracks);
+
+	s->ntracks = ntracks;
+	s->stamp++;
+	s->nused = 0;
+
+	/*
+	 * Metadata strings are interned, and adjacent tracks often share an
+	 * artist or album, so remember the last string of each column.
+	 */
+	for (c = 0; c < QUERY_NCOLUMNS; c++) {
+		last[c] = NULL;
+		lastid[c] = 0;
+	}
+
+	for (i = 0; i < ntracks; i++) {
+		s->tracks[i] = tracks[i];
+		for (c = 0; c < QUERY_NCOLUMNS; c++) {
+			str = query_get_string(tracks[i], query_columns[c]);
+			if (str != last[c]) {
+				last[c] = str;
+				lastid[c] = query_snapshot_add_string(s, str);
+			}
+			s->columns[c][i] = lastid[c];
+		}
+		for (c = 0; c < QUERY_NNUMBERS; c++)
+			s->numbers[c][i] = query_get_number(tracks[i],
+			    query_numbers[c]);
+	}
+}
+
+static void
+query_snapshot_clear_strings(struct query_snapshot *s)
+{
+	uint32_t i;
+
+	for (i = 0; i < s->nbuckets; i++)
+		s->buckets[i] = 0;
+	s->nstrings = 1;
+	s->buflen = 0;
+}
+
+void
+query_snapshot_free(struct query_snapshot *s)
+{
+	size_t c;
+
+	for (c = 0; c < QUERY_NCOLUMNS; c++)
+		free(s->columns[c]);
+	for (c = 0; c < QUERY_NNUMBERS; c++)
+		free(s->numbers[c]);
+	free(s->tracks);
+	free(s->buf);
+	free(s->strings);
+	free(s->buckets);
+	free(s);
+}
+
+size_t
+query_snapshot_get_ntracks(const struct query_snapshot *s)
+{
+	return s->ntracks;
+}
+
+struct track *
+query_snapshot_get_track(const struct query_snapshot *s, uint32_t row)
+{
+	return s->tracks[row];
+}
+
+static void
+query_snapshot_grow(struct query_snapshot *s)
+{
+	uint32_t i, id, next;
+
+	s->nbuckets *= 2;
+	s->buckets = xreallocarray(s->buckets, s->nbuckets,
+	    sizeof *s->buckets);
+	for (i = 0; i < s->nbuckets; i++)
+		s->buckets[i] = 0;
+
+	for (id = 1; id < s->nstrings; id++) {
+		next = s->buckets[s->strings[id].hash & (s->nbuckets - 1)];
+		s->strings[id].next = next;
+		s->buckets[s->strings[id].hash & (s->nbuckets - 1)] = id;
+	}
+}
+
+struct query_snapshot *
+query_snapshot_init(void)
+{
+	struct query_snapshot	*s;
+	size_t			 c;
+
+	s = xmalloc(sizeof *s);
+	s->tracks = NULL;
+	s->ntracks = 0;
+	s->size = 0;
+	for (c = 0; c < QUERY_NCOLUMNS; c++)
+		s->columns[c] = NULL;
+	for (c = 0; c < QUERY_NNUMBERS; c++)
+		s->numbers[c] = NULL;
+
+	s->bufsize = 4096;
+	s->buf = xmalloc(s->bufsize);
+	s->stringssize = QUERY_NBUCKETS;
+	s->strings = xreallocarray(NULL, s->stringssize, sizeof *s->strings);
+	s->nbuckets = QUERY_NBUCKETS;
+	s->buckets = xreallocarray(NULL, s->nbuckets, sizeof *s->buckets);
+	s->stamp = 0;
+	s->nused = 0;
+	query_snapshot_clear_strings(s);
+	return s;
+}
+
+/*
+ * Insert tracks in a snapshot. Track i is inserted before the row that was
+ * rows[i], so that it ends up in row rows[i] + i; rows must be in ascending
+ * order. The caller must hold the metadata lock.
+ */
+void
+query_snapshot_insert(struct query_snapshot *s, struct track **tracks,
+    const uint32_t *rows, size_t ntracks)
+{
+	size_t		 c, i, n, size;
+	uint32_t	 from, row, to;
+
+	if (s->ntracks + ntracks > s->size) {
+		size = s->size * 2;
+		if (size < s->ntracks + ntracks)
+			size = s->ntracks + ntracks;
+		query_snapshot_resize(s, size);
+	}
+
+	/*
+	 * Work from the end, so that every row is moved only once: the rows
+	 * from rows[i] up to the rows moved before move down by i + 1 rows.
+	 */
+	to = s->ntracks;
+	for (i = ntracks; i-- > 0;) {
+		from = rows[i];
+		n = to - from;
+		memmove(s->tracks + from + i + 1, s->tracks + from,
+		    n * sizeof *s->tracks);
+		for (c = 0; c < QUERY_NCOLUMNS; c++)
+			memmove(s->columns[c] + from + i + 1,
+			    s->columns[c] + from, n * sizeof *s->columns[c]);
+		for (c = 0; c < QUERY_NNUMBERS; c++)
+			memmove(s->numbers[c] + from + i + 1,
+			    s->numbers[c] + from, n * sizeof *s->numbers[c]);
+		to = from;
+
+		row = from + i;
+		s->tracks[row] = tracks[i];
+		for (c = 0; c < QUERY_NCOLUMNS; c++)
+			s->columns[c][row] = query_snapshot_add_string(s,
+			    query_get_string(tracks[i], query_columns[c]));
+		for (c = 0; c < QUERY_NNUMBERS; c++)
+			s->numbers[c][row] = query_get_number(tracks[i],
+			    query_numbers[c]);
+	}
+
+	s->ntracks += ntracks;
+}
+
+static void
+query_snapshot_resize(struct query_snapshot *s, size_t size)
+{
+	size_t c;
+
+	s->size = size;
+	s->tracks = xreallocarray(s->tracks, s->size, sizeof *s->tracks);
+	for (c = 0; c < QUERY_NCOLUMNS; c++)
+		s->columns[c] = xreallocarray(s->columns[c], s->size,
+		    sizeof *s->columns[c]);
+	for (c = 0; c < QUERY_NNUMBERS; c++)
+		s->numbers[c] = xreallocarray(s->numbers[c], s->size,
+		    sizeof *s->numbers[c]);
+}
@@ -22,7 +22,8 @@
 
 #include "siren.h"
 
-static int		 queue_search_entry(const void *, const char *);
+static int		 queue_search_entry(const void *,
+			    const struct pattern *);
 
 static pthread_mutex_t	 queue_menu_mtx = PTHREAD_MUTEX_INITIALIZER;
 static struct format	*queue_altformat;
@@ -193,6 +194,25 @@ queue_move_entry_up(void)
 	queue_print();
 }
 
+char *
+queue_peek_next_path(void)
+{
+	struct menu_entry	*me;
+	struct track		*t;
+	char			*path;
+
+	XPTHREAD_MUTEX_LOCK(&queue_menu_mtx);
+	if ((me = menu_get_first_entry(queue_menu)) == NULL)
+		path = NULL;
+	else {
+		t = menu_get_entry_data(me);
+		path = xstrdup(t->path);
+	}
+	XPTHREAD_MUTEX_UNLOCK(&queue_menu_mtx);
+
+	return path;
+}
+
 void
 queue_print(void)
 {
@@ -233,12 +253,12 @@ queue_scroll_up(enum menu_scroll scroll)
 }
 
 static int
-queue_search_entry(const void *e, const char *search)
+queue_search_entry(const void *e, const struct pattern *p)
 {
 	const struct track *t;
 
 	t = e;
-	return track_search(t, search);
+	return track_search(t, p);
 }
 
 void
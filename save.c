@@ -0,0 +1,286 @@
+/*
+ * Copyright (c) 2026 Tim van der Molen <tim@kariliq.nl>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Files are saved by a separate thread, so that the user interface does not
+ * block while they are written. The caller prepares the complete contents of
+ * a file in memory and passes them to save_file().
+ *
+ * A file is written to a temporary file in the same directory, which is then
+ * synchronised to disk and renamed over the original file. If siren or the
+ * system crashes while a file is being saved, the original file is left
+ * intact. If the file is a symbolic link, the file it points to is replaced,
+ * so that the link is kept.
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "siren.h"
+
+struct save_job {
+	char			*path;
+	void			*data;
+	size_t			 size;
+	const char		*msg;
+	const char		*errmsg;
+	SIMPLEQ_ENTRY(save_job)	 entries;
+};
+
+SIMPLEQ_HEAD(save_queue, save_job);
+
+static void		 save_free_job(struct save_job *);
+static void		*save_handler(void *);
+static void		 save_sync_dir(const char *);
+static int		 save_write(const struct save_job *);
+static int		 save_write_data(int, const char *, const void *, size_t);
+
+static pthread_t	 save_thd;
+static pthread_mutex_t	 save_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	 save_cond = PTHREAD_COND_INITIALIZER;
+static struct save_queue save_queue = SIMPLEQ_HEAD_INITIALIZER(save_queue);
+static int		 save_quit;
+static mode_t		 save_umask;
+
+/*
+ * Wait until all files have been saved.
+ */
+void
+save_end(void)
+{
+	XPTHREAD_MUTEX_LOCK(&save_mtx);
+	save_quit = 1;
+	XPTHREAD_COND_BROADCAST(&save_cond);
+	XPTHREAD_MUTEX_UNLOCK(&save_mtx);
+
+	XPTHREAD_JOIN(save_thd, NULL);
+}
+
+/*
+ * Save a file. The path and data must have been allocated with malloc(); they
+ * are freed once the file has been saved. Once the file has been saved, msg is
+ * shown unless it is NULL. If saving the file fails, errmsg is shown.
+ *
+ * If an earlier save of the same file has not started yet, it is replaced.
+ */
+void
+save_file(char *path, void *data, size_t size, const char *msg,
+    const char *errmsg)
+{
+	struct save_job *job;
+
+	XPTHREAD_MUTEX_LOCK(&save_mtx);
+	SIMPLEQ_FOREACH(job, &save_queue, entries)
+		if (!strcmp(job->path, path))
+			break;
+
+	if (job != NULL) {
+		free(job->data);
+		free(path);
+	} else {
+		job = xmalloc(sizeof *job);
+		job->path = path;
+		job->msg = NULL;
+		SIMPLEQ_INSERT_TAIL(&save_queue, job, entries);
+	}
+
+	/* The replaced save still has to be reported. */
+	if (msg != NULL)
+		job->msg = msg;
+	job->data = data;
+	job->size = size;
+	job->errmsg = errmsg;
+
+	XPTHREAD_COND_BROADCAST(&save_cond);
+	XPTHREAD_MUTEX_UNLOCK(&save_mtx);
+}
+
+static void
+save_free_job(struct save_job *job)
+{
+	free(job->path);
+	free(job->data);
+	free(job);
+}
+
+static void *
+save_handler(UNUSED void *p)
+{
+	struct save_job	*job;
+	sigset_t	 ss;
+
+	/* Let the main thread handle all signals. */
+	sigfillset(&ss);
+	pthread_sigmask(SIG_BLOCK, &ss, NULL);
+
+	XPTHREAD_MUTEX_LOCK(&save_mtx);
+	for (;;) {
+		if ((job = SIMPLEQ_FIRST(&save_queue)) == NULL) {
+			if (save_quit)
+				break;
+			XPTHREAD_COND_WAIT(&save_cond, &save_mtx);
+			continue;
+		}
+
+		SIMPLEQ_REMOVE_HEAD(&save_queue, entries);
+		XPTHREAD_MUTEX_UNLOCK(&save_mtx);
+
+		if (save_write(job) == -1)
+			msg_err("%s", job->errmsg);
+		else if (job->msg != NULL)
+			msg_info("%s", job->msg);
+		save_free_job(job);
+
+		XPTHREAD_MUTEX_LOCK(&save_mtx);
+	}
+	XPTHREAD_MUTEX_UNLOCK(&save_mtx);
+
+	return NULL;
+}
+
+void
+save_init(void)
+{
+	/* The umask cannot be read without changing it. */
+	save_umask = umask(0);
+	umask(save_umask);
+
+	XPTHREAD_CREATE(&save_thd, NULL, save_handler, NULL);
+}
+
+/*
+ * Synchronise the directory that contains the specified file, so that a
+ * rename of the file is stored on disk.
+ */
+static void
+save_sync_dir(const char *path)
+{
+	int	 fd;
+	char	*dir, *sep;
+
+	dir = xstrdup(path);
+	if ((sep = strrchr(dir, '/')) == NULL) {
+		free(dir);
+		return;
+	}
+	if (sep == dir)
+		sep[1] = '\0';
+	else
+		*sep = '\0';
+
+	if ((fd = open(dir, O_RDONLY)) == -1)
+		LOG_ERR("open: %s", dir);
+	else {
+		if (fsync(fd) == -1 && errno != EINVAL)
+			LOG_ERR("fsync: %s", dir);
+		close(fd);
+	}
+
+	free(dir);
+}
+
+static int
+save_write(const struct save_job *job)
+{
+	struct stat	 sb;
+	mode_t		 mode;
+	int		 fd, ret;
+	char		*path, *tmp;
+
+	/* A file that does not exist yet is created. */
+	if ((path = realpath(job->path, NULL)) == NULL) {
+		if (errno != ENOENT) {
+			LOG_ERR("realpath: %s", job->path);
+			return -1;
+		}
+		path = xstrdup(job->path);
+	}
+
+	xasprintf(&tmp, "%s.XXXXXXXXXX", path);
+
+	if ((fd = mkstemp(tmp)) == -1) {
+		LOG_ERR("mkstemp: %s", tmp);
+		free(tmp);
+		free(path);
+		return -1;
+	}
+
+	/*
+	 * mkstemp() creates the file with mode 0600. Give it the mode of the
+	 * original file instead, or the mode a new file would get.
+	 */
+	if (stat(path, &sb) == 0)
+		mode = sb.st_mode & 07777;
+	else
+		mode = 0666 & ~save_umask;
+	if (fchmod(fd, mode) == -1)
+		LOG_ERR("fchmod: %s", tmp);
+
+	ret = save_write_data(fd, tmp, job->data, job->size);
+
+	if (ret == 0 && fsync(fd) == -1) {
+		LOG_ERR("fsync: %s", tmp);
+		ret = -1;
+	}
+
+	if (close(fd) == -1) {
+		LOG_ERR("close: %s", tmp);
+		ret = -1;
+	}
+
+	if (ret == 0 && rename(tmp, path) == -1) {
+		LOG_ERR("rename: %s", path);
+		ret = -1;
+	}
+
+	if (ret == 0)
+		save_sync_dir(path);
+	else
+		unlink(tmp);
+
+	free(tmp);
+	free(path);
+	return ret;
+}
+
+static int
+save_write_data(int fd, const char *path, const void *buf, size_t len)
+{
+	const char	*p;
+	ssize_t		 n;
+
+	for (p = buf; len > 0; p += n, len -= n)
+		if ((n = write(fd, p, len)) == -1) {
+			if (errno == EINTR) {
+				n = 0;
+				continue;
+			}
+			LOG_ERR("write: %s", path);
+			return -1;
+		}
+
+	return 0;
+}
@@ -0,0 +1,415 @@
+/*
+ * Copyright (c) 2026 Tim van der Molen <tim@kariliq.nl>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * A search index maps each trigram (sequence of three bytes) that occurs in
+ * the searchable fields of a set of tracks to the tracks in which it occurs.
+ * Trigrams are case-folded and do not span fields. Only ASCII letters are
+ * folded, so the trigrams of a query that contain other bytes are not used.
+ *
+ * A track that matches a query (see track_search()) contains every trigram of
+ * the query, so the tracks of any single trigram of the query include all
+ * matching tracks. The index returns the tracks of the rarest trigram; the
+ * caller still has to check each of them.
+ *
+ * Trigrams that occur in many tracks (such as those of a common path prefix)
+ * are of little use and would take up most of the memory of the index. When
+ * the index is built, their tracks are not stored. A query that consists only
+ * of such trigrams cannot be answered by the index.
+ */
+
+#include "config.h"
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "siren.h"
+
+/* Initial number of buckets in the hash table. */
+#define SEARCH_NBUCKETS 1024
+
+/* A trigram is common if it occurs in at least one in this many tracks. */
+#define SEARCH_DENSITY 32
+
+struct search_trigram {
+	struct search_trigram	*next;
+	uint32_t		 trigram;
+	int			 common;
+	size_t			 stamp;		/* Last track seen */
+	struct track		**tracks;
+	size_t			 ntracks;
+	size_t			 size;
+};
+
+struct search {
+	struct search_trigram	**buckets;
+	size_t			 nbuckets;
+	size_t			 ntrigrams;
+	size_t			 ntracks;
+	size_t			 stamp;
+
+	/* Trigrams of the track being added or removed. */
+	uint32_t		*trigrams;
+	size_t			 trigramssize;
+};
+
+static void		 search_add_string(uint32_t **, size_t *, size_t *,
+			    const char *);
+static struct search_trigram *search_add_trigram(struct search *, uint32_t);
+static size_t		 search_get_trigrams(struct search *,
+			    const struct track *);
+static void		 search_grow(struct search *);
+static uint32_t		 search_hash(uint32_t);
+static struct search_trigram *search_lookup_trigram(const struct search *,
+			    uint32_t);
+
+/*
+ * Append the trigrams of a string to the trigrams array.
+ */
+static void
+search_add_string(uint32_t **trigrams, size_t *ntrigrams, size_t *size,
+    const char *str)
+{
+	uint32_t trigram;
+
+	if (str == NULL || str[0] == '\0' || str[1] == '\0')
+		return;
+
+	trigram = ((uint32_t)tolower((unsigned char)str[0]) << 8) |
+	    (uint32_t)tolower((unsigned char)str[1]);
+	for (str += 2; *str != '\0'; str++) {
+		trigram = ((trigram << 8) & 0xffffff) |
+		    (uint32_t)tolower((unsigned char)*str);
+
+		if (*ntrigrams == *size) {
+			*size = (*size == 0) ? 64 : *size * 2;
+			*trigrams = xreallocarray(*trigrams, *size,
+			    sizeof **trigrams);
+		}
+		(*trigrams)[(*ntrigrams)++] = trigram;
+	}
+}
+
+/*
+ * Add a track to the index. A track that is added more than once must be
+ * removed as many times.
+ */
+void
+search_add_track(struct search *s, struct track *t)
+{
+	struct search_trigram	*st;
+	size_t			 i, ntrigrams;
+
+	ntrigrams = search_get_trigrams(s, t);
+	for (i = 0; i < ntrigrams; i++) {
+		st = search_add_trigram(s, s->trigrams[i]);
+		if (st->common || st->stamp == s->stamp)
+			continue;
+		st->stamp = s->stamp;
+
+		if (st->ntracks == st->size) {
+			st->size = (st->size == 0) ? 4 : st->size * 2;
+			st->tracks = xreallocarray(st->tracks, st->size,
+			    sizeof *st->tracks);
+		}
+		st->tracks[st->ntracks++] = t;
+	}
+
+	s->ntracks++;
+}
+
+/*
+ * Look up a trigram and add it if it is not in the index yet.
+ */
+static struct search_trigram *
+search_add_trigram(struct search *s, uint32_t trigram)
+{
+	struct search_trigram	*st;
+	size_t			 i;
+
+	if ((st = search_lookup_trigram(s, trigram)) != NULL)
+		return st;
+
+	/* Keep the average chain length at most 1. */
+	if (s->ntrigrams >= s->nbuckets)
+		search_grow(s);
+
+	st = xmalloc(sizeof *st);
+	st->trigram = trigram;
+	st->common = 0;
+	st->stamp = 0;
+	st->tracks = NULL;
+	st->ntracks = 0;
+	st->size = 0;
+
+	i = search_hash(trigram) & (s->nbuckets - 1);
+	st->next = s->buckets[i];
+	s->buckets[i] = st;
+	s->ntrigrams++;
+	return st;
+}
+
+/*
+ * Build the index for the specified tracks, replacing its previous contents.
+ * This is faster than adding the tracks one by one and the index takes up
+ * less memory.
+ */
+void
+search_build(struct search *s, struct track **tracks, size_t ntracks)
+{
+	struct search_trigram	*st;
+	size_t			 i, j, ntrigrams;
+
+	search_clear(s);
+
+	/* Count the tracks of each trigram. */
+	for (i = 0; i < ntracks; i++) {
+		ntrigrams = search_get_trigrams(s, tracks[i]);
+		for (j = 0; j < ntrigrams; j++) {
+			st = search_add_trigram(s, s->trigrams[j]);
+			if (st->stamp != s->stamp) {
+				st->stamp = s->stamp;
+				st->size++;
+			}
+		}
+	}
+
+	for (i = 0; i < s->nbuckets; i++)
+		for (st = s->buckets[i]; st != NULL; st = st->next) {
+			if (st->size * SEARCH_DENSITY >= ntracks) {
+				st->common = 1;
+				st->size = 0;
+			} else
+				st->tracks = xreallocarray(NULL, st->size,
+				    sizeof *st->tracks);
+		}
+
+	for (i = 0; i < ntracks; i++) {
+		ntrigrams = search_get_trigrams(s, tracks[i]);
+		for (j = 0; j < ntrigrams; j++) {
+			st = search_lookup_trigram(s, s->trigrams[j]);
+			if (st->common || st->stamp == s->stamp)
+				continue;
+			st->stamp = s->stamp;
+			st->tracks[st->ntracks++] = tracks[i];
+		}
+	}
+
+	s->ntracks = ntracks;
+}
+
+/*
+ * Remove all tracks from the index.
+ */
+void
+search_clear(struct search *s)
+{
+	struct search_trigram	*st, *next;
+	size_t			 i;
+
+	for (i = 0; i < s->nbuckets; i++) {
+		for (st = s->buckets[i]; st != NULL; st = next) {
+			next = st->next;
+			free(st->tracks);
+			free(st);
+		}
+		s->buckets[i] = NULL;
+	}
+	s->ntrigrams = 0;
+	s->ntracks = 0;
+}
+
+void
+search_free(struct search *s)
+{
+	search_clear(s);
+	free(s->buckets);
+	free(s->trigrams);
+	free(s);
+}
+
+/*
+ * Get the trigrams of the searchable fields of a track. These are the same
+ * fields that track_search() searches. A trigram may occur more than once; to
+ * help callers skip duplicates, a new stamp is started for each track.
+ */
+static size_t
+search_get_trigrams(struct search *s, const struct track *t)
+{
+	size_t ntrigrams;
+
+	ntrigrams = 0;
+	search_add_string(&s->trigrams, &ntrigrams, &s->trigramssize,
+	    t->album);
+	search_add_string(&s->trigrams, &ntrigrams, &s->trigramssize,
+	    t->artist);
+	search_add_string(&s->trigrams, &ntrigrams, &s->trigramssize,
+	    t->date);
+	search_add_string(&s->trigrams, &ntrigrams, &s->trigramssize,
+	    t->genre);
+	search_add_string(&s->trigrams, &ntrigrams, &s->trigramssize,
+	    t->title);
+	search_add_string(&s->trigrams, &ntrigrams, &s->trigramssize,
+	    t->tracknumber);
+	search_add_string(&s->trigrams, &ntrigrams, &s->trigramssize,
+	    t->path);
+
+	s->stamp++;
+	return ntrigrams;
+}
+
+/*
+ * Double the number of buckets in the hash table.
+ */
+static void
+search_grow(struct search *s)
+{
+	struct search_trigram	**buckets, *st, *next;
+	size_t			  i, j, nbuckets;
+
+	nbuckets = s->nbuckets * 2;
+	buckets = xreallocarray(NULL, nbuckets, sizeof *buckets);
+	for (i = 0; i < nbuckets; i++)
+		buckets[i] = NULL;
+
+	for (i = 0; i < s->nbuckets; i++)
+		for (st = s->buckets[i]; st != NULL; st = next) {
+			next = st->next;
+			j = search_hash(st->trigram) & (nbuckets - 1);
+			st->next = buckets[j];
+			buckets[j] = st;
+		}
+
+	free(s->buckets);
+	s->buckets = buckets;
+	s->nbuckets = nbuckets;
+}
+
+static uint32_t
+search_hash(uint32_t trigram)
+{
+	uint32_t hash;
+
+	hash = trigram * 2654435769U;
+	return hash ^ (hash >> 16);
+}
+
+struct search *
+search_init(void)
+{
+	struct search	*s;
+	size_t		 i;
+
+	s = xmalloc(sizeof *s);
+	s->nbuckets = SEARCH_NBUCKETS;
+	s->buckets = xreallocarray(NULL, s->nbuckets, sizeof *s->buckets);
+	for (i = 0; i < s->nbuckets; i++)
+		s->buckets[i] = NULL;
+	s->ntrigrams = 0;
+	s->ntracks = 0;
+	s->stamp = 0;
+	s->trigrams = NULL;
+	s->trigramssize = 0;
+	return s;
+}
+
+/*
+ * Look up the tracks that may match a query. Return -1 if the index cannot
+ * answer the query because the query is too short or its trigrams are too
+ * common; searching all tracks is then likely to be fast anyway. Otherwise, set
+ * *tracks to an array of *ntracks candidates. Every track that matches the
+ * query is among the candidates, but not every candidate matches. The array
+ * remains valid until the index is changed.
+ */
+int
+search_lookup(const struct search *s, const char *query,
+    struct track ***tracks, size_t *ntracks)
+{
+	struct search_trigram	*st, *min;
+	size_t			 i, ntrigrams, size;
+	uint32_t		*trigrams;
+
+	trigrams = NULL;
+	ntrigrams = 0;
+	size = 0;
+	search_add_string(&trigrams, &ntrigrams, &size, query);
+
+	min = NULL;
+	for (i = 0; i < ntrigrams; i++) {
+		/* A track may contain a different case of a UTF-8 letter. */
+		if (trigrams[i] & 0x808080)
+			continue;
+		if ((st = search_lookup_trigram(s, trigrams[i])) == NULL) {
+			/* No track contains this trigram. */
+			free(trigrams);
+			*tracks = NULL;
+			*ntracks = 0;
+			return 0;
+		}
+		if (!st->common && (min == NULL || st->ntracks < min->ntracks))
+			min = st;
+	}
+	free(trigrams);
+
+	if (min == NULL || min->ntracks * SEARCH_DENSITY >= s->ntracks)
+		return -1;
+
+	*tracks = min->tracks;
+	*ntracks = min->ntracks;
+	return 0;
+}
+
+static struct search_trigram *
+search_lookup_trigram(const struct search *s, uint32_t trigram)
+{
+	struct search_trigram *st;
+
+	st = s->buckets[search_hash(trigram) & (s->nbuckets - 1)];
+	for (; st != NULL; st = st->next)
+		if (st->trigram == trigram)
+			break;
+	return st;
+}
+
+/*
+ * Remove a track from the index. The metadata of the track must not have
+ * changed since the track was added.
+ */
+void
+search_remove_track(struct search *s, const struct track *t)
+{
+	struct search_trigram	*st;
+	size_t			 i, j, ntrigrams;
+
+	ntrigrams = search_get_trigrams(s, t);
+	for (i = 0; i < ntrigrams; i++) {
+		st = search_lookup_trigram(s, s->trigrams[i]);
+		if (st == NULL || st->common || st->stamp == s->stamp)
+			continue;
+		st->stamp = s->stamp;
+
+		/* The order of the tracks does not matter. */
+		for (j = 0; j < st->ntracks; j++)
+			if (st->tracks[j] == t) {
+				st->tracks[j] = st->tracks[--st->ntracks];
+				break;
+			}
+	}
+
+	s->ntracks--;
+}
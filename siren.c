@@ -71,12 +71,14 @@ main(int argc, char **argv)
 	bind_init();
 	conf_init(confdir);
 	screen_init();
+	save_init();
 	plugin_init();
 	track_init();
 	library_init();
 	playlist_init();
 	queue_init();
 	browser_init();
+	io_init();
 	player_init();
 	prompt_init();
 
@@ -97,12 +99,14 @@ main(int argc, char **argv)
 
 	prompt_end();
 	player_end();
+	io_end();
 	browser_end();
 	queue_end();
 	playlist_end();
 	library_end();
 	track_end();
 	plugin_end();
+	save_end();
 	screen_end();
 	conf_end();
 	bind_end();
@@ -14,6 +14,8 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <sys/types.h>
+
 #include <errno.h>
 #include <pthread.h>
 #include <stdarg.h>
@@ -54,6 +56,9 @@
 /* Size of the buffer to be passed to strerror_r(). The value is arbitrary. */
 #define STRERROR_BUFSIZE	256
 
+/* Flags for io_open(). */
+#define IO_PREFETCH		0x1
+
 /* Character attributes. */
 #define ATTRIB_NORMAL		0x0
 #define ATTRIB_BLINK		0x1
@@ -187,11 +192,6 @@ enum byte_order {
 	BYTE_ORDER_LITTLE
 };
 
-enum cache_mode {
-	CACHE_MODE_READ,
-	CACHE_MODE_WRITE
-};
-
 enum colour {
 	COLOUR_BLACK	= -1,
 	COLOUR_BLUE	= -2,
@@ -247,10 +247,22 @@ struct command;
 
 struct history;
 
+struct io;
+
 struct menu;
 
 struct menu_entry;
 
+struct pattern;
+
+struct query;
+
+struct query_plan;
+
+struct query_snapshot;
+
+struct search;
+
 struct dir;
 
 struct dir_entry {
@@ -299,6 +311,29 @@ struct sample_format {
 	unsigned int	 rate;
 };
 
+/*
+ * Stream information saved by an input plug-in when it opens a track, so that
+ * it can skip probing the stream the next time it opens the same track.
+ */
+struct track_probe {
+	struct sample_format format;
+	int		 stream;
+	int64_t		 offset;
+	size_t		 datasize;
+	void		*data;
+};
+
+/*
+ * File status of a track at the time its metadata was read, used to detect
+ * whether the file has changed since.
+ */
+struct track_stamp {
+	int64_t		 mtime;
+	int64_t		 size;
+	uint64_t	 ino;
+	uint64_t	 dev;
+};
+
 struct track {
 	char		*path;
 
@@ -320,14 +355,22 @@ struct track {
 	unsigned int	 duration;
 
 	struct sample_format format;
+	struct track_probe *probe;
+	struct track_stamp stamp;
 };
 
-/* Input plug-in. */
+/*
+ * Input plug-in. The free_decoder, reset and reuse functions are optional.
+ * The reset function closes a track like the close function does, but
+ * returns its decoder so that it can be passed to the reuse function to open
+ * another track. If the reuse function fails, it frees the decoder.
+ */
 struct ip {
 	const char	 *name;
 	const int	  priority;
 	const char	**extensions;
 	void		  (*close)(struct track *) NONNULL();
+	void		  (*free_decoder)(void *) NONNULL();
 	void		  (*get_metadata)(struct track *) NONNULL();
 	int		  (*get_position)(struct track *, unsigned int *)
 			    NONNULL();
@@ -335,6 +378,8 @@ struct ip {
 	int		  (*open)(struct track *) NONNULL();
 	int		  (*read)(struct track *, struct sample_buffer *)
 			    NONNULL();
+	void		 *(*reset)(struct track *) NONNULL();
+	int		  (*reuse)(struct track *, void *) NONNULL();
 	void		  (*seek)(struct track *, unsigned int) NONNULL();
 };
 
@@ -378,6 +423,7 @@ const char	*browser_get_dir(void);
 struct track	*browser_get_next_track(void);
 struct track	*browser_get_prev_track(void);
 void		 browser_init(void);
+char		*browser_peek_next_path(void);
 void		 browser_print(void);
 void		 browser_reactivate_entry(void);
 void		 browser_refresh_dir(void);
@@ -391,11 +437,22 @@ void		 browser_select_last_entry(void);
 void		 browser_select_next_entry(void);
 void		 browser_select_prev_entry(void);
 
-void		 cache_close(void);
-int		 cache_open(enum cache_mode);
-int		 cache_read_entry(struct track *) NONNULL();
+void		 cache_close(int);
+int		 cache_contains(const char *);
+void		 cache_copy_entry(size_t);
+void		 cache_end(void);
+int		 cache_find_entry(const char *, size_t *) NONNULL();
+int64_t		 cache_get_added(size_t);
+int64_t		 cache_get_atime(size_t);
+size_t		 cache_get_nentries(void);
+char		*cache_get_path(size_t);
+void		 cache_init(void);
+void		 cache_open(void);
+int		 cache_read_entry(size_t, struct track *) NONNULL();
+int		 cache_read_probe(size_t, struct track_probe *) NONNULL();
 void		 cache_update(void);
-void		 cache_write_entry(const struct track *) NONNULL();
+void		 cache_write_entry(const struct track *, int64_t, int64_t)
+		    NONNULL();
 
 void		 command_execute(struct command *, void *) NONNULL(1);
 void		 command_free_data(struct command *, void *) NONNULL(1);
@@ -434,16 +491,31 @@ void		 input_handle_key(void);
 void		 input_init(void);
 void		 input_set_mode(enum input_mode);
 
+void		 io_close(struct io *) NONNULL();
+void		 io_end(void);
+int		 io_eof(const struct io *) NONNULL();
+int64_t		 io_get_size(const struct io *) NONNULL();
+void		 io_init(void);
+struct io	*io_open(const char *, int) NONNULL();
+void		 io_prefetch_file(const char *) NONNULL();
+ssize_t		 io_read(struct io *, void *, size_t) NONNULL();
+int		 io_seek(struct io *, int64_t, int) NONNULL();
+int64_t		 io_tell(const struct io *) NONNULL();
+
 void		 library_activate_entry(void);
 void		 library_add_dir(const char *) NONNULL();
 void		 library_add_track(struct track *) NONNULL();
+void		 library_autosave(void);
+void		 library_change_sort(void);
 void		 library_copy_entry(enum view_id);
 void		 library_delete_all_entries(void);
 void		 library_delete_entry(void);
 void		 library_end(void);
 struct track	*library_get_next_track(void);
 struct track	*library_get_prev_track(void);
+struct track	**library_get_tracks(const struct query *, size_t *) NONNULL();
 void		 library_init(void);
+char		*library_peek_next_path(void);
 void		 library_print(void);
 void		 library_reactivate_entry(void);
 void		 library_read_file(void);
@@ -456,8 +528,9 @@ void		 library_select_first_entry(void);
 void		 library_select_last_entry(void);
 void		 library_select_next_entry(void);
 void		 library_select_prev_entry(void);
+int		 library_set_filter(const char *, char **) NONNULL(2);
 void		 library_update(void);
-int		 library_write_file(void);
+void		 library_write_file(int);
 
 void		 log_end(void);
 void		 log_err(const char *, const char *, ...) PRINTFLIKE2;
@@ -471,10 +544,13 @@ void		 log_init(int);
 void		 log_verrx(const char *, const char *, va_list) VPRINTFLIKE2;
 
 void		 menu_activate_entry(struct menu *, struct menu_entry *)
-		    NONNULL();
+		    NONNULL(1);
 void		 menu_free(struct menu *) NONNULL();
 struct menu_entry *menu_get_active_entry(const struct menu *) NONNULL();
+struct menu_entry *menu_get_entry(const struct menu *, unsigned int)
+		    NONNULL();
 void		*menu_get_entry_data(const struct menu_entry *) NONNULL();
+unsigned int	 menu_get_entry_index(const struct menu_entry *) NONNULL();
 struct menu_entry *menu_get_first_entry(const struct menu *) NONNULL();
 struct menu_entry *menu_get_last_entry(const struct menu *) NONNULL();
 unsigned int	 menu_get_nentries(const struct menu *) NONNULL();
@@ -484,7 +560,7 @@ struct menu_entry *menu_get_selected_entry(const struct menu *) NONNULL();
 void		*menu_get_selected_entry_data(const struct menu *) NONNULL();
 struct menu	*menu_init(void (*)(void *),
 		    void (*)(const void *, char *, size_t),
-		    int (*)(const void *, const char *));
+		    int (*)(const void *, const struct pattern *));
 void		 menu_insert_after(struct menu *, struct menu_entry *, void *)
 		    NONNULL();
 void		 menu_insert_before(struct menu *, struct menu_entry *,
@@ -513,6 +589,7 @@ void		 menu_select_first_entry(struct menu *) NONNULL();
 void		 menu_select_last_entry(struct menu *) NONNULL();
 void		 menu_select_next_entry(struct menu *) NONNULL();
 void		 menu_select_prev_entry(struct menu *) NONNULL();
+void		 menu_set_entry_data(struct menu_entry *, void *) NONNULL();
 
 void		 msg_clear(void);
 void		 msg_err(const char *, ...) PRINTFLIKE1;
@@ -522,9 +599,12 @@ void		 msg_info(const char *, ...) PRINTFLIKE1;
 void		 option_add_number(const char *, int, int, int, void (*)(void))
 		    NONNULL(1);
 void		 option_add_string(const char *, const char *,
+		    int (*)(const char *, char **),
 		    void (*)(void)) NONNULL(1, 2);
 char		*option_attrib_to_string(int);
 const char	*option_boolean_to_string(int);
+int		 option_check_string(const char *, const char *, char **)
+		    NONNULL();
 char		*option_colour_to_string(int);
 void		 option_end(void);
 const char	*option_format_to_string(const struct format *) NONNULL();
@@ -556,6 +636,10 @@ char		*path_get_dirname(const char *);
 char		*path_get_home_dir(const char *);
 char		*path_normalise(const char *) NONNULL();
 
+void		 pattern_free(struct pattern *) NONNULL();
+struct pattern	*pattern_init(const char *) NONNULL();
+int		 pattern_match(const struct pattern *, const char *) NONNULL();
+
 void		 player_change_op(void);
 void		 player_end(void);
 void		 player_forcibly_close_op(void);
@@ -580,6 +664,7 @@ struct track	*playlist_get_next_track(void);
 struct track	*playlist_get_prev_track(void);
 void		 playlist_init(void);
 void		 playlist_load(const char *) NONNULL();
+char		*playlist_peek_next_path(void);
 void		 playlist_print(void);
 void		 playlist_reactivate_entry(void);
 void		 playlist_scroll_down(enum menu_scroll);
@@ -591,6 +676,8 @@ void		 playlist_select_first_entry(void);
 void		 playlist_select_last_entry(void);
 void		 playlist_select_next_entry(void);
 void		 playlist_select_prev_entry(void);
+void		 playlist_set_tracks(const char *, struct track **, size_t)
+		    NONNULL(1);
 void		 playlist_update(void);
 
 void		 plugin_append_promises(char **) NONNULL();
@@ -604,12 +691,37 @@ void		 prompt_get_answer(const char *, void (*)(char *, void *),
 		    void *) NONNULL(1, 2);
 void		 prompt_get_command(const char *, void (*)(char *, void *),
 		    void *) NONNULL(1, 2);
+void		 prompt_get_filter_query(const char *,
+		    void (*)(const char *, void *), void (*)(char *, void *),
+		    void *) NONNULL(1, 2, 3);
 void		 prompt_get_search_query(const char *,
 		    void (*)(char *, void *), void *) NONNULL(1, 2);
 void		 prompt_handle_key(int);
 void		 prompt_init(void);
 void		 prompt_print(void);
 
+void		 query_free(struct query *) NONNULL();
+struct query	*query_init(const char *, char **) NONNULL();
+int		 query_match(const struct query *, const struct track *)
+		    NONNULL();
+void		 query_plan_free(struct query_plan *) NONNULL();
+struct query_plan *query_plan_init(const struct query *,
+		    const struct query_snapshot *) NONNULL();
+size_t		 query_plan_select(struct query_plan *, const uint32_t *,
+		    size_t, uint32_t *) NONNULL();
+int		 query_refines(const struct query *, const struct query *)
+		    NONNULL();
+void		 query_snapshot_build(struct query_snapshot *, struct track **,
+		    size_t) NONNULL(1);
+void		 query_snapshot_free(struct query_snapshot *) NONNULL();
+size_t		 query_snapshot_get_ntracks(const struct query_snapshot *)
+		    NONNULL();
+struct track	*query_snapshot_get_track(const struct query_snapshot *,
+		    uint32_t) NONNULL();
+struct query_snapshot *query_snapshot_init(void);
+void		 query_snapshot_insert(struct query_snapshot *,
+		    struct track **, const uint32_t *, size_t) NONNULL();
+
 void		 queue_activate_entry(void);
 void		 queue_add_dir(const char *) NONNULL();
 void		 queue_add_track(struct track *) NONNULL();
@@ -621,6 +733,7 @@ struct track	*queue_get_next_track(void);
 void		 queue_init(void);
 void		 queue_move_entry_down(void);
 void		 queue_move_entry_up(void);
+char		*queue_peek_next_path(void);
 void		 queue_print(void);
 void		 queue_scroll_down(enum menu_scroll);
 void		 queue_scroll_up(enum menu_scroll);
@@ -632,6 +745,22 @@ void		 queue_select_next_entry(void);
 void		 queue_select_prev_entry(void);
 void		 queue_update(void);
 
+void		 save_end(void);
+void		 save_file(char *, void *, size_t, const char *, const char *)
+		    NONNULL(1, 5);
+void		 save_init(void);
+
+void		 search_add_track(struct search *, struct track *) NONNULL();
+void		 search_build(struct search *, struct track **, size_t)
+		    NONNULL();
+void		 search_clear(struct search *) NONNULL();
+void		 search_free(struct search *) NONNULL();
+struct search	*search_init(void);
+int		 search_lookup(const struct search *, const char *,
+		    struct track ***, size_t *) NONNULL();
+void		 search_remove_track(struct search *, const struct track *)
+		    NONNULL();
+
 void		 screen_configure_cursor(void);
 void		 screen_configure_objects(void);
 void		 screen_end(void);
@@ -665,19 +794,30 @@ void		 screen_view_print_selected(const char *) NONNULL();
 void		 screen_view_title_printf(const char *, ...) PRINTFLIKE1;
 void		 screen_view_title_printf_right(const char *, ...) PRINTFLIKE1;
 
+void		 track_autosave(void);
+int		 track_check_sort(const char *, char **) NONNULL();
+void		 track_clear_probe(struct track *) NONNULL();
 int		 track_cmp(const struct track *, const struct track *)
 		    NONNULL();
 void		 track_copy_vorbis_comment(struct track *, const char *);
 void		 track_end(void);
 struct track	*track_get(char *, const struct ip *) NONNULL(1);
+void		 track_get_multiple(char **, size_t, struct track **);
+int		 track_get_probe(struct track *, struct track_probe *)
+		    NONNULL();
 void		 track_init(void);
 void		 track_lock_metadata(void);
 struct track	*track_require(char *);
-int		 track_search(const struct track *, const char *);
+void		 track_require_multiple(char **, size_t, struct track **);
+int		 track_search(const struct track *, const struct pattern *);
+void		 track_set_probe(struct track *, const struct track_probe *)
+		    NONNULL();
+int		 track_set_sort(const char *) NONNULL();
+void		 track_sort(struct track **, size_t);
 void		 track_split_tag(const char *, char **, char **);
 void		 track_unlock_metadata(void);
-void		 track_update_metadata(int);
-int		 track_write_cache(void);
+void		 track_update_metadata(int, int);
+void		 track_write_cache(int);
 
 void		 view_activate_entry(void);
 void		 view_add_dir(enum view_id, const char *) NONNULL();
@@ -16,51 +16,358 @@
 
 #include "config.h"
 
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "siren.h"
 
+/* Number of tracks a worker reads before publishing their metadata. */
+#define TRACK_BATCH_SIZE 64
+
+/* Number of entries in a slab. */
+#define TRACK_SLAB_NENTRIES 1024
+
+/* Size of a chunk in the path arena. */
+#define TRACK_CHUNK_SIZE (64 * 1024)
+
+/* Initial number of buckets in the string table. Must be a power of 2. */
+#define TRACK_STRINGS_SIZE 1024
+
+/* Initial number of slots in the entry table. Must be a power of 2. */
+#define TRACK_SLOTS_SIZE 1024
+
+/* Minimum number of tracks per thread in track_sort(). */
+#define TRACK_SORT_NTRACKS 16384
+
+/* Maximum number of threads in track_sort(). */
+#define TRACK_SORT_NTHREADS 64
+
+/* Maximum number of fields in a sort order. */
+#define TRACK_SORT_NFIELDS 8
+
+enum track_field {
+	TRACK_FIELD_ADDED,
+	TRACK_FIELD_ALBUM,
+	TRACK_FIELD_ALBUMARTIST,
+	TRACK_FIELD_ARTIST,
+	TRACK_FIELD_DATE,
+	TRACK_FIELD_DISCNUMBER,
+	TRACK_FIELD_DURATION,
+	TRACK_FIELD_FILENAME,
+	TRACK_FIELD_GENRE,
+	TRACK_FIELD_PATH,
+	TRACK_FIELD_TITLE,
+	TRACK_FIELD_TRACKNUMBER
+};
+
+/*
+ * Sort key of a track, with an element for each field of the sort order. It
+ * is derived from the metadata so that track_cmp() does not have to parse
+ * numbers or fold case. A string is represented by the first bytes of its
+ * lower-case form, packed into an integer in big-endian order; only strings
+ * with equal keys need to be compared in full. A number is represented by its
+ * value, TRACK_KEY_NULL or TRACK_KEY_NAN.
+ */
+union track_key {
+	uint64_t		str;
+	int			num;
+};
+
+#define TRACK_KEY_NULL	-1	/* Field not set */
+#define TRACK_KEY_NAN	-2	/* Field not a number */
+
+/*
+ * The stream information of a track that was read from the cache stays in the
+ * cache until it is needed.
+ */
 struct track_entry {
-	struct track		track;
+	struct track		track;		/* Must be first */
+	union track_key		key[TRACK_SORT_NFIELDS];
+	int64_t			atime;		/* Time of last use */
+	int64_t			added;		/* Time of addition */
+	size_t			cacheidx;
+	int			cacheprobe;	/* Probe still in cache */
+	int			used;		/* Used in this session */
 	int			delete;
-	RB_ENTRY(track_entry)	entries;
 };
 
-RB_HEAD(track_tree, track_entry);
+#define TRACK_ENTRY(t)	((struct track_entry *)(t))
+#define TRACK_KEY(t)	(((const struct track_entry *)(t))->key)
+
+/*
+ * Slot in the entry table, an open-addressing hash table with linear probing.
+ * The hash of the path is kept in the slot, so that most mismatches are
+ * detected without comparing paths.
+ */
+struct track_slot {
+	struct track_entry	*te;
+	uint32_t		 hash;
+};
+
+/*
+ * Entries are allocated from slabs and paths from chunks of an arena. Neither
+ * is freed before track_end(), which frees them all at once.
+ */
+struct track_slab {
+	struct track_slab	*next;
+	size_t			 len;
+	struct track_entry	 entries[TRACK_SLAB_NENTRIES];
+};
+
+/*
+ * Iterate over all entries. Because this macro consists of two nested loops,
+ * break cannot be used to leave it.
+ */
+#define TRACK_FOR_EACH_ENTRY(te, slab, i)				\
+	for ((slab) = track_slabs; (slab) != NULL; (slab) = (slab)->next) \
+		for ((i) = 0; (i) < (slab)->len &&			\
+		    ((te) = &(slab)->entries[(i)]) != NULL; (i)++)
+
+/*
+ * Part of the array being sorted by track_sort(). A job either sorts
+ * src[lo..hi) or merges the sorted runs src[lo..mid) and src[mid..hi) into
+ * dst[lo..hi).
+ */
+struct track_sort_job {
+	pthread_t		 thd;
+	struct track		**src;
+	struct track		**dst;
+	size_t			 lo;
+	size_t			 mid;
+	size_t			 hi;
+};
+
+/* Entry that is saved to the cache only if there is room for it. */
+struct track_unused {
+	int64_t			 atime;
+	size_t			 idx;		/* Index in the cache */
+	struct track_entry	*te;		/* Or NULL if not added */
+};
+
+struct track_chunk {
+	struct track_chunk	*next;
+	size_t			 len;
+	size_t			 size;
+	char			*data;
+};
+
+struct track_dir {
+	char			*path;
+	size_t			 len;
+	int			 fd;
+	int			 error;
+};
+
+/*
+ * Interned string. Metadata fields that are shared by many tracks (for
+ * example, the artist and album fields) are stored only once and are
+ * reference-counted. The string itself directly follows this structure.
+ */
+struct track_string {
+	struct track_string	*next;
+	uint32_t		 hash;
+	size_t			 refs;
+	char			*str;
+};
+
+struct track_job {
+	struct track_entry	*te;
+	struct track_stamp	 stamp;
+};
+
+struct track_result {
+	struct track_entry	*te;
+	struct track		 track;
+};
+
+struct track_worker {
+	pthread_t		 thd;
+	size_t			 nresults;
+	struct track_result	 results[TRACK_BATCH_SIZE];
+};
 
-static int		 track_cmp_entry(struct track_entry *,
-			    struct track_entry *);
-static int		 track_cmp_number(const char *, const char *);
-static int		 track_cmp_string(const char *, const char *);
-static void		 track_free_entry(struct track_entry *);
+static int		 track_add_entry(struct track_entry *);
+static struct track_entry *track_alloc_entry(void);
+static char		*track_alloc_path(const char *);
+static int		 track_cmp_atime(const void *, const void *);
+static int		 track_cmp_number(const char *, int, const char *, int);
+static int		 track_cmp_sort(const void *, const void *);
+static int		 track_cmp_stamp(const struct track_stamp *,
+			    const struct stat *);
+static int		 track_cmp_string(const char *, uint64_t, const char *,
+			    uint64_t);
 static void		 track_free_metadata(struct track_entry *);
+static void		 track_free_probe(struct track_entry *);
+static void		 track_free_slab_entry(void);
+static void		 track_free_string(char *);
+static void		 track_get_entries(char **, size_t, struct track **,
+			    int);
+static const char	*track_get_field(const struct track *,
+			    enum track_field);
+static uint32_t		 track_hash_string(const char *);
+static char		*track_intern_string(char *);
+static void		 track_intern_metadata(struct track *);
+static void		 track_log_strings(void);
+static void		 track_release_string(char *);
 static void		 track_init_metadata(struct track_entry *);
-static void		 track_read_cache(void);
+static void		 track_load_all_entries(void);
+static struct track_entry *track_load_entry(size_t);
+static int		 track_key_number(const char *);
+static uint64_t		 track_key_string(const char *);
+static struct track_entry *track_lookup_entry(const char *);
+static void		*track_merge_handler(void *);
+static int		 track_parse_sort(const char *, enum track_field *,
+			    size_t *, char **);
+static void		 track_publish_results(struct track_worker *);
+static void		 track_read_metadata(struct track_job *, size_t, int);
+static void		 track_set_key(struct track_entry *);
+static void		 track_set_stamp(struct track_stamp *,
+			    const struct stat *);
+static void		*track_sort_handler(void *);
+static int		 track_stat(struct track *, struct track_dir *,
+			    struct stat *);
+static void		*track_worker_handler(void *);
+static void		 track_write_entry(struct track_entry *, int64_t);
 
 static pthread_mutex_t	 track_metadata_mtx = PTHREAD_MUTEX_INITIALIZER;
-static struct track_tree track_tree = RB_INITIALIZER(track_tree);
+
+static struct track_slab *track_slabs;
+static struct track_chunk *track_chunks;
+
+static struct track_string **track_strings;
+static size_t		 track_strings_size;
+static size_t		 track_strings_len;
+static size_t		 track_strings_refs;
+static size_t		 track_strings_saved;	/* Bytes saved by interning */
+
+static pthread_mutex_t	 track_pool_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	 track_pool_cond = PTHREAD_COND_INITIALIZER;
+static struct track_job	*track_pool_jobs;
+static size_t		 track_pool_njobs;
+static size_t		 track_pool_next;
+static size_t		 track_pool_ndone;
+static struct track_slot *track_slots;
+static size_t		 track_slots_size;
 static size_t		 track_nentries;
-static int		 track_tree_modified;
+static size_t		 track_nchanges;
+
+/* Time at which siren was started. */
+static int64_t		 track_time;
+
+static const struct {
+	const char		*name;
+	enum track_field	 field;
+} track_fields[] = {
+	{ "added",		TRACK_FIELD_ADDED },
+	{ "album",		TRACK_FIELD_ALBUM },
+	{ "albumartist",	TRACK_FIELD_ALBUMARTIST },
+	{ "artist",		TRACK_FIELD_ARTIST },
+	{ "date",		TRACK_FIELD_DATE },
+	{ "discnumber",		TRACK_FIELD_DISCNUMBER },
+	{ "duration",		TRACK_FIELD_DURATION },
+	{ "filename",		TRACK_FIELD_FILENAME },
+	{ "genre",		TRACK_FIELD_GENRE },
+	{ "path",		TRACK_FIELD_PATH },
+	{ "title",		TRACK_FIELD_TITLE },
+	{ "tracknumber",	TRACK_FIELD_TRACKNUMBER }
+};
+
+/* Sort order used by track_cmp(). */
+static enum track_field	 track_sort_fields[TRACK_SORT_NFIELDS] = {
+	TRACK_FIELD_ALBUMARTIST,
+	TRACK_FIELD_DATE,
+	TRACK_FIELD_ALBUM,
+	TRACK_FIELD_DISCNUMBER,
+	TRACK_FIELD_TRACKNUMBER,
+	TRACK_FIELD_TITLE
+};
+static size_t		 track_sort_nfields = 6;
+
+/*
+ * Add an entry for a new track. Its metadata is not read.
+ */
+static struct track_entry *
+track_add_empty_entry(char *path, const struct ip *ip)
+{
+	struct track_entry *te;
+
+	te = track_alloc_entry();
+	te->atime = track_time;
+	te->added = track_time;
+	te->used = 1;
+	te->delete = 0;
+	te->track.path = track_alloc_path(path);
+	te->track.ip = (ip != NULL) ? ip : plugin_find_ip(path);
+	te->track.ipdata = NULL;
+	track_init_metadata(te);
+
+	if (track_add_entry(te) == -1) {
+		track_free_slab_entry();
+		return NULL;
+	}
 
-RB_GENERATE_STATIC(track_tree, track_entry, entries, track_cmp_entry)
+	track_nchanges++;
+	return te;
+}
 
 static int
 track_add_entry(struct track_entry *te)
 {
-	if (track_nentries == SIZE_MAX)
-		return -1;
+	struct track_slot	*slots;
+	size_t			 i, j, size;
+	uint32_t		 hash;
 
-	if (RB_INSERT(track_tree, &track_tree, te) != NULL) {
-		/* This should not happen. */
-		LOG_ERRX("%s: track already in tree", te->track.path);
+	if (track_nentries == SIZE_MAX / 4)
 		return -1;
+
+	/* Keep the table at most half full. */
+	if (track_nentries >= track_slots_size / 2) {
+		size = (track_slots_size == 0) ? TRACK_SLOTS_SIZE :
+		    track_slots_size * 2;
+		slots = xreallocarray(NULL, size, sizeof *slots);
+		for (i = 0; i < size; i++)
+			slots[i].te = NULL;
+		for (i = 0; i < track_slots_size; i++) {
+			if (track_slots[i].te == NULL)
+				continue;
+			j = track_slots[i].hash & (size - 1);
+			while (slots[j].te != NULL)
+				j = (j + 1) & (size - 1);
+			slots[j] = track_slots[i];
+		}
+		free(track_slots);
+		track_slots = slots;
+		track_slots_size = size;
+	}
+
+	hash = track_hash_string(te->track.path);
+	i = hash & (track_slots_size - 1);
+	while (track_slots[i].te != NULL) {
+		if (track_slots[i].hash == hash &&
+		    !strcmp(track_slots[i].te->track.path, te->track.path)) {
+			/* This should not happen. */
+			LOG_ERRX("%s: track already in table", te->track.path);
+			return -1;
+		}
+		i = (i + 1) & (track_slots_size - 1);
 	}
 
+	track_slots[i].te = te;
+	track_slots[i].hash = hash;
+
 	te->track.filename = strrchr(te->track.path, '/');
 	if (te->track.filename != NULL)
 		te->track.filename++;
@@ -74,27 +381,108 @@ track_add_entry(struct track_entry *te)
 static struct track *
 track_add_new_entry(char *path, const struct ip *ip)
 {
-	struct track_entry *te;
+	struct track_entry	*te;
+	struct stat		 sb;
 
-	te = xmalloc(sizeof *te);
-	te->delete = 0;
-	te->track.path = xstrdup(path);
-	te->track.ip = (ip != NULL) ? ip : plugin_find_ip(path);
-	te->track.ipdata = NULL;
-	track_init_metadata(te);
+	if ((te = track_add_empty_entry(path, ip)) == NULL)
+		return NULL;
 
-	if (te->track.ip != NULL)
-		te->track.ip->get_metadata(&te->track);
+	if (stat(path, &sb) == 0)
+		track_set_stamp(&te->track.stamp, &sb);
 
-	if (track_add_entry(te) == -1) {
-		track_free_entry(te);
-		return NULL;
+	if (te->track.ip != NULL) {
+		te->track.ip->get_metadata(&te->track);
+		track_lock_metadata();
+		track_intern_metadata(&te->track);
+		track_set_key(te);
+		track_unlock_metadata();
 	}
 
-	track_tree_modified = 1;
 	return &te->track;
 }
 
+static struct track_entry *
+track_alloc_entry(void)
+{
+	struct track_slab *slab;
+
+	if (track_slabs == NULL || track_slabs->len == TRACK_SLAB_NENTRIES) {
+		slab = xmalloc(sizeof *slab);
+		slab->len = 0;
+		slab->next = track_slabs;
+		track_slabs = slab;
+	}
+
+	return &track_slabs->entries[track_slabs->len++];
+}
+
+static char *
+track_alloc_path(const char *path)
+{
+	struct track_chunk	*chunk;
+	size_t			 len;
+	char			*p;
+
+	len = strlen(path) + 1;
+	chunk = track_chunks;
+	if (chunk == NULL || chunk->size - chunk->len < len) {
+		chunk = xmalloc(sizeof *chunk);
+		chunk->size = (len > TRACK_CHUNK_SIZE) ? len : TRACK_CHUNK_SIZE;
+		chunk->data = xmalloc(chunk->size);
+		chunk->len = 0;
+
+		/* Keep using the current chunk if the path is too large. */
+		if (track_chunks != NULL && len > TRACK_CHUNK_SIZE) {
+			chunk->next = track_chunks->next;
+			track_chunks->next = chunk;
+		} else {
+			chunk->next = track_chunks;
+			track_chunks = chunk;
+		}
+	}
+
+	p = chunk->data + chunk->len;
+	memcpy(p, path, len);
+	chunk->len += len;
+	return p;
+}
+
+/*
+ * Save the metadata cache if it has changed often enough since it was last
+ * saved.
+ */
+void
+track_autosave(void)
+{
+	int threshold;
+
+	threshold = option_get_number("autosave-threshold");
+	if (threshold > 0 && track_nchanges >= (size_t)threshold)
+		track_write_cache(0);
+}
+
+/*
+ * Check whether a sort order is valid; see track_set_sort(). If it is not, -1
+ * is returned and an error message is stored in *error; the caller must free
+ * it.
+ */
+int
+track_check_sort(const char *order, char **error)
+{
+	enum track_field	fields[TRACK_SORT_NFIELDS];
+	size_t			nfields;
+
+	return track_parse_sort(order, fields, &nfields, error);
+}
+
+void
+track_clear_probe(struct track *t)
+{
+	track_lock_metadata();
+	track_free_probe(TRACK_ENTRY(t));
+	track_unlock_metadata();
+}
+
 void
 track_copy_vorbis_comment(struct track *t, const char *com)
 {
@@ -162,116 +550,237 @@ track_copy_vorbis_comment(struct track *t, const char *com)
 	}
 }
 
+/*
+ * Compare two tracks in the order set by track_set_sort(). Tracks that are
+ * equal in all fields of the order are compared by path.
+ */
 int
 track_cmp(const struct track *t1, const struct track *t2)
 {
-	int		 ret;
-	const char	*artist1, *artist2;
-
-	artist1 = (t1->albumartist != NULL) ? t1->albumartist : t1->artist;
-	artist2 = (t2->albumartist != NULL) ? t2->albumartist : t2->artist;
-
-	if ((ret = track_cmp_string(artist1, artist2)))
-		return ret;
-	if ((ret = track_cmp_number(t1->date, t2->date)))
-		return ret;
-	if ((ret = track_cmp_string(t1->album, t2->album)))
-		return ret;
-	if ((ret = track_cmp_number(t1->discnumber, t2->discnumber)))
-		return ret;
-	if ((ret = track_cmp_number(t1->tracknumber, t2->tracknumber)))
-		return ret;
-	if ((ret = track_cmp_string(t1->title, t2->title)))
-		return ret;
+	const union track_key	*k1, *k2;
+	enum track_field	 field;
+	size_t			 i;
+	int64_t			 a1, a2;
+	int			 ret;
+
+	k1 = TRACK_KEY(t1);
+	k2 = TRACK_KEY(t2);
+
+	for (i = 0; i < track_sort_nfields; i++) {
+		field = track_sort_fields[i];
+		switch (field) {
+		case TRACK_FIELD_ADDED:
+			a1 = ((const struct track_entry *)t1)->added;
+			a2 = ((const struct track_entry *)t2)->added;
+			ret = (a1 < a2) ? -1 : (a1 > a2);
+			break;
+		case TRACK_FIELD_DATE:
+		case TRACK_FIELD_DISCNUMBER:
+		case TRACK_FIELD_TRACKNUMBER:
+			if (k1[i].num >= 0 && k2[i].num >= 0)
+				ret = (k1[i].num < k2[i].num) ? -1 :
+				    (k1[i].num > k2[i].num);
+			else
+				ret = track_cmp_number(
+				    track_get_field(t1, field), k1[i].num,
+				    track_get_field(t2, field), k2[i].num);
+			break;
+		case TRACK_FIELD_DURATION:
+			ret = (t1->duration < t2->duration) ? -1 :
+			    (t1->duration > t2->duration);
+			break;
+		case TRACK_FIELD_FILENAME:
+			ret = strcmp(t1->filename, t2->filename);
+			break;
+		case TRACK_FIELD_PATH:
+			ret = strcmp(t1->path, t2->path);
+			break;
+		default:
+			/*
+			 * Different keys decide the order by themselves: a
+			 * missing field has the same key as an empty one and
+			 * both sort first.
+			 */
+			if (k1[i].str != k2[i].str)
+				ret = (k1[i].str < k2[i].str) ? -1 : 1;
+			else
+				ret = track_cmp_string(
+				    track_get_field(t1, field), k1[i].str,
+				    track_get_field(t2, field), k2[i].str);
+			break;
+		}
+		if (ret)
+			return ret;
+	}
+
 	return strcmp(t1->path, t2->path);
 }
 
+/*
+ * Sort unused entries from most to least recently used.
+ */
 static int
-track_cmp_entry(struct track_entry *t1, struct track_entry *t2)
+track_cmp_atime(const void *p1, const void *p2)
 {
-	return strcmp(t1->track.path, t2->track.path);
+	const struct track_unused *u1, *u2;
+
+	u1 = p1;
+	u2 = p2;
+	if (u1->atime > u2->atime)
+		return -1;
+	return u1->atime < u2->atime;
 }
 
 static int
-track_cmp_number(const char *s1, const char *s2)
+track_cmp_number(const char *s1, int k1, const char *s2, int k2)
 {
-	int		 i1, i2;
-	const char	*errstr;
+	if (k1 >= 0 && k2 >= 0)
+		return (k1 < k2) ? -1 : (k1 > k2);
 
 	if (s1 == NULL)
 		return (s2 == NULL) ? 0 : -1;
 	if (s2 == NULL)
 		return 1;
 
-	i1 = strtonum(s1, 0, INT_MAX, &errstr);
-	if (errstr != NULL)
-		return strcasecmp(s1, s2);
+	/* At least one of the fields is not a number. */
+	return strcasecmp(s1, s2);
+}
 
-	i2 = strtonum(s2, 0, INT_MAX, &errstr);
-	if (errstr != NULL)
-		return strcasecmp(s1, s2);
+static int
+track_cmp_sort(const void *p1, const void *p2)
+{
+	return track_cmp(*(struct track * const *)p1,
+	    *(struct track * const *)p2);
+}
 
-	return (i1 < i2) ? -1 : (i1 > i2);
+/*
+ * Return 0 if a file still has the status recorded in a stamp, or 1 otherwise.
+ */
+static int
+track_cmp_stamp(const struct track_stamp *stamp, const struct stat *sb)
+{
+	return stamp->mtime != sb->st_mtime || stamp->size != sb->st_size ||
+	    stamp->ino != (uint64_t)sb->st_ino ||
+	    stamp->dev != (uint64_t)sb->st_dev;
 }
 
 static int
-track_cmp_string(const char *s1, const char *s2)
+track_cmp_string(const char *s1, uint64_t k1, const char *s2, uint64_t k2)
 {
 	if (s1 == NULL)
 		return (s2 == NULL) ? 0 : -1;
 	if (s2 == NULL)
 		return 1;
+	if (k1 != k2)
+		return (k1 < k2) ? -1 : 1;
+
+	/* If the strings end within the key, they are equal. */
+	if ((k1 & 0xff) == 0)
+		return 0;
 	return strcasecmp(s1, s2);
 }
 
 void
 track_end(void)
 {
-	struct track_entry *te;
+	struct track_slab	*slab;
+	struct track_entry	*te;
+	struct track_chunk	*chunk;
+	size_t			 i;
+
+	if (track_nchanges > 0)
+		track_write_cache(0);
+
+	track_log_strings();
+
+	track_lock_metadata();
+	TRACK_FOR_EACH_ENTRY(te, slab, i)
+		track_free_metadata(te);
+	track_unlock_metadata();
 
-	if (track_tree_modified)
-		track_write_cache();
+	while ((slab = track_slabs) != NULL) {
+		track_slabs = slab->next;
+		free(slab);
+	}
+
+	free(track_slots);
 
-	while ((te = RB_ROOT(&track_tree)) != NULL) {
-		RB_REMOVE(track_tree, &track_tree, te);
-		track_free_entry(te);
+	while ((chunk = track_chunks) != NULL) {
+		track_chunks = chunk->next;
+		free(chunk->data);
+		free(chunk);
 	}
+
+	free(track_strings);
+	cache_end();
 }
 
 static struct track_entry *
 track_find_entry(char *path, const struct ip *ip)
 {
-	struct track_entry search, *te;
+	struct track_entry	*te;
+	size_t			 i;
+
+	te = track_lookup_entry(path);
+	if (te == NULL && cache_find_entry(path, &i) == 0)
+		te = track_load_entry(i);
+	if (te == NULL)
+		return NULL;
 
-	search.track.path = path;
-	te = RB_FIND(track_tree, &track_tree, &search);
-	if (te != NULL && te->track.ip == NULL)
+	if (te->track.ip == NULL)
 		te->track.ip = (ip != NULL) ? ip : plugin_find_ip(path);
+	te->used = 1;
 	return te;
 }
 
+/*
+ * The metadata mutex must be locked before calling this function.
+ */
+static void
+track_free_metadata(struct track_entry *te)
+{
+	track_release_string(te->track.album);
+	track_release_string(te->track.albumartist);
+	track_release_string(te->track.artist);
+	track_free_string(te->track.comment);
+	track_release_string(te->track.date);
+	track_release_string(te->track.discnumber);
+	track_release_string(te->track.disctotal);
+	track_release_string(te->track.genre);
+	track_free_string(te->track.title);
+	track_release_string(te->track.tracknumber);
+	track_release_string(te->track.tracktotal);
+	track_free_probe(te);
+}
+
+static void
+track_free_probe(struct track_entry *te)
+{
+	if (te->track.probe != NULL) {
+		free(te->track.probe->data);
+		free(te->track.probe);
+		te->track.probe = NULL;
+	}
+	te->cacheprobe = 0;
+}
+
+/*
+ * Return the entry that was allocated last to its slab.
+ */
 static void
-track_free_entry(struct track_entry *te)
+track_free_slab_entry(void)
 {
-	track_free_metadata(te);
-	free(te->track.path);
-	free(te);
+	track_slabs->len--;
 }
 
+/*
+ * Free a string unless it points into the metadata cache.
+ */
 static void
-track_free_metadata(struct track_entry *te)
+track_free_string(char *s)
 {
-	free(te->track.album);
-	free(te->track.albumartist);
-	free(te->track.artist);
-	free(te->track.comment);
-	free(te->track.date);
-	free(te->track.discnumber);
-	free(te->track.disctotal);
-	free(te->track.genre);
-	free(te->track.title);
-	free(te->track.tracknumber);
-	free(te->track.tracktotal);
+	if (!cache_contains(s))
+		free(s);
 }
 
 struct track *
@@ -300,10 +809,152 @@ track_get(char *path, const struct ip *ip)
 	return track_add_new_entry(path, ip);
 }
 
+/*
+ * Get the tracks for the specified paths. The metadata of new tracks is read
+ * concurrently. If require is set, tracks are got like track_require() does;
+ * otherwise, like track_get() does. If a track cannot be got, its element in
+ * the tracks array is set to NULL.
+ */
+static void
+track_get_entries(char **paths, size_t npaths, struct track **tracks,
+    int require)
+{
+	struct track_entry	*te;
+	struct track_job	*jobs;
+	struct stat		 sb;
+	size_t			 i, njobs;
+
+	if (npaths == 0)
+		return;
+
+	jobs = xreallocarray(NULL, npaths, sizeof *jobs);
+	njobs = 0;
+
+	for (i = 0; i < npaths; i++) {
+		te = track_find_entry(paths[i], NULL);
+		if (te == NULL) {
+			te = track_add_empty_entry(paths[i], NULL);
+			if (te != NULL && te->track.ip != NULL) {
+				jobs[njobs].te = te;
+				memset(&jobs[njobs].stamp, 0,
+				    sizeof jobs[njobs].stamp);
+				if (stat(paths[i], &sb) == 0)
+					track_set_stamp(&jobs[njobs].stamp,
+					    &sb);
+				njobs++;
+			}
+		}
+
+		if (te != NULL && (te->track.ip != NULL || require))
+			tracks[i] = &te->track;
+		else {
+			if (!require)
+				msg_errx("%s: Unsupported file format",
+				    paths[i]);
+			tracks[i] = NULL;
+		}
+	}
+
+	track_read_metadata(jobs, njobs, 0);
+	free(jobs);
+}
+
+/*
+ * Return the value of a metadata field. For the album artist, the artist is
+ * returned if the album artist is not set.
+ */
+static const char *
+track_get_field(const struct track *t, enum track_field field)
+{
+	switch (field) {
+	case TRACK_FIELD_ALBUM:
+		return t->album;
+	case TRACK_FIELD_ALBUMARTIST:
+		return (t->albumartist != NULL) ? t->albumartist : t->artist;
+	case TRACK_FIELD_ARTIST:
+		return t->artist;
+	case TRACK_FIELD_DATE:
+		return t->date;
+	case TRACK_FIELD_DISCNUMBER:
+		return t->discnumber;
+	case TRACK_FIELD_GENRE:
+		return t->genre;
+	case TRACK_FIELD_TITLE:
+		return t->title;
+	case TRACK_FIELD_TRACKNUMBER:
+		return t->tracknumber;
+	default:
+		return NULL;
+	}
+}
+
+/*
+ * Get the tracks for the specified paths, like track_get() does. The metadata
+ * of new tracks is read concurrently. If a track cannot be got, its element in
+ * the tracks array is set to NULL.
+ */
+void
+track_get_multiple(char **paths, size_t npaths, struct track **tracks)
+{
+	track_get_entries(paths, npaths, tracks, 0);
+}
+
+
+/*
+ * Get the stream information saved by track_set_probe(). The caller must free
+ * the data member of the probe structure. If the file has changed since its
+ * metadata was read, the stream information may no longer be valid; it is then
+ * discarded and -1 is returned.
+ */
+int
+track_get_probe(struct track *t, struct track_probe *probe)
+{
+	struct stat	sb;
+	int		ret, stale;
+
+	stale = stat(t->path, &sb) == -1;
+
+	track_lock_metadata();
+	if (!stale)
+		stale = track_cmp_stamp(&t->stamp, &sb);
+	if (stale) {
+		track_free_probe(TRACK_ENTRY(t));
+		ret = -1;
+	} else if (TRACK_ENTRY(t)->cacheprobe)
+		ret = cache_read_probe(TRACK_ENTRY(t)->cacheidx, probe);
+	else if (t->probe == NULL)
+		ret = -1;
+	else {
+		*probe = *t->probe;
+		if (probe->datasize > 0) {
+			probe->data = xmalloc(probe->datasize);
+			memcpy(probe->data, t->probe->data, probe->datasize);
+		}
+		ret = 0;
+	}
+	track_unlock_metadata();
+	return ret;
+}
+
+/* FNV-1a hash. */
+static uint32_t
+track_hash_string(const char *s)
+{
+	uint32_t hash;
+
+	hash = 2166136261U;
+	for (; *s != '\0'; s++) {
+		hash ^= (unsigned char)*s;
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
 void
 track_init(void)
 {
-	track_read_cache();
+	track_time = time(NULL);
+	cache_init();
 }
 
 static void
@@ -321,6 +972,172 @@ track_init_metadata(struct track_entry *te)
 	te->track.tracknumber = NULL;
 	te->track.tracktotal = NULL;
 	te->track.duration = 0;
+	te->track.probe = NULL;
+	te->cacheprobe = 0;
+	memset(&te->track.stamp, 0, sizeof te->track.stamp);
+	track_set_key(te);
+}
+
+/*
+ * Intern the metadata fields that are commonly shared by tracks. The metadata
+ * mutex must be locked before calling this function.
+ */
+static void
+track_intern_metadata(struct track *t)
+{
+	t->album = track_intern_string(t->album);
+	t->albumartist = track_intern_string(t->albumartist);
+	t->artist = track_intern_string(t->artist);
+	t->date = track_intern_string(t->date);
+	t->discnumber = track_intern_string(t->discnumber);
+	t->disctotal = track_intern_string(t->disctotal);
+	t->genre = track_intern_string(t->genre);
+	t->tracknumber = track_intern_string(t->tracknumber);
+	t->tracktotal = track_intern_string(t->tracktotal);
+}
+
+/*
+ * Return the interned copy of a string allocated with malloc(). The string
+ * itself is freed. The metadata mutex must be locked before calling this
+ * function.
+ */
+static char *
+track_intern_string(char *s)
+{
+	struct track_string	**strings, *ts, *next;
+	size_t			  i, len;
+	uint32_t		  hash;
+
+	if (s == NULL)
+		return NULL;
+
+	hash = track_hash_string(s);
+	if (track_strings != NULL) {
+		i = hash & (track_strings_size - 1);
+		for (ts = track_strings[i]; ts != NULL; ts = ts->next)
+			if (ts->hash == hash && !strcmp(ts->str, s)) {
+				ts->refs++;
+				track_strings_refs++;
+				track_strings_saved += strlen(s) + 1;
+				free(s);
+				return ts->str;
+			}
+	}
+
+	/* Keep the average chain length at most 1. */
+	if (track_strings_len >= track_strings_size) {
+		if (track_strings_size == 0)
+			track_strings_size = TRACK_STRINGS_SIZE;
+		else
+			track_strings_size *= 2;
+		strings = xreallocarray(NULL, track_strings_size,
+		    sizeof *strings);
+		for (i = 0; i < track_strings_size; i++)
+			strings[i] = NULL;
+		if (track_strings != NULL) {
+			for (i = 0; i < track_strings_size / 2; i++)
+				for (ts = track_strings[i]; ts != NULL;
+				    ts = next) {
+					next = ts->next;
+					ts->next = strings[ts->hash &
+					    (track_strings_size - 1)];
+					strings[ts->hash &
+					    (track_strings_size - 1)] = ts;
+				}
+			free(track_strings);
+		}
+		track_strings = strings;
+	}
+
+	len = strlen(s) + 1;
+	ts = xmalloc(sizeof *ts + len);
+	ts->hash = hash;
+	ts->refs = 1;
+	ts->str = (char *)(ts + 1);
+	memcpy(ts->str, s, len);
+	free(s);
+
+	i = hash & (track_strings_size - 1);
+	ts->next = track_strings[i];
+	track_strings[i] = ts;
+	track_strings_len++;
+	track_strings_refs++;
+	return ts->str;
+}
+
+static int
+track_key_number(const char *s)
+{
+	const char	*errstr;
+	int		 num;
+
+	if (s == NULL)
+		return TRACK_KEY_NULL;
+
+	num = strtonum(s, 0, INT_MAX, &errstr);
+	return (errstr == NULL) ? num : TRACK_KEY_NAN;
+}
+
+static uint64_t
+track_key_string(const char *s)
+{
+	uint64_t	key;
+	size_t		i;
+
+	key = 0;
+	for (i = 0; i < sizeof key; i++) {
+		key <<= 8;
+		if (s != NULL && *s != '\0')
+			key |= (unsigned char)tolower((unsigned char)*s++);
+	}
+	return key;
+}
+
+/*
+ * Add all entries of the metadata cache that have not been added yet.
+ */
+static void
+track_load_all_entries(void)
+{
+	size_t	 i, n;
+	char	*path;
+
+	n = cache_get_nentries();
+	for (i = 0; i < n; i++)
+		if ((path = cache_get_path(i)) != NULL &&
+		    track_lookup_entry(path) == NULL)
+			track_load_entry(i);
+}
+
+/*
+ * Add the specified entry of the metadata cache. Its strings are not copied.
+ */
+static struct track_entry *
+track_load_entry(size_t idx)
+{
+	struct track_entry	*te;
+	struct track		 t;
+
+	if (cache_read_entry(idx, &t) == -1)
+		return NULL;
+
+	te = track_alloc_entry();
+	te->atime = cache_get_atime(idx);
+	te->added = cache_get_added(idx);
+	te->cacheidx = idx;
+	te->cacheprobe = 1;
+	te->used = 0;
+	te->delete = 0;
+	te->track = t;
+	track_set_key(te);
+
+	if (track_add_entry(te) == -1) {
+		track_free_metadata(te);
+		track_free_slab_entry();
+		return NULL;
+	}
+
+	return te;
 }
 
 void
@@ -330,25 +1147,215 @@ track_lock_metadata(void)
 }
 
 static void
-track_read_cache(void)
+track_log_strings(void)
 {
-	struct track_entry *te;
+	LOG_INFO("%zu interned strings, %zu references, %zu bytes saved",
+	    track_strings_len, track_strings_refs, track_strings_saved);
+}
+
+/*
+ * Find an entry in the entry table.
+ */
+static struct track_entry *
+track_lookup_entry(const char *path)
+{
+	size_t		i;
+	uint32_t	hash;
+
+	if (track_slots_size == 0)
+		return NULL;
+
+	hash = track_hash_string(path);
+	i = hash & (track_slots_size - 1);
+	while (track_slots[i].te != NULL) {
+		if (track_slots[i].hash == hash &&
+		    !strcmp(track_slots[i].te->track.path, path))
+			return track_slots[i].te;
+		i = (i + 1) & (track_slots_size - 1);
+	}
+
+	return NULL;
+}
+
+/*
+ * Merge two sorted runs of tracks.
+ */
+static void *
+track_merge_handler(void *p)
+{
+	struct track_sort_job	*job;
+	sigset_t		 ss;
+	size_t			 i, j, k;
+
+	/* Let the main thread handle all signals. */
+	sigfillset(&ss);
+	pthread_sigmask(SIG_BLOCK, &ss, NULL);
 
-	if (cache_open(CACHE_MODE_READ) == -1)
+	job = p;
+	i = job->lo;
+	j = job->mid;
+	for (k = job->lo; k < job->hi; k++)
+		if (j == job->hi ||
+		    (i < job->mid && track_cmp(job->src[i], job->src[j]) <= 0))
+			job->dst[k] = job->src[i++];
+		else
+			job->dst[k] = job->src[j++];
+
+	return NULL;
+}
+
+/*
+ * Parse a sort order into an array of at most TRACK_SORT_NFIELDS fields.
+ */
+static int
+track_parse_sort(const char *order, enum track_field *fields, size_t *nfields,
+    char **error)
+{
+	size_t	 i;
+	char	*name, *p, *s;
+
+	*nfields = 0;
+	p = s = xstrdup(order);
+	while ((name = strsep(&p, ",")) != NULL) {
+		for (i = 0; i < nitems(track_fields); i++)
+			if (!strcmp(name, track_fields[i].name))
+				break;
+		if (i == nitems(track_fields)) {
+			xasprintf(error, "Invalid sort field: %s", name);
+			free(s);
+			return -1;
+		}
+		if (*nfields == TRACK_SORT_NFIELDS) {
+			xasprintf(error, "Too many sort fields: %s", order);
+			free(s);
+			return -1;
+		}
+		fields[(*nfields)++] = track_fields[i].field;
+	}
+	free(s);
+	return 0;
+}
+
+/*
+ * Move the metadata read by a worker to the tracks.
+ */
+static void
+track_publish_results(struct track_worker *w)
+{
+	struct track_result	*r;
+	struct track		*t;
+	size_t			 i;
+
+	track_lock_metadata();
+	for (i = 0; i < w->nresults; i++) {
+		r = &w->results[i];
+		t = &r->te->track;
+		track_free_metadata(r->te);
+		track_intern_metadata(&r->track);
+		t->album = r->track.album;
+		t->albumartist = r->track.albumartist;
+		t->artist = r->track.artist;
+		t->comment = r->track.comment;
+		t->date = r->track.date;
+		t->discnumber = r->track.discnumber;
+		t->disctotal = r->track.disctotal;
+		t->genre = r->track.genre;
+		t->title = r->track.title;
+		t->tracknumber = r->track.tracknumber;
+		t->tracktotal = r->track.tracktotal;
+		t->duration = r->track.duration;
+		t->stamp = r->track.stamp;
+		track_set_key(r->te);
+	}
+	track_unlock_metadata();
+
+	XPTHREAD_MUTEX_LOCK(&track_pool_mtx);
+	track_pool_ndone += w->nresults;
+	XPTHREAD_COND_BROADCAST(&track_pool_cond);
+	XPTHREAD_MUTEX_UNLOCK(&track_pool_mtx);
+
+	w->nresults = 0;
+}
+
+/*
+ * Read the metadata of the specified tracks with a pool of worker threads. If
+ * progress is set, the progress is reported.
+ */
+static void
+track_read_metadata(struct track_job *jobs, size_t njobs, int progress)
+{
+	struct track_worker	*workers;
+	size_t			 i, ndone, nworkers;
+	long			 ncpu;
+
+	if (njobs == 0)
 		return;
 
-	for (;;) {
-		te = xmalloc(sizeof *te);
-		te->delete = 0;
-		if (cache_read_entry(&te->track) == -1) {
-			track_free_entry(te);
-			break;
+	nworkers = option_get_number("metadata-threads");
+	if (nworkers == 0) {
+		ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+		nworkers = (ncpu > 0) ? ncpu : 1;
+	}
+	if (nworkers > njobs)
+		nworkers = njobs;
+
+	track_pool_jobs = jobs;
+	track_pool_njobs = njobs;
+	track_pool_next = 0;
+	track_pool_ndone = 0;
+
+	workers = xreallocarray(NULL, nworkers, sizeof *workers);
+	for (i = 0; i < nworkers; i++) {
+		workers[i].nresults = 0;
+		XPTHREAD_CREATE(&workers[i].thd, NULL, track_worker_handler,
+		    &workers[i]);
+	}
+
+	XPTHREAD_MUTEX_LOCK(&track_pool_mtx);
+	while ((ndone = track_pool_ndone) < njobs) {
+		if (progress) {
+			XPTHREAD_MUTEX_UNLOCK(&track_pool_mtx);
+			msg_info("Updating track %zu of %zu (%zu%%)", ndone + 1,
+			    njobs, 100 * (ndone + 1) / njobs);
+			XPTHREAD_MUTEX_LOCK(&track_pool_mtx);
 		}
-		if (track_add_entry(te) == -1)
-			track_free_entry(te);
+		while (track_pool_ndone == ndone)
+			XPTHREAD_COND_WAIT(&track_pool_cond, &track_pool_mtx);
+	}
+	XPTHREAD_MUTEX_UNLOCK(&track_pool_mtx);
+
+	for (i = 0; i < nworkers; i++)
+		XPTHREAD_JOIN(workers[i].thd, NULL);
+	free(workers);
+
+	track_log_strings();
+}
+
+/*
+ * Release an interned string. The metadata mutex must be locked before calling
+ * this function.
+ */
+static void
+track_release_string(char *s)
+{
+	struct track_string **tsp, *ts;
+
+	if (s == NULL || cache_contains(s))
+		return;
+
+	ts = (struct track_string *)s - 1;
+	track_strings_refs--;
+	if (--ts->refs > 0) {
+		track_strings_saved -= strlen(s) + 1;
+		return;
 	}
 
-	cache_close();
+	tsp = &track_strings[ts->hash & (track_strings_size - 1)];
+	while (*tsp != ts)
+		tsp = &(*tsp)->next;
+	*tsp = ts->next;
+	free(ts);
+	track_strings_len--;
 }
 
 struct track *
@@ -360,26 +1367,222 @@ track_require(char *path)
 	return (te != NULL) ? &te->track : track_add_new_entry(path, NULL);
 }
 
+/*
+ * Get the tracks for the specified paths, like track_require() does. The
+ * metadata of new tracks is read concurrently.
+ */
+void
+track_require_multiple(char **paths, size_t npaths, struct track **tracks)
+{
+	track_get_entries(paths, npaths, tracks, 1);
+}
+
 int
-track_search(const struct track *t, const char *search)
+track_search(const struct track *t, const struct pattern *p)
 {
-	if (t->album != NULL && strcasestr(t->album, search))
+	if (t->album != NULL && pattern_match(p, t->album))
 		return 0;
-	if (t->artist != NULL && strcasestr(t->artist, search))
+	if (t->artist != NULL && pattern_match(p, t->artist))
 		return 0;
-	if (t->date != NULL && strcasestr(t->date, search))
+	if (t->date != NULL && pattern_match(p, t->date))
 		return 0;
-	if (t->genre != NULL && strcasestr(t->genre, search))
+	if (t->genre != NULL && pattern_match(p, t->genre))
 		return 0;
-	if (t->title != NULL && strcasestr(t->title, search))
+	if (t->title != NULL && pattern_match(p, t->title))
 		return 0;
-	if (t->tracknumber != NULL && strcasestr(t->tracknumber, search))
+	if (t->tracknumber != NULL && pattern_match(p, t->tracknumber))
 		return 0;
-	if (strcasestr(t->path, search))
+	if (pattern_match(p, t->path))
 		return 0;
 	return -1;
 }
 
+/*
+ * Compute the sort key of an entry from its metadata. This function must be
+ * called whenever the metadata changes.
+ */
+static void
+track_set_key(struct track_entry *te)
+{
+	const char		*value;
+	enum track_field	 field;
+	size_t			 i;
+
+	for (i = 0; i < track_sort_nfields; i++) {
+		field = track_sort_fields[i];
+		value = track_get_field(&te->track, field);
+		switch (field) {
+		case TRACK_FIELD_DATE:
+		case TRACK_FIELD_DISCNUMBER:
+		case TRACK_FIELD_TRACKNUMBER:
+			te->key[i].num = track_key_number(value);
+			break;
+		default:
+			te->key[i].str = track_key_string(value);
+			break;
+		}
+	}
+}
+
+void
+track_set_probe(struct track *t, const struct track_probe *probe)
+{
+	struct track_probe *p;
+
+	p = xmalloc(sizeof *p);
+	*p = *probe;
+	if (p->datasize == 0)
+		p->data = NULL;
+	else {
+		p->data = xmalloc(p->datasize);
+		memcpy(p->data, probe->data, p->datasize);
+	}
+
+	track_lock_metadata();
+	track_free_probe(TRACK_ENTRY(t));
+	t->probe = p;
+	track_unlock_metadata();
+}
+
+/*
+ * Set the order in which track_cmp() sorts tracks. The order is a
+ * comma-separated list of field names. Return -1 if the order is invalid.
+ */
+int
+track_set_sort(const char *order)
+{
+	struct track_slab	*slab;
+	struct track_entry	*te;
+	enum track_field	 fields[TRACK_SORT_NFIELDS];
+	size_t			 i, nfields;
+	char			*error;
+
+	if (track_parse_sort(order, fields, &nfields, &error) == -1) {
+		LOG_ERRX("%s", error);
+		free(error);
+		return -1;
+	}
+
+	track_lock_metadata();
+	for (i = 0; i < nfields; i++)
+		track_sort_fields[i] = fields[i];
+	track_sort_nfields = nfields;
+	TRACK_FOR_EACH_ENTRY(te, slab, i)
+		track_set_key(te);
+	track_unlock_metadata();
+
+	return 0;
+}
+
+static void
+track_set_stamp(struct track_stamp *stamp, const struct stat *sb)
+{
+	stamp->mtime = sb->st_mtime;
+	stamp->size = sb->st_size;
+	stamp->ino = sb->st_ino;
+	stamp->dev = sb->st_dev;
+}
+
+/*
+ * Sort an array of tracks in the order defined by track_cmp(). A large array
+ * is split into runs that are sorted by separate threads; pairs of adjacent
+ * runs are then merged, also by separate threads, until one run is left.
+ */
+void
+track_sort(struct track **tracks, size_t ntracks)
+{
+	struct track_sort_job	*jobs;
+	struct track		**buf, **src, **dst, **tmp;
+	size_t			  i, nruns, njobs;
+	size_t			 *bounds;
+	long			  ncpu;
+
+	ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	nruns = ntracks / TRACK_SORT_NTRACKS;
+	if (ncpu > 0 && nruns > (size_t)ncpu)
+		nruns = ncpu;
+	if (nruns > TRACK_SORT_NTHREADS)
+		nruns = TRACK_SORT_NTHREADS;
+
+	if (nruns < 2) {
+		qsort(tracks, ntracks, sizeof *tracks, track_cmp_sort);
+		return;
+	}
+
+	jobs = xreallocarray(NULL, nruns, sizeof *jobs);
+	bounds = xreallocarray(NULL, nruns + 1, sizeof *bounds);
+	for (i = 0; i <= nruns; i++)
+		bounds[i] = ntracks * i / nruns;
+
+	for (i = 0; i < nruns; i++) {
+		jobs[i].src = tracks;
+		jobs[i].lo = bounds[i];
+		jobs[i].hi = bounds[i + 1];
+		XPTHREAD_CREATE(&jobs[i].thd, NULL, track_sort_handler,
+		    &jobs[i]);
+	}
+	for (i = 0; i < nruns; i++)
+		XPTHREAD_JOIN(jobs[i].thd, NULL);
+
+	buf = xreallocarray(NULL, ntracks, sizeof *buf);
+	src = tracks;
+	dst = buf;
+	while (nruns > 1) {
+		njobs = nruns / 2;
+		for (i = 0; i < njobs; i++) {
+			jobs[i].src = src;
+			jobs[i].dst = dst;
+			jobs[i].lo = bounds[2 * i];
+			jobs[i].mid = bounds[2 * i + 1];
+			jobs[i].hi = bounds[2 * i + 2];
+			XPTHREAD_CREATE(&jobs[i].thd, NULL,
+			    track_merge_handler, &jobs[i]);
+		}
+
+		/* An odd run out is copied as is. */
+		if (nruns % 2)
+			memcpy(dst + bounds[nruns - 1], src + bounds[nruns - 1],
+			    (ntracks - bounds[nruns - 1]) * sizeof *dst);
+
+		for (i = 0; i < njobs; i++)
+			XPTHREAD_JOIN(jobs[i].thd, NULL);
+
+		for (i = 0; i < njobs; i++)
+			bounds[i] = bounds[2 * i];
+		if (nruns % 2)
+			bounds[njobs++] = bounds[nruns - 1];
+		bounds[njobs] = ntracks;
+		nruns = njobs;
+
+		tmp = src;
+		src = dst;
+		dst = tmp;
+	}
+
+	if (src != tracks)
+		memcpy(tracks, src, ntracks * sizeof *tracks);
+
+	free(buf);
+	free(bounds);
+	free(jobs);
+}
+
+static void *
+track_sort_handler(void *p)
+{
+	struct track_sort_job	*job;
+	sigset_t		 ss;
+
+	/* Let the main thread handle all signals. */
+	sigfillset(&ss);
+	pthread_sigmask(SIG_BLOCK, &ss, NULL);
+
+	job = p;
+	qsort(job->src + job->lo, job->hi - job->lo, sizeof *job->src,
+	    track_cmp_sort);
+	return NULL;
+}
+
 void
 track_split_tag(const char *tag, char **fld1, char **fld2)
 {
@@ -392,30 +1595,86 @@ track_split_tag(const char *tag, char **fld1, char **fld2)
 		*fld2 = xstrdup(tag + pos + 1);
 }
 
+/*
+ * Get the file status of a track. The directory of the track is opened and
+ * kept in dir, so that the status of the other tracks in the same directory
+ * can be obtained without looking up the directory again.
+ */
+static int
+track_stat(struct track *t, struct track_dir *dir, struct stat *sb)
+{
+	size_t len;
+
+	len = t->filename - t->path;
+	if (len == 0) {
+		if (stat(t->path, sb) == -1)
+			return -1;
+		return 0;
+	}
+
+	if (dir->path == NULL || dir->len != len ||
+	    strncmp(dir->path, t->path, len)) {
+		if (dir->fd != -1)
+			close(dir->fd);
+		free(dir->path);
+		dir->path = xstrndup(t->path, len);
+		dir->len = len;
+		dir->fd = open(dir->path, O_RDONLY | O_DIRECTORY);
+		dir->error = (dir->fd == -1) ? errno : 0;
+	}
+
+	if (dir->fd == -1) {
+		errno = dir->error;
+		return -1;
+	}
+
+	return fstatat(dir->fd, t->filename, sb, 0);
+}
+
 void
 track_unlock_metadata(void)
 {
 	XPTHREAD_MUTEX_UNLOCK(&track_metadata_mtx);
 }
 
+/*
+ * Update the metadata of tracks whose files have changed. If force is set,
+ * the metadata of all tracks is updated.
+ */
 void
-track_update_metadata(int delete)
+track_update_metadata(int delete, int force)
 {
+	struct track_slab	*slab;
 	struct track_entry	*te;
-	size_t			 i;
+	struct track_job	*jobs;
+	struct track_dir	 dir;
+	struct stat		 sb;
+	size_t			 i, njobs;
+
+	track_load_all_entries();
+
+	if (track_nentries == 0)
+		return;
+
+	jobs = xreallocarray(NULL, track_nentries, sizeof *jobs);
+	njobs = 0;
 
-	i = 1;
-	RB_FOREACH(te, track_tree, &track_tree) {
-		msg_info("Updating track %zu of %zu (%zu%%)", i,
-		    track_nentries, 100 * i / track_nentries);
-		i++;
+	dir.path = NULL;
+	dir.fd = -1;
+	dir.error = 0;
 
-		if (access(te->track.path, F_OK) == -1) {
-			if (delete)
+	TRACK_FOR_EACH_ENTRY(te, slab, i) {
+		if (track_stat(&te->track, &dir, &sb) == -1) {
+			if (delete && !te->delete) {
 				te->delete = 1;
+				track_nchanges++;
+			}
 			continue;
 		}
 
+		if (!force && !track_cmp_stamp(&te->track.stamp, &sb))
+			continue;
+
 		if (te->track.ip == NULL) {
 			te->track.ip = plugin_find_ip(te->track.path);
 			if (te->track.ip == NULL) {
@@ -424,30 +1683,152 @@ track_update_metadata(int delete)
 			}
 		}
 
-		track_lock_metadata();
-		track_free_metadata(te);
-		track_init_metadata(te);
-		te->track.ip->get_metadata(&te->track);
-		track_unlock_metadata();
+		jobs[njobs].te = te;
+		track_set_stamp(&jobs[njobs].stamp, &sb);
+		njobs++;
 	}
 
+	if (dir.fd != -1)
+		close(dir.fd);
+	free(dir.path);
+
+	track_read_metadata(jobs, njobs, 1);
+	free(jobs);
+
 	msg_clear();
-	track_tree_modified = 1;
+	track_nchanges += njobs;
 }
 
-int
-track_write_cache(void)
+/*
+ * Read the metadata of the tracks taken from the job queue.
+ */
+static void *
+track_worker_handler(void *p)
 {
-	struct track_entry *te;
+	struct track_worker	*w;
+	struct track_job	*job;
+	struct track_result	*r;
+	sigset_t		 ss;
 
-	if (cache_open(CACHE_MODE_WRITE) == -1)
-		return -1;
+	/* Let the main thread handle all signals. */
+	sigfillset(&ss);
+	pthread_sigmask(SIG_BLOCK, &ss, NULL);
 
-	RB_FOREACH(te, track_tree, &track_tree)
-		if (!te->delete)
-			cache_write_entry(&te->track);
+	w = p;
+	for (;;) {
+		XPTHREAD_MUTEX_LOCK(&track_pool_mtx);
+		if (track_pool_next < track_pool_njobs)
+			job = &track_pool_jobs[track_pool_next++];
+		else
+			job = NULL;
+		XPTHREAD_MUTEX_UNLOCK(&track_pool_mtx);
 
-	cache_close();
-	track_tree_modified = 0;
-	return 0;
+		if (job == NULL)
+			break;
+
+		/* The path and plug-in of a track do not change. */
+		r = &w->results[w->nresults++];
+		r->te = job->te;
+		memset(&r->track, 0, sizeof r->track);
+		r->track.path = job->te->track.path;
+		r->track.filename = job->te->track.filename;
+		r->track.ip = job->te->track.ip;
+		r->track.stamp = job->stamp;
+		r->track.ip->get_metadata(&r->track);
+
+		if (w->nresults == TRACK_BATCH_SIZE)
+			track_publish_results(w);
+	}
+
+	if (w->nresults > 0)
+		track_publish_results(w);
+
+	return NULL;
+}
+
+/*
+ * Save the metadata cache. The cache file is written by the save thread.
+ *
+ * Entries that have been used in this session are always saved. Of the other
+ * entries, only the most recently used ones are saved if there are more of
+ * them than the cache-size option allows. If report is set, a message is shown
+ * once the cache has been saved.
+ */
+void
+track_write_cache(int report)
+{
+	struct track_slab	*slab;
+	struct track_entry	*te;
+	struct track_unused	*unused;
+	size_t			 i, n, nunused, max;
+	char			*path;
+
+	n = cache_get_nentries();
+	unused = xreallocarray(NULL, n + track_nentries + 1, sizeof *unused);
+	nunused = 0;
+
+	cache_open();
+
+	/* Collect the cached entries that have not been added. */
+	for (i = 0; i < n; i++)
+		if ((path = cache_get_path(i)) != NULL &&
+		    track_lookup_entry(path) == NULL) {
+			unused[nunused].atime = cache_get_atime(i);
+			unused[nunused].idx = i;
+			unused[nunused].te = NULL;
+			nunused++;
+		}
+
+	track_lock_metadata();
+	TRACK_FOR_EACH_ENTRY(te, slab, i) {
+		if (te->delete)
+			continue;
+		if (te->used)
+			track_write_entry(te, track_time);
+		else {
+			unused[nunused].atime = te->atime;
+			unused[nunused].te = te;
+			nunused++;
+		}
+	}
+
+	max = option_get_number("cache-size");
+	if (max > 0 && nunused > max) {
+		LOG_INFO("dropping %zu of %zu unused entries", nunused - max,
+		    nunused);
+		qsort(unused, nunused, sizeof *unused, track_cmp_atime);
+		nunused = max;
+	}
+
+	for (i = 0; i < nunused; i++)
+		if (unused[i].te == NULL)
+			cache_copy_entry(unused[i].idx);
+		else
+			track_write_entry(unused[i].te, unused[i].te->atime);
+	track_unlock_metadata();
+
+	cache_close(report);
+	free(unused);
+	track_nchanges = 0;
+}
+
+/*
+ * Add an entry to the cache being built. If its stream information is still in
+ * the cache that was read, it is copied from there. The metadata mutex must be
+ * locked before calling this function.
+ */
+static void
+track_write_entry(struct track_entry *te, int64_t atime)
+{
+	struct track_probe probe;
+
+	if (!te->cacheprobe || cache_read_probe(te->cacheidx, &probe) == -1) {
+		cache_write_entry(&te->track, atime, te->added);
+		return;
+	}
+
+	te->track.probe = &probe;
+	cache_write_entry(&te->track, atime, te->added);
+	te->track.probe = NULL;
+	free(probe.data);
 }